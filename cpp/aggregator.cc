@@ -0,0 +1,854 @@
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include "aggregator.hh"
+#include "context.hh"
+#include "serialize.hh"
+#include "trace.hh"
+
+namespace hail {
+
+namespace {
+
+// f(x) for the defined values of c, with the switch on the column type
+// outside the loop
+template<typename F> void
+for_each_value(const Column &c, F f) {
+  const uint8_t *missing = c.missing.data();
+  size_t n = c.size;
+  switch (c.type->kind) {
+  case BaseType::Kind::BOOLEAN:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	f((double)c.bools[i]);
+    break;
+  case BaseType::Kind::INT32:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	f((double)c.ints[i]);
+    break;
+  case BaseType::Kind::INT64:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	f((double)c.longs[i]);
+    break;
+  case BaseType::Kind::FLOAT64:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	f(c.doubles[i]);
+    break;
+  default: abort();
+  }
+}
+
+template<typename T> const T &
+cast_aggregator(const Aggregator &a) {
+  assert(dynamic_cast<const T *>(&a));
+  return static_cast<const T &>(a);
+}
+
+uint64_t
+defined_count(const Column &c) {
+  uint64_t n = 0;
+  for (size_t i = 0; i < c.size; ++i)
+    n += !c.missing[i];
+  return n;
+}
+
+// splitmix64 finalizer
+uint64_t
+mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// serialized states start with the aggregator's name
+void
+read_name(std::istream &in, const Aggregator &agg) {
+  std::string name = read_string(in);
+  if (name != agg.name())
+    throw std::runtime_error(fmt::format("expected {} state, got {}", agg.name(), name));
+}
+
+void
+check_parameters(bool same, const Aggregator &agg) {
+  if (!same)
+    throw std::runtime_error(fmt::format("{} state has different parameters", agg.name()));
+}
+
+// the HyperLogLog register i of x over 2^p registers, and the rank of
+// x's hash in it
+inline void
+hll_hash(double x, uint64_t p, uint64_t &i, uint8_t &rank) {
+  // 0.0 and -0.0 are the same value
+  if (x == 0)
+    x = 0;
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  uint64_t h = mix(bits);
+  i = h >> (64 - p);
+  // the guard bit bounds the rank at 64 - p + 1
+  uint64_t w = (h << p) | ((uint64_t)1 << (p - 1));
+  rank = __builtin_clzll(w) + 1;
+}
+
+bool
+is_aggregable(const Type *t) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+  case BaseType::Kind::INT32:
+  case BaseType::Kind::INT64:
+  case BaseType::Kind::FLOAT64:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+Aggregator::~Aggregator() {}
+
+std::ostream &
+operator<<(std::ostream &out, const Aggregator &agg) {
+  return agg.put_to(out);
+}
+
+const char *
+CountAggregator::name() const {
+  return "count";
+}
+
+std::unique_ptr<Aggregator>
+CountAggregator::init() const {
+  return std::make_unique<CountAggregator>();
+}
+
+void
+CountAggregator::update_batch(const Column &c) {
+  n += defined_count(c);
+}
+
+void
+CountAggregator::merge(const Aggregator &that) {
+  n += cast_aggregator<CountAggregator>(that).n;
+}
+
+std::vector<double>
+CountAggregator::finalize() const {
+  return { (double)n };
+}
+
+void
+CountAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_raw<uint64_t>(out, n);
+}
+
+void
+CountAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  n = read_raw<uint64_t>(in);
+}
+
+std::ostream &
+CountAggregator::put_to(std::ostream &out) const {
+  return out << "count: " << n;
+}
+
+const char *
+SumAggregator::name() const {
+  return "sum";
+}
+
+std::unique_ptr<Aggregator>
+SumAggregator::init() const {
+  return std::make_unique<SumAggregator>();
+}
+
+void
+SumAggregator::update_batch(const Column &c) {
+  double s = 0;
+  for_each_value(c, [&s](double x) { s += x; });
+  sum += s;
+}
+
+void
+SumAggregator::merge(const Aggregator &that) {
+  sum += cast_aggregator<SumAggregator>(that).sum;
+}
+
+std::vector<double>
+SumAggregator::finalize() const {
+  return { sum };
+}
+
+void
+SumAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_raw<double>(out, sum);
+}
+
+void
+SumAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  sum = read_raw<double>(in);
+}
+
+std::ostream &
+SumAggregator::put_to(std::ostream &out) const {
+  return out << "sum: " << sum;
+}
+
+const char *
+StatsAggregator::name() const {
+  return "stats";
+}
+
+std::unique_ptr<Aggregator>
+StatsAggregator::init() const {
+  return std::make_unique<StatsAggregator>();
+}
+
+// the batch's mean and squared deviations in two passes, combined
+// with the running state as in merge()
+void
+StatsAggregator::update_batch(const Column &c) {
+  uint64_t batch_n = 0;
+  double sum = 0;
+  for_each_value(c, [&](double x) { ++batch_n; sum += x; });
+  if (batch_n == 0)
+    return;
+  double batch_mean = sum / batch_n;
+  double batch_m2 = 0;
+  for_each_value(c, [&](double x) { batch_m2 += (x - batch_mean) * (x - batch_mean); });
+  combine(batch_n, batch_mean, batch_m2);
+}
+
+void
+StatsAggregator::combine(uint64_t that_n, double that_mean, double that_m2) {
+  if (that_n == 0)
+    return;
+  uint64_t new_n = n + that_n;
+  double delta = that_mean - mean;
+  mean += delta * that_n / new_n;
+  m2 += that_m2 + delta * delta * ((double)n * that_n / new_n);
+  n = new_n;
+}
+
+void
+StatsAggregator::merge(const Aggregator &that_) {
+  auto &that = cast_aggregator<StatsAggregator>(that_);
+  combine(that.n, that.mean, that.m2);
+}
+
+std::vector<double>
+StatsAggregator::finalize() const {
+  return { (double)n, mean, variance() };
+}
+
+void
+StatsAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_raw<uint64_t>(out, n);
+  write_raw<double>(out, mean);
+  write_raw<double>(out, m2);
+}
+
+void
+StatsAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  n = read_raw<uint64_t>(in);
+  mean = read_raw<double>(in);
+  m2 = read_raw<double>(in);
+}
+
+std::ostream &
+StatsAggregator::put_to(std::ostream &out) const {
+  return out << "n: " << n << ", mean: " << mean << ", variance: " << variance();
+}
+
+MinMaxAggregator::MinMaxAggregator()
+  : n(0),
+    min(std::numeric_limits<double>::infinity()),
+    max(-std::numeric_limits<double>::infinity()) {}
+
+const char *
+MinMaxAggregator::name() const {
+  return "minmax";
+}
+
+std::unique_ptr<Aggregator>
+MinMaxAggregator::init() const {
+  return std::make_unique<MinMaxAggregator>();
+}
+
+void
+MinMaxAggregator::update_batch(const Column &c) {
+  uint64_t batch_n = 0;
+  double lo = min, hi = max;
+  for_each_value(c, [&](double x) {
+      ++batch_n;
+      lo = std::min(lo, x);
+      hi = std::max(hi, x);
+    });
+  n += batch_n;
+  min = lo;
+  max = hi;
+}
+
+void
+MinMaxAggregator::merge(const Aggregator &that_) {
+  auto &that = cast_aggregator<MinMaxAggregator>(that_);
+  n += that.n;
+  min = std::min(min, that.min);
+  max = std::max(max, that.max);
+}
+
+std::vector<double>
+MinMaxAggregator::finalize() const {
+  if (n == 0)
+    return { NAN, NAN };
+  return { min, max };
+}
+
+void
+MinMaxAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_raw<uint64_t>(out, n);
+  write_raw<double>(out, min);
+  write_raw<double>(out, max);
+}
+
+void
+MinMaxAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  n = read_raw<uint64_t>(in);
+  min = read_raw<double>(in);
+  max = read_raw<double>(in);
+}
+
+std::ostream &
+MinMaxAggregator::put_to(std::ostream &out) const {
+  auto r = finalize();
+  return out << "min: " << r[0] << ", max: " << r[1];
+}
+
+HistogramAggregator::HistogramAggregator(double lo, double hi, uint64_t n_bins)
+  : lo(lo), hi(hi), bins(n_bins), n_below(0), n_above(0) {
+  if (!(lo < hi) || n_bins == 0)
+    throw std::runtime_error(fmt::format("bad histogram: [{}, {}] in {} bins", lo, hi, n_bins));
+}
+
+const char *
+HistogramAggregator::name() const {
+  return "histogram";
+}
+
+std::unique_ptr<Aggregator>
+HistogramAggregator::init() const {
+  return std::make_unique<HistogramAggregator>(lo, hi, bins.size());
+}
+
+// as update(), with the bounds and counts in locals
+void
+HistogramAggregator::update_batch(const Column &c) {
+  const double l = lo, h = hi, width = hi - lo;
+  const uint64_t n_bins = bins.size();
+  uint64_t *b = bins.data();
+  uint64_t below = 0, above = 0;
+  for_each_value(c, [&](double x) {
+      if (x < l)
+	++below;
+      else if (x > h)
+	++above;
+      else if (x >= l)
+	++b[std::min((uint64_t)((x - l) / width * n_bins), n_bins - 1)];
+    });
+  n_below += below;
+  n_above += above;
+}
+
+void
+HistogramAggregator::merge(const Aggregator &that_) {
+  auto &that = cast_aggregator<HistogramAggregator>(that_);
+  assert(that.bins.size() == bins.size());
+  for (size_t i = 0; i < bins.size(); ++i)
+    bins[i] += that.bins[i];
+  n_below += that.n_below;
+  n_above += that.n_above;
+}
+
+std::vector<double>
+HistogramAggregator::finalize() const {
+  std::vector<double> r;
+  r.push_back(n_below);
+  for (uint64_t b : bins)
+    r.push_back(b);
+  r.push_back(n_above);
+  return r;
+}
+
+void
+HistogramAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_raw<double>(out, lo);
+  write_raw<double>(out, hi);
+  write_vector(out, bins);
+  write_raw<uint64_t>(out, n_below);
+  write_raw<uint64_t>(out, n_above);
+}
+
+void
+HistogramAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  double new_lo = read_raw<double>(in);
+  double new_hi = read_raw<double>(in);
+  std::vector<uint64_t> new_bins = read_vector<uint64_t>(in);
+  check_parameters(new_lo == lo && new_hi == hi && new_bins.size() == bins.size(), *this);
+  bins = std::move(new_bins);
+  n_below = read_raw<uint64_t>(in);
+  n_above = read_raw<uint64_t>(in);
+}
+
+std::ostream &
+HistogramAggregator::put_to(std::ostream &out) const {
+  out << "histogram [" << lo << ", " << hi << "]: " << n_below << " |";
+  for (uint64_t b : bins)
+    out << " " << b;
+  return out << " | " << n_above;
+}
+
+QuantileAggregator::QuantileAggregator(const std::vector<double> &qs, uint64_t k)
+  : qs(qs), k(k), n(0), size(0), max_size(0), rng(0x9e3779b97f4a7c15ULL) {
+  if (k < 8)
+    throw std::runtime_error(fmt::format("quantile sketch size too small: {}", k));
+  for (double q : qs)
+    if (!(q >= 0 && q <= 1))
+      throw std::runtime_error(fmt::format("bad quantile: {}", q));
+  add_level();
+}
+
+const char *
+QuantileAggregator::name() const {
+  return "quantiles";
+}
+
+std::unique_ptr<Aggregator>
+QuantileAggregator::init() const {
+  return std::make_unique<QuantileAggregator>(qs, k);
+}
+
+// capacities shrink by 2/3 per level below the top
+uint64_t
+QuantileAggregator::capacity(uint64_t h) const {
+  uint64_t depth = levels.size() - 1 - h;
+  return std::max<uint64_t>(2, (uint64_t)std::ceil(k * std::pow(2.0 / 3.0, depth)));
+}
+
+void
+QuantileAggregator::add_level() {
+  levels.emplace_back();
+  max_size = 0;
+  for (uint64_t h = 0; h < levels.size(); ++h)
+    max_size += capacity(h);
+}
+
+bool
+QuantileAggregator::coin() {
+  // xorshift64
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng & 1;
+}
+
+void
+QuantileAggregator::compress() {
+  while (size >= max_size) {
+    uint64_t h = 0;
+    while (levels[h].size() < capacity(h))
+      ++h;
+    if (h + 1 == levels.size())
+      add_level();
+
+    std::vector<double> &l = levels[h];
+    std::sort(l.begin(), l.end());
+    // an odd item out stays at this level
+    double odd = 0;
+    bool has_odd = l.size() & 1;
+    if (has_odd) {
+      odd = l.back();
+      l.pop_back();
+    }
+    std::vector<double> &next = levels[h + 1];
+    for (size_t i = coin(); i < l.size(); i += 2)
+      next.push_back(l[i]);
+    size -= l.size() / 2;
+    l.clear();
+    if (has_odd)
+      l.push_back(odd);
+  }
+}
+
+// the defined values are appended to level 0 in runs that fill it up
+// to the next compression, the same sketch as updating one at a time
+void
+QuantileAggregator::update_batch(const Column &c) {
+  batch.clear();
+  for_each_value(c, [this](double x) {
+      if (x == x)
+	batch.push_back(x);
+    });
+  n += batch.size();
+  for (size_t i = 0; i < batch.size(); ) {
+    size_t k = std::min<uint64_t>(batch.size() - i, max_size - size);
+    levels[0].insert(levels[0].end(), batch.begin() + i, batch.begin() + i + k);
+    size += k;
+    i += k;
+    if (size >= max_size)
+      compress();
+  }
+}
+
+void
+QuantileAggregator::merge(const Aggregator &that_) {
+  auto &that = cast_aggregator<QuantileAggregator>(that_);
+  while (levels.size() < that.levels.size())
+    add_level();
+  for (size_t h = 0; h < that.levels.size(); ++h)
+    levels[h].insert(levels[h].end(), that.levels[h].begin(), that.levels[h].end());
+  n += that.n;
+  size += that.size;
+  compress();
+}
+
+double
+QuantileAggregator::quantile(double q) const {
+  if (n == 0)
+    return NAN;
+
+  std::vector<std::pair<double, uint64_t>> items;
+  uint64_t total = 0;
+  for (size_t h = 0; h < levels.size(); ++h)
+    for (double x : levels[h]) {
+      items.emplace_back(x, (uint64_t)1 << h);
+      total += (uint64_t)1 << h;
+    }
+  std::sort(items.begin(), items.end());
+
+  double target = q * total;
+  uint64_t weight = 0;
+  for (const auto &p : items) {
+    weight += p.second;
+    if (weight >= target)
+      return p.first;
+  }
+  return items.back().first;
+}
+
+std::vector<double>
+QuantileAggregator::finalize() const {
+  std::vector<double> r;
+  for (double q : qs)
+    r.push_back(quantile(q));
+  return r;
+}
+
+void
+QuantileAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_vector(out, qs);
+  write_raw<uint64_t>(out, k);
+  write_raw<uint64_t>(out, n);
+  write_raw<uint64_t>(out, levels.size());
+  for (const auto &l : levels)
+    write_vector(out, l);
+  write_raw<uint64_t>(out, rng);
+}
+
+void
+QuantileAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  std::vector<double> new_qs = read_vector<double>(in);
+  uint64_t new_k = read_raw<uint64_t>(in);
+  check_parameters(new_qs == qs && new_k == k, *this);
+  n = read_raw<uint64_t>(in);
+  uint64_t n_levels = read_raw<uint64_t>(in);
+  if (n_levels == 0 || n_levels > 64)
+    throw std::runtime_error(fmt::format("bad {} state: {} levels", name(), n_levels));
+  levels.clear();
+  size = 0;
+  for (uint64_t h = 0; h < n_levels; ++h) {
+    levels.push_back(read_vector<double>(in));
+    size += levels.back().size();
+  }
+  max_size = 0;
+  for (uint64_t h = 0; h < levels.size(); ++h)
+    max_size += capacity(h);
+  rng = read_raw<uint64_t>(in);
+}
+
+std::ostream &
+QuantileAggregator::put_to(std::ostream &out) const {
+  out << "quantiles:";
+  for (double q : qs)
+    out << " " << q << ": " << quantile(q);
+  return out;
+}
+
+DistinctAggregator::DistinctAggregator(uint64_t p)
+  : p(p), registers((uint64_t)1 << p) {
+  if (p < 4 || p > 18)
+    throw std::runtime_error(fmt::format("bad HyperLogLog precision: {}", p));
+}
+
+const char *
+DistinctAggregator::name() const {
+  return "distinct";
+}
+
+std::unique_ptr<Aggregator>
+DistinctAggregator::init() const {
+  return std::make_unique<DistinctAggregator>(p);
+}
+
+void
+DistinctAggregator::update(double x) {
+  uint64_t i;
+  uint8_t rank;
+  hll_hash(x, p, i, rank);
+  if (registers[i] < rank)
+    registers[i] = rank;
+}
+
+void
+DistinctAggregator::update_batch(const Column &c) {
+  const uint64_t bits = p;
+  uint8_t *r = registers.data();
+  for_each_value(c, [&](double x) {
+      uint64_t i;
+      uint8_t rank;
+      hll_hash(x, bits, i, rank);
+      r[i] = std::max(r[i], rank);
+    });
+}
+
+void
+DistinctAggregator::merge(const Aggregator &that_) {
+  auto &that = cast_aggregator<DistinctAggregator>(that_);
+  assert(that.p == p);
+  for (size_t i = 0; i < registers.size(); ++i)
+    registers[i] = std::max(registers[i], that.registers[i]);
+}
+
+double
+DistinctAggregator::estimate() const {
+  double m = registers.size();
+  double sum = 0;
+  uint64_t zeros = 0;
+  for (uint8_t r : registers) {
+    sum += std::ldexp(1.0, -(int)r);
+    zeros += r == 0;
+  }
+  double alpha = 0.7213 / (1 + 1.079 / m);
+  double e = alpha * m * m / sum;
+  // linear counting for small cardinalities
+  if (e <= 2.5 * m && zeros > 0)
+    e = m * std::log(m / zeros);
+  return e;
+}
+
+std::vector<double>
+DistinctAggregator::finalize() const {
+  return { estimate() };
+}
+
+void
+DistinctAggregator::serialize(std::ostream &out) const {
+  write_string(out, name());
+  write_raw<uint64_t>(out, p);
+  write_vector(out, registers);
+}
+
+void
+DistinctAggregator::deserialize(std::istream &in) {
+  read_name(in, *this);
+  uint64_t new_p = read_raw<uint64_t>(in);
+  std::vector<uint8_t> new_registers = read_vector<uint8_t>(in);
+  check_parameters(new_p == p && new_registers.size() == registers.size(), *this);
+  registers = std::move(new_registers);
+}
+
+std::ostream &
+DistinctAggregator::put_to(std::ostream &out) const {
+  return out << "distinct: " << (uint64_t)std::round(estimate());
+}
+
+Aggregation::Aggregation(Context &c, const TMatrixTable *type)
+  : c(c), type(type) {}
+
+void
+Aggregation::filter_rows(RowPredicate p) {
+  filter = std::move(p);
+}
+
+size_t
+Aggregation::add(const ExprPtr &e, std::unique_ptr<Aggregator> agg) {
+  size_t input = 0;
+  while (input < inputs.size() && inputs[input].e != e)
+    ++input;
+  if (input == inputs.size()) {
+    CompiledExpr compiled = compile(c, e, "row", type->row_impl_type);
+    bool elements = false;
+    const Type *t = compiled.type;
+    if (auto ta = dyn_cast<TArray>(t)) {
+      elements = true;
+      t = ta->element_type;
+    }
+    if (!is_aggregable(t))
+      throw ExprError(fmt::format("cannot aggregate {}", compiled.type->to_string()));
+    inputs.push_back(Input { e, std::move(compiled), elements });
+  }
+  aggregators.push_back(std::move(agg));
+  aggregator_input.push_back(input);
+  return aggregators.size() - 1;
+}
+
+std::vector<std::unique_ptr<Aggregator>>
+Aggregation::init() const {
+  std::vector<std::unique_ptr<Aggregator>> aggs;
+  for (const auto &a : aggregators)
+    aggs.push_back(a->init());
+  return aggs;
+}
+
+void
+Aggregation::aggregate_part(const std::shared_ptr<const MatrixTable> &mt, uint64_t part,
+			    std::vector<std::unique_ptr<Aggregator>> &aggs,
+			    uint64_t &n_rows) const {
+  TraceSpan span("aggregate", "part", part);
+  auto i = mt->iterator(PartitionRange { part, part + 1 });
+  n_rows = 0;
+  // the filter sees every row; without one, next() does
+  bool count_filtered = bool(filter);
+  if (filter)
+    i->filter_rows([this, &n_rows](const TypedRegionValue &rv) {
+	++n_rows;
+	return filter(rv);
+      });
+  // rows are read without their entries if no input needs them
+  if (std::none_of(inputs.begin(), inputs.end(),
+		   [](const Input &input) { return references_field(input.e, "row", "gs"); }))
+    i->lazy_entries();
+  i->use_batches();
+  
+  std::vector<Column> values(inputs.size());
+  std::vector<offset_t> rows;
+  const Region *region = nullptr;
+  auto aggregate_batch = [&]() {
+    if (rows.empty())
+      return;
+    for (size_t j = 0; j < inputs.size(); ++j)
+      inputs[j].compiled.eval(*region, rows.data(), rows.size(), values[j]);
+    for (size_t j = 0; j < aggs.size(); ++j) {
+      const Input &input = inputs[aggregator_input[j]];
+      const Column &v = values[aggregator_input[j]];
+      aggs[j]->update_batch(input.elements ? *v.elements : v);
+    }
+    rows.clear();
+    i->clear_batch();
+  };
+  while (i->has_next()) {
+    TypedRegionValue row = i->next();
+    if (!count_filtered)
+      ++n_rows;
+    region = row.get_region();
+    rows.push_back(row.get_offset());
+    if (rows.size() == batch_size || region->end >= max_batch_bytes)
+      aggregate_batch();
+  }
+  aggregate_batch();
+}
+
+std::vector<std::unique_ptr<Aggregator>>
+Aggregation::run(const std::shared_ptr<const MatrixTable> &mt,
+		 PartitionRange parts,
+		 unsigned n_threads) const {
+  if (parts.begin == parts.end)
+    return init();
+  return merge_partitions(run_partitions(mt, parts, n_threads));
+}
+
+std::vector<std::vector<std::unique_ptr<Aggregator>>>
+Aggregation::run_partitions(const std::shared_ptr<const MatrixTable> &mt,
+			    PartitionRange parts,
+			    unsigned n_threads,
+			    std::vector<uint64_t> *n_rows) const {
+  uint64_t n_parts = parts.end - parts.begin;
+  if (n_rows)
+    n_rows->assign(n_parts, 0);
+  if (n_parts == 0)
+    return {};
+
+  if (n_threads == 0)
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  n_threads = std::min<uint64_t>(n_threads, n_parts);
+
+  std::vector<std::vector<std::unique_ptr<Aggregator>>> results(n_parts);
+  std::atomic<uint64_t> next_part(0);
+  std::vector<std::exception_ptr> errors(n_threads);
+  auto work = [&](unsigned t) {
+    try {
+      for (;;) {
+	uint64_t k = next_part++;
+	if (k >= n_parts)
+	  break;
+	results[k] = init();
+	uint64_t n;
+	aggregate_part(mt, parts.begin + k, results[k], n);
+	if (n_rows)
+	  (*n_rows)[k] = n;
+      }
+    } catch (...) {
+      errors[t] = std::current_exception();
+      // stop the other workers
+      next_part = n_parts;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < n_threads; ++t)
+    threads.emplace_back(work, t);
+  work(0);
+  for (auto &t : threads)
+    t.join();
+  for (auto &e : errors)
+    if (e)
+      std::rethrow_exception(e);
+  return results;
+}
+
+std::vector<std::unique_ptr<Aggregator>>
+Aggregation::merge_partitions(std::vector<std::vector<std::unique_ptr<Aggregator>>> results) {
+  uint64_t n_parts = results.size();
+  assert(n_parts > 0);
+  for (uint64_t step = 1; step < n_parts; step *= 2)
+    for (uint64_t k = 0; k + step < n_parts; k += 2 * step)
+      for (size_t j = 0; j < results[k].size(); ++j)
+	results[k][j]->merge(*results[k + step][j]);
+  return std::move(results[0]);
+}
+
+} // namespace hail
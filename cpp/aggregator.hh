@@ -0,0 +1,314 @@
+#ifndef HAIL_AGGREGATOR_HH
+#define HAIL_AGGREGATOR_HH
+#pragma once
+
+#include <algorithm>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "expr.hh"
+#include "matrixtable.hh"
+
+namespace hail {
+
+// Combinable aggregation state over numeric values (Booleans count as 0
+// and 1).  Missing values are never passed to an aggregator.
+class Aggregator {
+public:
+  virtual ~Aggregator();
+
+  virtual const char *name() const = 0;
+
+  // a new aggregator with the same parameters in its initial state
+  virtual std::unique_ptr<Aggregator> init() const = 0;
+
+  virtual void update(double x) = 0;
+
+  // update with the defined values of c, a Boolean or numeric column
+  virtual void update_batch(const Column &c) = 0;
+
+  // that must have been created by init() from the same prototype
+  virtual void merge(const Aggregator &that) = 0;
+
+  virtual std::vector<double> finalize() const = 0;
+
+  // Write the state to out.  deserialize() replaces the state with one
+  // written by an aggregator with the same parameters, and throws
+  // std::runtime_error if in holds another aggregator's state or is
+  // truncated.
+  virtual void serialize(std::ostream &out) const = 0;
+  virtual void deserialize(std::istream &in) = 0;
+
+  virtual std::ostream &put_to(std::ostream &out) const = 0;
+};
+
+extern std::ostream &operator<<(std::ostream &out, const Aggregator &agg);
+
+// finalize: n
+class CountAggregator final : public Aggregator {
+public:
+  uint64_t n;
+
+  CountAggregator() : n(0) {}
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x) { ++n; }
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+};
+
+// finalize: sum
+class SumAggregator final : public Aggregator {
+public:
+  double sum;
+
+  SumAggregator() : sum(0) {}
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x) { sum += x; }
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+};
+
+// Welford's online mean and variance; merge uses the pairwise update
+// of Chan et al.  finalize: n, mean, variance (population)
+class StatsAggregator final : public Aggregator {
+public:
+  uint64_t n;
+  double mean;
+  // sum of squared deviations from the mean
+  double m2;
+
+  StatsAggregator() : n(0), mean(0), m2(0) {}
+
+  // add the state of that_n values with mean that_mean and m2 that_m2
+  void combine(uint64_t that_n, double that_mean, double that_m2);
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x) {
+    ++n;
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+  }
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+
+  double variance() const { return n ? m2 / n : 0; }
+};
+
+// finalize: min, max (NaN if there were no values)
+class MinMaxAggregator final : public Aggregator {
+public:
+  uint64_t n;
+  double min;
+  double max;
+
+  MinMaxAggregator();
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x) {
+    ++n;
+    min = std::min(min, x);
+    max = std::max(max, x);
+  }
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+};
+
+// n_bins equal bins over [lo, hi]; hi falls in the last bin.  NaN is
+// not counted.  finalize: n_below, bins..., n_above
+class HistogramAggregator final : public Aggregator {
+public:
+  double lo;
+  double hi;
+  std::vector<uint64_t> bins;
+  uint64_t n_below;
+  uint64_t n_above;
+
+  HistogramAggregator(double lo, double hi, uint64_t n_bins);
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x) {
+    if (x < lo)
+      ++n_below;
+    else if (x > hi)
+      ++n_above;
+    else if (x >= lo)
+      ++bins[std::min((uint64_t)((x - lo) / (hi - lo) * bins.size()), (uint64_t)bins.size() - 1)];
+  }
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+};
+
+// Approximate quantiles with a KLL sketch: a stack of compactors where
+// an item at level h stands for 2^h values.  A full compactor sorts
+// itself and promotes every other item to the next level.  The rank
+// error is about 1.7 / k.  Compaction offsets come from a fixed-seed
+// generator, so a given sequence of updates and merges always gives
+// the same sketch.  finalize: the value at each of qs
+class QuantileAggregator final : public Aggregator {
+  std::vector<double> qs;
+  uint64_t k;
+  uint64_t n;
+  std::vector<std::vector<double>> levels;
+  // items held, and the sum of the level capacities
+  uint64_t size;
+  uint64_t max_size;
+  uint64_t rng;
+  // defined values of the current update_batch()
+  std::vector<double> batch;
+
+  uint64_t capacity(uint64_t h) const;
+  void add_level();
+  bool coin();
+  void compress();
+
+public:
+  static const uint64_t default_k = 200;
+
+  QuantileAggregator(const std::vector<double> &qs, uint64_t k = default_k);
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x) {
+    if (x != x)
+      return;
+    ++n;
+    levels[0].push_back(x);
+    if (++size >= max_size)
+      compress();
+  }
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+
+  // NaN if there were no values
+  double quantile(double q) const;
+};
+
+// Approximate number of distinct values with HyperLogLog over 2^p
+// registers; the standard error is about 1.04 / sqrt(2^p).
+// finalize: estimate
+class DistinctAggregator final : public Aggregator {
+  uint64_t p;
+  std::vector<uint8_t> registers;
+
+public:
+  static const uint64_t default_p = 12;
+
+  DistinctAggregator(uint64_t p = default_p);
+
+  const char *name() const;
+  std::unique_ptr<Aggregator> init() const;
+  void update(double x);
+  void update_batch(const Column &c);
+  void merge(const Aggregator &that);
+  std::vector<double> finalize() const;
+  void serialize(std::ostream &out) const;
+  void deserialize(std::istream &in);
+  std::ostream &put_to(std::ostream &out) const;
+
+  double estimate() const;
+};
+
+// Several aggregators computed in one pass over a MatrixTable.  Each
+// aggregates an expression over the row; array-valued expressions are
+// aggregated element by element, so
+//
+//   array_map(row.gs, g, g.DP)
+//
+// aggregates over entries.  Expressions are evaluated once per row
+// however many aggregators share them.
+class Aggregation {
+  class Input {
+  public:
+    ExprPtr e;
+    CompiledExpr compiled;
+    bool elements;
+  };
+
+  // rows are aggregated in batches of up to batch_size rows, cut short
+  // once their region reaches max_batch_bytes
+  static const size_t batch_size = 1024;
+  static const size_t max_batch_bytes = 64 << 20;
+
+  Context &c;
+  const TMatrixTable *type;
+  RowPredicate filter;
+  std::vector<Input> inputs;
+  // prototypes
+  std::vector<std::unique_ptr<Aggregator>> aggregators;
+  std::vector<size_t> aggregator_input;
+
+  // n_rows counts the rows of the partition, filtered or not
+  void aggregate_part(const std::shared_ptr<const MatrixTable> &mt, uint64_t part,
+		      std::vector<std::unique_ptr<Aggregator>> &aggs,
+		      uint64_t &n_rows) const;
+
+public:
+  Aggregation(Context &c, const TMatrixTable *type);
+
+  void filter_rows(RowPredicate p);
+
+  // e must be Boolean or numeric, or an array of them; throws
+  // ExprError otherwise.  Returns the index of agg in the result of
+  // run().
+  size_t add(const ExprPtr &e, std::unique_ptr<Aggregator> agg);
+
+  // the aggregators with no rows aggregated
+  std::vector<std::unique_ptr<Aggregator>> init() const;
+
+  // Each partition is aggregated separately by a pool of n_threads
+  // workers (0 for one per core), and the partition results are merged
+  // pairwise in a tree in partition order, so the result does not
+  // depend on n_threads.
+  std::vector<std::unique_ptr<Aggregator>> run(const std::shared_ptr<const MatrixTable> &mt,
+					       PartitionRange parts,
+					       unsigned n_threads = 0) const;
+
+  // The steps of run(): the aggregators of each partition, and their
+  // merge.  Merging the partition results of adjacent ranges, in order,
+  // gives the same result as run() over the whole range.  results must
+  // not be empty.  If n_rows is given, it is set to the number of rows
+  // in each partition, before the filter, counted in the same pass.
+  std::vector<std::vector<std::unique_ptr<Aggregator>>> run_partitions(const std::shared_ptr<const MatrixTable> &mt,
+								       PartitionRange parts,
+								       unsigned n_threads = 0,
+								       std::vector<uint64_t> *n_rows = nullptr) const;
+  static std::vector<std::unique_ptr<Aggregator>> merge_partitions(std::vector<std::vector<std::unique_ptr<Aggregator>>> results);
+};
+
+} // namespace hail
+
+#endif // HAIL_AGGREGATOR_HH
@@ -0,0 +1,442 @@
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include "aggregator.hh"
+#include "blockcache.hh"
+#include "codec.hh"
+#include "context.hh"
+#include "expr.hh"
+#include "grm.hh"
+#include "inputbuffer.hh"
+#include "intervals.hh"
+#include "matrixtable.hh"
+#include "pages.hh"
+#include "perfcounters.hh"
+#include "shard.hh"
+#include "trace.hh"
+
+namespace {
+
+using Args = std::vector<std::string>;
+
+class Timer {
+  std::chrono::steady_clock::time_point before;
+public:
+  Timer() : before(std::chrono::steady_clock::now()) {}
+
+  double elapsed_s() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+  }
+};
+
+void
+bench_scan(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  int iterations = args.size() > 1 ? std::stoi(args[1]) : 3;
+
+  for (int i = 0; i < iterations; ++i) {
+    Timer t;
+    uint64_t n = mt->count_rows();
+    double s = t.elapsed_s();
+    std::cout << fmt::format("scan {}: {} rows in {:.3f}s ({:.0f} rows/s)\n",
+			     i, n, s, n / s);
+  }
+}
+
+// compression ratio and throughput of each codec on the dataset's
+// own (decompressed) blocks
+void
+bench_codecs(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  size_t max_blocks = args.size() > 1 ? std::stoul(args[1]) : 256;
+
+  std::vector<std::string> blocks;
+  size_t total = 0;
+  for (uint64_t part = 0; part < mt->n_partitions && blocks.size() < max_blocks; ++part) {
+    hail::BlockInputBuffer in(mt->codec, open(mt->part_filename(part).c_str(), O_RDONLY));
+    while (blocks.size() < max_blocks && in.next_block()) {
+      blocks.emplace_back(in.buf, in.end);
+      total += in.end;
+      in.off = in.end;
+    }
+  }
+  std::cout << fmt::format("{} blocks, {} bytes (dataset codec {})\n",
+			   blocks.size(), total, mt->codec->name());
+
+  hail::LZ4Codec lz4;
+  hail::ZstdCodec zstd1(1), zstd3(3), zstd9(9), zstd19(19);
+  hail::RawCodec raw;
+  std::vector<std::pair<std::string, const hail::BlockCodec *>> codecs = {
+    { "lz4", &lz4 },
+    { "zstd-1", &zstd1 },
+    { "zstd-3", &zstd3 },
+    { "zstd-9", &zstd9 },
+    { "zstd-19", &zstd19 },
+    { "raw", &raw },
+  };
+
+  std::cout << fmt::format("{:<10}{:>14}{:>10}{:>14}{:>14}\n",
+			   "codec", "bytes", "ratio", "comp MB/s", "decomp MB/s");
+  for (const auto &p : codecs) {
+    const hail::BlockCodec *codec = p.second;
+    std::vector<std::string> compressed;
+    size_t comp_total = 0;
+    Timer ct;
+    for (const auto &b : blocks) {
+      std::string comp(codec->max_compressed_size(b.size()), '\0');
+      comp.resize(codec->compress(b.data(), b.size(), &comp[0], comp.size()));
+      comp_total += comp.size();
+      compressed.push_back(std::move(comp));
+    }
+    double comp_s = ct.elapsed_s();
+
+    std::string out(hail::BlockInputBuffer::block_size, '\0');
+    Timer dt;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      codec->decompress(compressed[i].data(), compressed[i].size(), &out[0], blocks[i].size());
+      if (memcmp(out.data(), blocks[i].data(), blocks[i].size()) != 0)
+	throw std::runtime_error(fmt::format("{}: round trip mismatch", p.first));
+    }
+    double decomp_s = dt.elapsed_s();
+
+    std::cout << fmt::format("{:<10}{:>14}{:>10.2f}{:>14.1f}{:>14.1f}\n",
+			     p.first, comp_total, (double)total / comp_total,
+			     total / comp_s * 1e-6, total / decomp_s * 1e-6);
+  }
+}
+
+void
+bench_grm(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  unsigned n_threads = args.size() > 2 ? std::stoul(args[2]) : 0;
+
+  Timer t;
+  uint64_t m = hail::grm(c, mt, args[1], n_threads);
+  double s = t.elapsed_s();
+  uint64_t n = mt->n_cols;
+  std::cout << fmt::format("grm: {} samples, {} variants in {:.3f}s ({:.2f} GFLOP/s)\n",
+			   n, m, s, (double)n * (n + 1) * m / s * 1e-9);
+}
+
+// the blocked GRM kernel against the naive triple loop on random
+// standardized genotypes
+void
+bench_grm_kernel(hail::Context &c, const Args &args) {
+  uint64_t n = std::stoul(args[1]);
+  uint64_t m = std::stoul(args[2]);
+  unsigned n_threads = args.size() > 3 ? std::stoul(args[3]) : 0;
+
+  std::mt19937_64 rng(0);
+  std::uniform_int_distribution<int> allele(0, 9);
+  std::vector<double> x(m * n);
+  for (uint64_t p = 0; p < m; ++p) {
+    for (uint64_t i = 0; i < n; ++i) {
+      int a = allele(rng);
+      x[p * n + i] = a == 0 ? NAN : (a > 4) + (a > 7);
+    }
+    hail::normalize_row(&x[p * n], n, true);
+  }
+
+  Timer bt;
+  hail::GrmAccumulator acc(args[0], n, n_threads);
+  for (uint64_t p = 0; p < m; ++p)
+    acc.add_row(&x[p * n]);
+  acc.finish();
+  double blocked_s = bt.elapsed_s();
+
+  Timer nt;
+  std::vector<double> g(n * n);
+  for (uint64_t i = 0; i < n; ++i)
+    for (uint64_t j = i; j < n; ++j) {
+      double sum = 0;
+      for (uint64_t p = 0; p < m; ++p)
+	sum += x[p * n + i] * x[p * n + j];
+      g[i * n + j] = g[j * n + i] = sum / m;
+    }
+  double naive_s = nt.elapsed_s();
+
+  hail::BlockMatrix result(args[0]);
+  double max_error = 0;
+  for (uint64_t i = 0; i < n; ++i)
+    for (uint64_t j = 0; j < n; ++j)
+      max_error = std::max(max_error, std::abs(result.get(i, j) - g[i * n + j]));
+
+  double flop = (double)n * (n + 1) * m;
+  std::cout << fmt::format("{:<10}{:>10}{:>12}\n", "kernel", "s", "GFLOP/s");
+  std::cout << fmt::format("{:<10}{:>10.3f}{:>12.2f}\n", "naive", naive_s, flop / naive_s * 1e-9);
+  std::cout << fmt::format("{:<10}{:>10.3f}{:>12.2f}\n", "blocked", blocked_s, flop / blocked_s * 1e-9);
+  std::cout << fmt::format("speedup {:.1f}x, max error {:.3g}\n", naive_s / blocked_s, max_error);
+}
+
+// scans of the dataset loaded into memory, still compressed
+void
+bench_in_memory(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  int iterations = args.size() > 1 ? std::stoi(args[1]) : 3;
+
+  Timer lt;
+  uint64_t n_bytes = mt->load_into_memory();
+  std::cout << fmt::format("loaded {} bytes in {:.3f}s\n", n_bytes, lt.elapsed_s());
+  for (int i = 0; i < iterations; ++i) {
+    Timer t;
+    uint64_t n = mt->count_rows();
+    double s = t.elapsed_s();
+    std::cout << fmt::format("scan {}: {} rows in {:.3f}s ({:.0f} rows/s)\n", i, n, s, n / s);
+  }
+}
+
+// repeated scans through the shared block cache
+void
+bench_block_cache(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  uint64_t capacity = std::stoull(args[1]) << 20;
+  int iterations = args.size() > 2 ? std::stoi(args[2]) : 3;
+
+  hail::BlockCache &cache = hail::BlockCache::global();
+  cache.set_capacity(capacity);
+  for (int i = 0; i < iterations; ++i) {
+    Timer t;
+    uint64_t n = mt->count_rows();
+    double s = t.elapsed_s();
+    hail::BlockCache::Stats st = cache.stats();
+    std::cout << fmt::format("scan {}: {} rows in {:.3f}s, {} hits, {} misses, {} evictions, {} bytes\n",
+			     i, n, s, st.hits, st.misses, st.evictions, st.bytes);
+  }
+  cache.set_capacity(0);
+}
+
+// scans reading decoded rows from a row cache in cache_dir, the first
+// filling it
+void
+bench_row_cache(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  int iterations = args.size() > 2 ? std::stoi(args[2]) : 3;
+
+  Timer pt;
+  uint64_t n = mt->count_rows();
+  std::cout << fmt::format("plain: {} rows in {:.3f}s\n", n, pt.elapsed_s());
+
+  auto cache = std::make_shared<hail::RowCache>(args[1], UINT64_MAX);
+  mt->use_row_cache(cache);
+  for (int i = 0; i < iterations; ++i) {
+    Timer t;
+    n = mt->count_rows();
+    std::cout << fmt::format("cached {}: {} rows in {:.3f}s\n", i, n, t.elapsed_s());
+  }
+  std::cout << fmt::format("cache size {} bytes\n", cache->size());
+}
+
+// a plain scan against a scan filtered by the intervals of a BED file
+void
+bench_intervals(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  int iterations = args.size() > 2 ? std::stoi(args[2]) : 3;
+
+  Timer lt;
+  auto index = hail::IntervalIndex::read_bed(args[1]);
+  std::cout << fmt::format("read {} intervals in {:.3f}s\n", index->n_intervals, lt.elapsed_s());
+
+  for (int i = 0; i < iterations; ++i) {
+    Timer st;
+    uint64_t n = mt->count_rows();
+    double scan_s = st.elapsed_s();
+
+    Timer ft;
+    uint64_t m = mt->count_rows(mt->all_partitions(), hail::interval_filter(index));
+    double filter_s = ft.elapsed_s();
+    std::cout << fmt::format("scan {}: {} rows in {:.3f}s, filtered {} rows in {:.3f}s\n",
+			     i, n, scan_s, m, filter_s);
+  }
+}
+
+// full scans against scans decoding every kth sample's entries
+void
+bench_sample_subset(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  uint64_t k = std::max<uint64_t>(std::stoull(args[1]), 1);
+  int iterations = args.size() > 2 ? std::stoi(args[2]) : 3;
+
+  std::vector<uint64_t> samples;
+  for (uint64_t i = 0; i < mt->n_cols; i += k)
+    samples.push_back(i);
+
+  auto scan = [&](bool subset) {
+    auto it = mt->iterator();
+    if (subset)
+      it->select_samples(samples);
+    uint64_t n = 0;
+    while (it->has_next()) {
+      it->next();
+      ++n;
+    }
+    return n;
+  };
+  for (int i = 0; i < iterations; ++i) {
+    Timer ft;
+    uint64_t n = scan(false);
+    double full_s = ft.elapsed_s();
+    Timer st;
+    scan(true);
+    double subset_s = st.elapsed_s();
+    std::cout << fmt::format("scan {}: {} rows, {} samples in {:.3f}s, {} samples in {:.3f}s\n",
+			     i, n, mt->n_cols, full_s, samples.size(), subset_s);
+  }
+}
+
+// aggregations of pk.pos in one run against n_shards shard results
+// written, read back and merged; throws if they differ
+void
+bench_shards(hail::Context &c, const Args &args) {
+  auto mt = std::make_shared<hail::MatrixTable>(c, args[0]);
+  uint64_t n_shards = std::max<uint64_t>(std::stoull(args[1]), 1);
+
+  hail::Aggregation agg(c, mt->type);
+  for (int k = 0; k < 7; ++k) {
+    std::unique_ptr<hail::Aggregator> a;
+    switch (k) {
+    case 0: a = std::make_unique<hail::CountAggregator>(); break;
+    case 1: a = std::make_unique<hail::SumAggregator>(); break;
+    case 2: a = std::make_unique<hail::StatsAggregator>(); break;
+    case 3: a = std::make_unique<hail::MinMaxAggregator>(); break;
+    case 4: a = std::make_unique<hail::HistogramAggregator>(0, 250e6, 100); break;
+    case 5: a = std::make_unique<hail::QuantileAggregator>(std::vector<double> { 0, 0.25, 0.5, 0.75, 1 }); break;
+    default: a = std::make_unique<hail::DistinctAggregator>(); break;
+    }
+    agg.add(hail::get_field(hail::get_field(hail::ref("row"), "pk"), "pos"), std::move(a));
+  }
+
+  Timer rt;
+  auto expected = agg.run(mt, mt->all_partitions());
+  double run_s = rt.elapsed_s();
+
+  Timer st;
+  std::vector<hail::ShardResult> shards;
+  for (uint64_t i = 0; i < n_shards; ++i) {
+    std::stringstream s;
+    hail::ShardResult::scan(mt, i, n_shards, &agg).write(s);
+    shards.push_back(hail::ShardResult::read(s, &agg));
+  }
+  auto r = hail::ShardResult::merge(std::move(shards));
+  double shards_s = st.elapsed_s();
+  std::cout << fmt::format("run in {:.3f}s, {} shards in {:.3f}s\n", run_s, n_shards, shards_s);
+
+  uint64_t n_rows = mt->count_rows();
+  if (r.n_rows != n_rows)
+    throw std::runtime_error(fmt::format("merged shards count {} rows, expected {}", r.n_rows, n_rows));
+
+  for (size_t j = 0; j < expected.size(); ++j) {
+    std::vector<double> x = expected[j]->finalize(), y = r.aggregators[j]->finalize();
+    std::cout << fmt::format("{}: {}\n", expected[j]->name(), fmt::join(x, " "));
+    // NaN results (min of no values) compare by their bits
+    if (x.size() != y.size() || memcmp(x.data(), y.data(), x.size() * sizeof(double)) != 0)
+      throw std::runtime_error(fmt::format("{}: merged shards give {}",
+					   expected[j]->name(), fmt::join(y, " ")));
+  }
+}
+
+struct Benchmark {
+  const char *name;
+  const char *usage;
+  size_t min_args;
+  void (*run)(hail::Context &c, const Args &args);
+};
+
+const Benchmark benchmarks[] = {
+  { "scan", "<vds> [iterations]", 1, bench_scan },
+  { "codecs", "<vds> [max_blocks]", 1, bench_codecs },
+  { "grm", "<vds> <out.bm> [n_threads]", 2, bench_grm },
+  { "grm-kernel", "<out.bm> <n_samples> <n_variants> [n_threads]", 3, bench_grm_kernel },
+  { "in-memory", "<vds> [iterations]", 1, bench_in_memory },
+  { "block-cache", "<vds> <capacity_mb> [iterations]", 2, bench_block_cache },
+  { "row-cache", "<vds> <cache_dir> [iterations]", 2, bench_row_cache },
+  { "intervals", "<vds> <intervals.bed> [iterations]", 2, bench_intervals },
+  { "sample-subset", "<vds> <every_kth_sample> [iterations]", 2, bench_sample_subset },
+  { "shards", "<vds> <n_shards>", 2, bench_shards },
+};
+
+// buffers allocated by what they got
+void
+report_pages() {
+  hail::PageStats st = hail::page_stats();
+  for (int k = 0; k < (int)hail::PageKind::N_KINDS; ++k)
+    std::cout << fmt::format("{:<18}{:>10} buffers\n",
+			     hail::page_kind_name((hail::PageKind)k), st.n_allocated[k]);
+  std::cout << fmt::format("{} fallbacks, {} bytes in huge pages\n", st.n_fallbacks, st.anon_huge_bytes);
+}
+
+int
+usage(const char *argv0) {
+  std::cerr << fmt::format("usage: {} [--trace trace.json] [--perf] [--huge-pages none|transparent|hugetlbfs]"
+			   " <benchmark> [args...]\n", argv0);
+  std::cerr << "benchmarks:\n";
+  for (const auto &b : benchmarks)
+    std::cerr << fmt::format("  {} {}\n", b.name, b.usage);
+  return 1;
+}
+
+} // namespace
+
+int
+main(int argc, char **argv) {
+  hail::Context c;
+
+  bool perf = false;
+  bool pages = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--trace" && i + 1 < argc)
+      hail::Tracer::start(argv[++i]);
+    else if (arg == "--perf")
+      perf = true;
+    else if (arg == "--huge-pages" && i + 1 < argc) {
+      std::string policy = argv[++i];
+      if (policy == "none")
+	hail::set_huge_page_policy(hail::HugePagePolicy::NONE);
+      else if (policy == "transparent")
+	hail::set_huge_page_policy(hail::HugePagePolicy::TRANSPARENT);
+      else if (policy == "hugetlbfs")
+	hail::set_huge_page_policy(hail::HugePagePolicy::HUGETLBFS);
+      else
+	return usage(argv[0]);
+      pages = true;
+    }
+    else
+      return usage(argv[0]);
+  }
+  if (i == argc)
+    return usage(argv[0]);
+
+  std::string name = argv[i];
+  Args args(argv + i + 1, argv + argc);
+  for (const auto &b : benchmarks) {
+    if (name == b.name) {
+      if (args.size() < b.min_args)
+	return usage(argv[0]);
+      if (perf)
+	hail::Profiler::start();
+      b.run(c, args);
+      if (perf)
+	hail::Profiler::report(std::cout);
+      if (pages)
+	report_pages();
+      return 0;
+    }
+  }
+  return usage(argv[0]);
+}
@@ -0,0 +1,104 @@
+#include <sys/stat.h>
+
+#include "blockcache.hh"
+
+namespace hail {
+
+BlockCache::BlockCache()
+  : capacity(0), hits(0), misses(0), evictions(0) {}
+
+BlockCache &
+BlockCache::global() {
+  static BlockCache cache;
+  return cache;
+}
+
+void
+BlockCache::evict(Shard &s, uint64_t shard_capacity) {
+  while (s.bytes > shard_capacity) {
+    const Entry &e = s.lru.back();
+    s.bytes -= e.second->size;
+    s.index.erase(e.first);
+    s.lru.pop_back();
+    ++evictions;
+  }
+}
+
+void
+BlockCache::set_capacity(uint64_t bytes) {
+  capacity = bytes;
+  for (Shard &s : shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    evict(s, bytes / n_shards);
+  }
+}
+
+bool
+BlockCache::file_key(int fd, Key &k) {
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+    return false;
+  k.dev = st.st_dev;
+  k.ino = st.st_ino;
+  k.mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  k.offset = 0;
+  return true;
+}
+
+std::shared_ptr<const CachedBlock>
+BlockCache::lookup(const Key &k) {
+  Shard &s = shard(k);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto i = s.index.find(k);
+  if (i == s.index.end()) {
+    ++misses;
+    return nullptr;
+  }
+  ++hits;
+  s.lru.splice(s.lru.begin(), s.lru, i->second);
+  return i->second->second;
+}
+
+void
+BlockCache::insert(const Key &k, std::shared_ptr<const CachedBlock> block) {
+  uint64_t shard_capacity = capacity.load() / n_shards;
+  if (block->size > shard_capacity)
+    return;
+  
+  Shard &s = shard(k);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  // another reader may have inserted it first
+  if (s.index.count(k))
+    return;
+  s.bytes += block->size;
+  s.lru.emplace_front(k, std::move(block));
+  s.index.emplace(k, s.lru.begin());
+  evict(s, shard_capacity);
+}
+
+void
+BlockCache::clear() {
+  for (Shard &s : shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.lru.clear();
+    s.index.clear();
+    s.bytes = 0;
+  }
+}
+
+BlockCache::Stats
+BlockCache::stats() {
+  Stats st;
+  st.hits = hits;
+  st.misses = misses;
+  st.evictions = evictions;
+  st.capacity = capacity;
+  st.bytes = 0;
+  for (Shard &s : shards) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    st.bytes += s.bytes;
+  }
+  return st;
+}
+
+} // namespace hail
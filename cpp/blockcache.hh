@@ -0,0 +1,116 @@
+#ifndef HAIL_BLOCKCACHE_HH
+#define HAIL_BLOCKCACHE_HH
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "util.hh"
+
+namespace hail {
+
+// a decompressed block; encoded_size is the size of the block in the
+// file, header included
+class CachedBlock {
+public:
+  std::unique_ptr<char[]> data;
+  uint32_t size;
+  uint32_t encoded_size;
+  
+  CachedBlock(uint32_t size, uint32_t encoded_size)
+    : data(new char[size]), size(size), encoded_size(encoded_size) {}
+};
+
+// Process-wide LRU cache of decompressed blocks, bounded by bytes and
+// shared by every BlockInputBuffer.  Blocks are keyed by file identity
+// (device, inode and modification time) and offset, so a rewritten
+// file misses.  Evicted blocks stay valid for readers still holding
+// them.  The cache is split into shards, each with its own lock and
+// an equal share of the capacity.  Disabled (capacity 0) by default.
+class BlockCache {
+public:
+  class Key {
+  public:
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t mtime_ns;
+    uint64_t offset;
+    
+    bool operator==(const Key &that) const {
+      return offset == that.offset && ino == that.ino && dev == that.dev && mtime_ns == that.mtime_ns;
+    }
+  };
+  
+  class Stats {
+  public:
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;
+    uint64_t capacity;
+  };
+  
+private:
+  class KeyHash {
+  public:
+    std::size_t operator()(const Key &k) const {
+      std::size_t h = std::hash<uint64_t>()(k.offset);
+      hash_combine(h, k.ino);
+      hash_combine(h, k.dev);
+      hash_combine(h, k.mtime_ns);
+      return h;
+    }
+  };
+  
+  using Entry = std::pair<Key, std::shared_ptr<const CachedBlock>>;
+  
+  class Shard {
+  public:
+    std::mutex mutex;
+    // most recently used first
+    std::list<Entry> lru;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    uint64_t bytes = 0;
+  };
+  
+  static const int n_shards = 16;
+  
+  Shard shards[n_shards];
+  std::atomic<uint64_t> capacity;
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> evictions;
+  
+  Shard &shard(const Key &k) { return shards[KeyHash()(k) % n_shards]; }
+  // with shard's mutex held
+  void evict(Shard &s, uint64_t shard_capacity);
+  
+public:
+  BlockCache();
+  
+  static BlockCache &global();
+  
+  bool enabled() const { return capacity.load(std::memory_order_relaxed) > 0; }
+  
+  // evicts down to the new capacity; 0 disables the cache
+  void set_capacity(uint64_t bytes);
+  
+  // fills the identity of open file fd, except the offset; false if
+  // fd can't be stat'ed
+  static bool file_key(int fd, Key &k);
+  
+  // the block, or null on a miss
+  std::shared_ptr<const CachedBlock> lookup(const Key &k);
+  void insert(const Key &k, std::shared_ptr<const CachedBlock> block);
+  
+  void clear();
+  
+  Stats stats();
+};
+
+} // namespace hail
+
+#endif // HAIL_BLOCKCACHE_HH
@@ -0,0 +1,370 @@
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <fmt/format.h>
+
+#include "blockmatrix.hh"
+#include "context.hh"
+
+namespace hail {
+
+namespace {
+
+const char magic[4] = { 'H', 'L', 'B', 'M' };
+const uint32_t version = 1;
+
+class Header {
+public:
+  char magic[4];
+  uint32_t version;
+  uint64_t n_rows;
+  uint64_t n_cols;
+  uint64_t block_size;
+};
+
+CompiledExpr
+entry_values(Context &c, const TMatrixTable *t, const std::string &field) {
+  CompiledExpr e = compile(c,
+			   array_map(get_field(ref("row"), "gs"), "g", get_field(ref("g"), field)),
+			   "row", t->row_impl_type);
+  switch (cast<TArray>(e.type)->element_type->kind) {
+  case BaseType::Kind::INT32:
+  case BaseType::Kind::INT64:
+  case BaseType::Kind::FLOAT64:
+    return e;
+  default:
+    throw std::runtime_error(fmt::format("entry field {} is not numeric", field));
+  }
+}
+
+bool
+is_call_field(const TMatrixTable *t, const std::string &field) {
+  const TStruct *ts = dyn_cast<TStruct>(t->entry_type);
+  if (!ts)
+    return false;
+  for (const auto &f : ts->fields)
+    if (f.name == field)
+      return f.type->kind == BaseType::Kind::CALL;
+  return false;
+}
+
+} // namespace
+
+BlockMatrix::BlockMatrix(const std::string &filename, bool writable)
+  : filename(filename), fd(-1), data(nullptr), size(0), writable(writable) {
+  fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < header_size) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("not a block matrix: {}", filename));
+  }
+  size = st.st_size;
+  void *p = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("could not map {}: {}", filename, strerror(errno)));
+  }
+  data = (char *)p;
+
+  Header h;
+  memcpy(&h, data, sizeof(h));
+  n_rows = h.n_rows;
+  n_cols = h.n_cols;
+  block_size = h.block_size;
+  if (!std::equal(h.magic, h.magic + 4, magic)
+      || h.version != version
+      || block_size == 0
+      || size != header_size + 8 * n_rows * n_cols) {
+    munmap((void *)data, size);
+    ::close(fd);
+    throw std::runtime_error(fmt::format("not a block matrix: {}", filename));
+  }
+}
+
+BlockMatrix::~BlockMatrix() {
+  munmap((void *)data, size);
+  ::close(fd);
+}
+
+std::unique_ptr<BlockMatrix>
+BlockMatrix::create(const std::string &filename, uint64_t n_rows, uint64_t n_cols, uint64_t block_size) {
+  if (block_size == 0)
+    throw std::runtime_error("block size must be positive");
+  int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1)
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+  Header h;
+  std::copy(magic, magic + 4, h.magic);
+  h.version = version;
+  h.n_rows = n_rows;
+  h.n_cols = n_cols;
+  h.block_size = block_size;
+  // the tiles are a hole, so they read as zero
+  bool ok = ftruncate(fd, header_size + 8 * n_rows * n_cols) == 0
+    && pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+  ::close(fd);
+  if (!ok)
+    throw std::runtime_error(fmt::format("could not write file: {}", filename));
+  return std::make_unique<BlockMatrix>(filename, true);
+}
+
+BlockMatrixWriter::BlockMatrixWriter(const std::string &filename, uint64_t n_cols, uint64_t block_size)
+  : filename(filename),
+    fd(-1),
+    n_cols(n_cols),
+    block_size(block_size),
+    n_rows(0) {
+  if (block_size == 0)
+    throw std::runtime_error("block size must be positive");
+  fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1)
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+}
+
+BlockMatrixWriter::~BlockMatrixWriter() {
+  if (fd != -1)
+    ::close(fd);
+}
+
+void
+BlockMatrixWriter::write(const void *p, uint64_t n, uint64_t offset) {
+  while (n > 0) {
+    ssize_t k = pwrite(fd, p, n, offset);
+    if (k <= 0)
+      throw std::runtime_error(fmt::format("could not write file: {}", filename));
+    p = (const char *)p + k;
+    n -= k;
+    offset += k;
+  }
+}
+
+void
+BlockMatrixWriter::append_row(const double *row) {
+  uint64_t i = n_rows / block_size, r = n_rows % block_size;
+  uint64_t tiles = BlockMatrix::header_size + 8 * i * block_size * n_cols;
+  for (uint64_t j = 0; j * block_size < n_cols; ++j) {
+    uint64_t cols = std::min(block_size, n_cols - j * block_size);
+    write(row + j * block_size, 8 * cols, tiles + 8 * (block_size * j * block_size + r * cols));
+  }
+  ++n_rows;
+}
+
+void
+BlockMatrixWriter::close() {
+  // the rows of tile j of the last row of tiles are contiguous, at
+  // block_size * j * block_size; move them down to n_last * j *
+  // block_size, in order of j so no tile is overwritten before it is
+  // moved
+  uint64_t n_last = n_rows % block_size;
+  if (n_last > 0) {
+    uint64_t tiles = BlockMatrix::header_size + 8 * (n_rows - n_last) * n_cols;
+    std::vector<char> buf(1 << 20);
+    for (uint64_t j = 1; j * block_size < n_cols; ++j) {
+      uint64_t cols = std::min(block_size, n_cols - j * block_size);
+      uint64_t src = tiles + 8 * block_size * j * block_size;
+      uint64_t dst = tiles + 8 * n_last * j * block_size;
+      for (uint64_t n = 8 * n_last * cols, o = 0; o < n; ) {
+	uint64_t k = std::min<uint64_t>(buf.size(), n - o);
+	if (pread(fd, buf.data(), k, src + o) != (ssize_t)k)
+	  throw std::runtime_error(fmt::format("could not read file: {}", filename));
+	write(buf.data(), k, dst + o);
+	o += k;
+      }
+    }
+  }
+
+  Header h;
+  std::copy(magic, magic + 4, h.magic);
+  h.version = version;
+  h.n_rows = n_rows;
+  h.n_cols = n_cols;
+  h.block_size = block_size;
+  write(&h, sizeof(h), 0);
+  bool ok = ftruncate(fd, BlockMatrix::header_size + 8 * n_rows * n_cols) == 0;
+  ok = ::close(fd) == 0 && ok;
+  fd = -1;
+  if (!ok)
+    throw std::runtime_error(fmt::format("could not write file: {}", filename));
+}
+
+#ifdef AVX2_KERNELS
+
+namespace {
+
+// the sum and number of defined values of whole groups of 4 of the n
+// values at x; returns the number of values seen
+TARGET_AVX2_FMA uint64_t
+sum_defined_avx2(const double *x, uint64_t n, double &sum, uint64_t &n_defined) {
+  __m256d sum_v = _mm256_setzero_pd();
+  __m256d count_v = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1);
+  uint64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(x + i);
+    __m256d defined = _mm256_cmp_pd(v, v, _CMP_ORD_Q);
+    sum_v = _mm256_add_pd(sum_v, _mm256_and_pd(defined, v));
+    count_v = _mm256_add_pd(count_v, _mm256_and_pd(defined, one));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, sum_v);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm256_storeu_pd(lanes, count_v);
+  n_defined = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  return i;
+}
+
+// x = defined ? (x - shift) * scale : fill for whole groups of 4 of the
+// n values at x; returns the number of values set
+TARGET_AVX2_FMA uint64_t
+shift_scale_avx2(double *x, uint64_t n, double shift, double scale, double fill) {
+  const __m256d shift_v = _mm256_set1_pd(shift);
+  const __m256d scale_v = _mm256_set1_pd(scale);
+  const __m256d fill_v = _mm256_set1_pd(fill);
+  uint64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(x + i);
+    __m256d defined = _mm256_cmp_pd(v, v, _CMP_ORD_Q);
+    __m256d y = _mm256_mul_pd(_mm256_sub_pd(v, shift_v), scale_v);
+    _mm256_storeu_pd(x + i, _mm256_blendv_pd(fill_v, y, defined));
+  }
+  return i;
+}
+
+} // namespace
+
+#endif
+
+void
+normalize_row(double *x, uint64_t n, bool standardize) {
+  double sum = 0;
+  uint64_t n_defined = 0;
+  uint64_t i = 0;
+#ifdef AVX2_KERNELS
+  if (cpu_has_avx2_fma())
+    i = sum_defined_avx2(x, n, sum, n_defined);
+#endif
+  for (; i < n; ++i) {
+    bool defined = x[i] == x[i];
+    sum += defined ? x[i] : 0;
+    n_defined += defined;
+  }
+
+  if (n_defined == 0) {
+    std::fill(x, x + n, 0);
+    return;
+  }
+  double mean = sum / n_defined;
+
+  // x = defined ? (x - shift) * scale : fill
+  double shift = 0, scale = 1, fill = mean;
+  if (standardize) {
+    double ss = 0;
+    for (i = 0; i < n; ++i) {
+      double y = x[i] - mean;
+      ss += y == y ? y * y : 0;
+    }
+    if (ss == 0) {
+      std::fill(x, x + n, 0);
+      return;
+    }
+    shift = mean;
+    scale = 1 / std::sqrt(ss / n_defined);
+    fill = 0;
+  }
+
+  i = 0;
+#ifdef AVX2_KERNELS
+  if (cpu_has_avx2_fma())
+    i = shift_scale_avx2(x, n, shift, scale, fill);
+#endif
+  for (; i < n; ++i)
+    x[i] = x[i] == x[i] ? (x[i] - shift) * scale : fill;
+}
+
+DosageRows::DosageRows(Context &c, const std::shared_ptr<const MatrixTable> &mt, PartitionRange parts,
+		       const std::string &field, bool standardize)
+  : it(mt->iterator(parts)),
+    gt(is_call_field(mt->type, field)),
+    standardize(standardize),
+    values(entry_values(c, mt->type, field)),
+    n_cols(mt->n_cols) {
+  if (gt && field == "GT")
+    it->pack_calls();
+}
+
+bool
+DosageRows::advance() {
+  if (!it->has_next())
+    return false;
+  current = it->next();
+  return true;
+}
+
+void
+DosageRows::fill(double *row) {
+  if (it->calls_packed()) {
+    PackedCalls p = it->packed_calls();
+    if (p.n != n_cols)
+      throw std::runtime_error(fmt::format("row has {} entries, expected {}", p.n, n_cols));
+    p.to_dosages(row, NAN);
+  } else {
+    values.eval(current, column);
+    if (column.is_missing(0))
+      std::fill(row, row + n_cols, NAN);
+    else {
+      const Column &e = *column.elements;
+      if (e.size != n_cols)
+	throw std::runtime_error(fmt::format("row has {} entries, expected {}", e.size, n_cols));
+      const uint8_t *missing = e.missing.data();
+      switch (e.type->kind) {
+      case BaseType::Kind::INT32:
+	if (gt) {
+	  for (uint64_t i = 0; i < n_cols; ++i)
+	    row[i] = missing[i] ? NAN : call_n_alt(e.ints[i]);
+	} else {
+	  for (uint64_t i = 0; i < n_cols; ++i)
+	    row[i] = missing[i] ? NAN : e.ints[i];
+	}
+	break;
+      case BaseType::Kind::INT64:
+	for (uint64_t i = 0; i < n_cols; ++i)
+	  row[i] = missing[i] ? NAN : e.longs[i];
+	break;
+      case BaseType::Kind::FLOAT64:
+	for (uint64_t i = 0; i < n_cols; ++i)
+	  row[i] = missing[i] ? NAN : e.doubles[i];
+	break;
+      default: abort();
+      }
+    }
+  }
+
+  normalize_row(row, n_cols, standardize);
+}
+
+void
+write_block_matrix(Context &c, const std::shared_ptr<const MatrixTable> &mt,
+		   const std::string &field, bool standardize,
+		   const std::string &filename,
+		   uint64_t block_size) {
+  DosageRows rows(c, mt, mt->all_partitions(), field, standardize);
+  BlockMatrixWriter w(filename, rows.n_cols, block_size);
+  std::vector<double> row(rows.n_cols);
+  while (rows.next(row.data()))
+    w.append_row(row.data());
+  w.close();
+}
+
+} // namespace hail
@@ -0,0 +1,153 @@
+#ifndef HAIL_BLOCKMATRIX_HH
+#define HAIL_BLOCKMATRIX_HH
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expr.hh"
+#include "matrixtable.hh"
+
+namespace hail {
+
+// A dense float64 matrix stored in square tiles of block_size (smaller
+// at the right and bottom edges).  On disk:
+//
+//   header (header_size bytes): "HLBM", uint32 version, uint64 n_rows,
+//     uint64 n_cols, uint64 block_size
+//   tiles in row-major tile order, each row-major
+//
+// The header is a page long, so mapping the file gives 8-aligned tiles
+// whose rows are contiguous.
+class BlockMatrix {
+  std::string filename;
+  int fd;
+  char *data;
+  size_t size;
+  bool writable;
+
+public:
+  static const uint64_t header_size = 4096;
+  static const uint64_t default_block_size = 4096;
+
+  uint64_t n_rows;
+  uint64_t n_cols;
+  uint64_t block_size;
+
+  // maps filename, read-only unless writable
+  BlockMatrix(const std::string &filename, bool writable = false);
+  BlockMatrix(const BlockMatrix &) = delete;
+  ~BlockMatrix();
+
+  BlockMatrix &operator=(const BlockMatrix &) = delete;
+
+  // creates filename as an all-zero matrix and maps it read-write
+  static std::unique_ptr<BlockMatrix> create(const std::string &filename,
+					     uint64_t n_rows, uint64_t n_cols, uint64_t block_size);
+
+  uint64_t n_row_blocks() const { return (n_rows + block_size - 1) / block_size; }
+  uint64_t n_col_blocks() const { return (n_cols + block_size - 1) / block_size; }
+
+  uint64_t block_rows(uint64_t i) const { return std::min(block_size, n_rows - i * block_size); }
+  uint64_t block_cols(uint64_t j) const { return std::min(block_size, n_cols - j * block_size); }
+
+  uint64_t block_offset(uint64_t i, uint64_t j) const {
+    return header_size + 8 * (i * block_size * n_cols + block_rows(i) * j * block_size);
+  }
+
+  // tile (i, j), block_rows(i) by block_cols(j), row-major
+  const double *block(uint64_t i, uint64_t j) const {
+    return (const double *)(data + block_offset(i, j));
+  }
+  double *block(uint64_t i, uint64_t j) {
+    assert(writable);
+    return (double *)(data + block_offset(i, j));
+  }
+
+  double get(uint64_t r, uint64_t c) const {
+    uint64_t i = r / block_size, j = c / block_size;
+    return block(i, j)[(r - i * block_size) * block_cols(j) + (c - j * block_size)];
+  }
+};
+
+// Writes a BlockMatrix a row at a time, without buffering rows: each
+// row is written straight into its tiles, placed as in a full row of
+// tiles.  close() moves the tiles of a last, partial row of tiles to
+// their place.
+class BlockMatrixWriter {
+  std::string filename;
+  int fd;
+  uint64_t n_cols;
+  uint64_t block_size;
+  uint64_t n_rows;
+
+  void write(const void *p, uint64_t n, uint64_t offset);
+
+public:
+  BlockMatrixWriter(const std::string &filename, uint64_t n_cols,
+		    uint64_t block_size = BlockMatrix::default_block_size);
+  BlockMatrixWriter(const BlockMatrixWriter &) = delete;
+  ~BlockMatrixWriter();
+
+  BlockMatrixWriter &operator=(const BlockMatrixWriter &) = delete;
+
+  void append_row(const double *row);
+
+  // writes the header; the file is incomplete until then
+  void close();
+};
+
+// Mean-impute the missing (NaN) values of x and, if standardize, scale
+// the row to mean 0 and variance 1.  A row with no defined values, or
+// constant with standardize, becomes all zero.
+extern void normalize_row(double *x, uint64_t n, bool standardize);
+
+// Rows of a MatrixTable as per-sample values of an entry field, with
+// missing values mean-imputed and optionally standardized.  The field
+// is either GT, giving the number of alternate alleles, or numeric,
+// such as a dosage.  Biallelic GT rows are decoded as packed calls.
+class DosageRows {
+  std::shared_ptr<MatrixTableIterator> it;
+  bool gt;
+  bool standardize;
+  CompiledExpr values;
+  Column column;
+  TypedRegionValue current;
+
+public:
+  uint64_t n_cols;
+
+  DosageRows(Context &c, const std::shared_ptr<const MatrixTable> &mt, PartitionRange parts,
+	     const std::string &field, bool standardize);
+
+  // moves to the next row; false at the end
+  bool advance();
+  
+  // fills row (n_cols values) from the current row
+  void fill(double *row);
+  
+  // fills row from the next row; false at the end
+  bool next(double *row) {
+    if (!advance())
+      return false;
+    fill(row);
+    return true;
+  }
+  
+  // the current row, valid until the next call to advance()
+  TypedRegionValue row() const { return current; }
+  bool calls_packed() const { return it->calls_packed(); }
+  RetainedRow retain() const { return it->retain(); }
+};
+
+// writes field of the rows of mt as a BlockMatrix with a row per
+// variant and a column per sample
+extern void write_block_matrix(Context &c, const std::shared_ptr<const MatrixTable> &mt,
+			       const std::string &field, bool standardize,
+			       const std::string &filename,
+			       uint64_t block_size = BlockMatrix::default_block_size);
+
+} // namespace hail
+
+#endif // HAIL_BLOCKMATRIX_HH
@@ -0,0 +1,139 @@
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#define LZ4_DISABLE_DEPRECATE_WARNINGS
+#include <lz4.h>
+#include <zstd.h>
+
+#include <fmt/format.h>
+
+#include "codec.hh"
+
+namespace hail {
+
+BlockCodec::~BlockCodec() {}
+
+const BlockCodec *
+BlockCodec::lz4() {
+  static const LZ4Codec codec;
+  return &codec;
+}
+
+const BlockCodec *
+BlockCodec::zstd() {
+  static const ZstdCodec codec;
+  return &codec;
+}
+
+const BlockCodec *
+BlockCodec::raw() {
+  static const RawCodec codec;
+  return &codec;
+}
+
+const BlockCodec *
+BlockCodec::lookup(const std::string &name) {
+  if (name == "lz4")
+    return lz4();
+  if (name == "zstd")
+    return zstd();
+  if (name == "raw")
+    return raw();
+  throw std::runtime_error(fmt::format("unknown block codec: {}", name));
+}
+
+const char *
+LZ4Codec::name() const {
+  return "lz4";
+}
+
+size_t
+LZ4Codec::max_compressed_size(size_t n) const {
+  return LZ4_compressBound(n);
+}
+
+size_t
+LZ4Codec::compress(const char *src, size_t n, char *dst, size_t dst_capacity) const {
+  int comp_len = LZ4_compress_default(src, dst, n, dst_capacity);
+  assert(comp_len > 0);
+  return comp_len;
+}
+
+void
+LZ4Codec::decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const {
+#ifndef NDEBUG
+  int comp_len2 =
+#endif
+    LZ4_decompress_fast(src, dst, decomp_len);
+  assert((size_t)comp_len2 == comp_len);
+}
+
+namespace {
+
+struct ZstdContexts {
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+
+  ZstdContexts() : cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()) {}
+  ~ZstdContexts() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+};
+
+// zstd contexts are expensive to create; keep one pair per thread
+thread_local ZstdContexts zstd_contexts;
+
+} // namespace
+
+const char *
+ZstdCodec::name() const {
+  return "zstd";
+}
+
+size_t
+ZstdCodec::max_compressed_size(size_t n) const {
+  return ZSTD_compressBound(n);
+}
+
+size_t
+ZstdCodec::compress(const char *src, size_t n, char *dst, size_t dst_capacity) const {
+  size_t comp_len = ZSTD_compressCCtx(zstd_contexts.cctx, dst, dst_capacity, src, n, level);
+  if (ZSTD_isError(comp_len))
+    throw std::runtime_error(fmt::format("zstd compression failed: {}", ZSTD_getErrorName(comp_len)));
+  return comp_len;
+}
+
+void
+ZstdCodec::decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const {
+  size_t decomp_len2 = ZSTD_decompressDCtx(zstd_contexts.dctx, dst, decomp_len, src, comp_len);
+  if (ZSTD_isError(decomp_len2) || decomp_len2 != decomp_len)
+    throw std::runtime_error("corrupt zstd block");
+}
+
+const char *
+RawCodec::name() const {
+  return "raw";
+}
+
+size_t
+RawCodec::max_compressed_size(size_t n) const {
+  return n;
+}
+
+size_t
+RawCodec::compress(const char *src, size_t n, char *dst, size_t dst_capacity) const {
+  assert(n <= dst_capacity);
+  memcpy(dst, src, n);
+  return n;
+}
+
+void
+RawCodec::decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const {
+  assert(comp_len == decomp_len);
+  memcpy(dst, src, decomp_len);
+}
+
+} // namespace hail
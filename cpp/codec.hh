@@ -0,0 +1,71 @@
+#ifndef HAIL_CODEC_HH
+#define HAIL_CODEC_HH
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace hail {
+
+// Compression for the blocks of a partition file.  Every codec uses
+// the same framing:
+//
+//   int32 comp_len, int32 decomp_len, comp_len bytes
+//
+// The codec is recorded as "codec" in metadata.json; datasets without
+// it are LZ4.
+class BlockCodec {
+public:
+  virtual ~BlockCodec();
+
+  virtual const char *name() const = 0;
+
+  virtual size_t max_compressed_size(size_t n) const = 0;
+
+  // returns the compressed size
+  virtual size_t compress(const char *src, size_t n, char *dst, size_t dst_capacity) const = 0;
+
+  // src decompresses to exactly decomp_len bytes
+  virtual void decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const = 0;
+
+  static const BlockCodec *lz4();
+  static const BlockCodec *zstd();
+  static const BlockCodec *raw();
+
+  // throws std::runtime_error on an unknown name
+  static const BlockCodec *lookup(const std::string &name);
+};
+
+class LZ4Codec : public BlockCodec {
+public:
+  const char *name() const;
+  size_t max_compressed_size(size_t n) const;
+  size_t compress(const char *src, size_t n, char *dst, size_t dst_capacity) const;
+  void decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const;
+};
+
+class ZstdCodec : public BlockCodec {
+  int level;
+
+public:
+  static const int default_level = 3;
+
+  ZstdCodec(int level = default_level) : level(level) {}
+
+  const char *name() const;
+  size_t max_compressed_size(size_t n) const;
+  size_t compress(const char *src, size_t n, char *dst, size_t dst_capacity) const;
+  void decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const;
+};
+
+class RawCodec : public BlockCodec {
+public:
+  const char *name() const;
+  size_t max_compressed_size(size_t n) const;
+  size_t compress(const char *src, size_t n, char *dst, size_t dst_capacity) const;
+  void decompress(const char *src, size_t comp_len, char *dst, size_t decomp_len) const;
+};
+
+} // namespace hail
+
+#endif // HAIL_CODEC_HH
@@ -1,7 +1,9 @@
 
+#include <algorithm>
 #include <unordered_map>
 #include <fmt/format.h>
 
+#include "casting.hh"
 #include "type.hh"
 #include "context.hh"
 
@@ -18,7 +20,7 @@ public:
 enum Token {
   BOOLEAN = std::numeric_limits<char>::max() + 1,
   INT32, INT64, FLOAT32, FLOAT64, STRING, ARRAY, SET, STRUCT, EMPTY,
-  CALL, LOCUS, ALTALLELE, VARIANT,
+  CALL, LOCUS, ALTALLELE, VARIANT, INTERVAL,
   ID
 };
 
@@ -55,6 +57,7 @@ std::unordered_map<std::string, int> TypeLexer::keywords = {
   { "Locus", LOCUS },
   { "AltAllele", ALTALLELE },
   { "Variant", VARIANT },
+  { "Interval", INTERVAL },
 };
 
 int
@@ -214,6 +217,13 @@ Context::parse_type(TypeLexer &lexer) {
     lexer.expect(')');
     return variant_type(gr, required);
   }
+  case INTERVAL: {
+    lexer.expect('(');
+    lexer.expect(ID);
+    std::string gr = lexer.text();
+    lexer.expect(')');
+    return interval_type(gr, required);
+  }
   default:
     throw ParseError(fmt::format("parse error at {}", lexer.text()));
   }
@@ -252,6 +262,11 @@ Context::variant_type(const std::string &gr, bool required) {
   return intern(new TVariant(*this, gr, required));
 }
 
+const TInterval *
+Context::interval_type(const std::string &gr, bool required) {
+  return intern(new TInterval(*this, gr, required));
+}
+
 const TMatrixTable *
 Context::matrix_table_type(const rapidjson::Document &d) {
   return intern(new TMatrixTable(
@@ -264,6 +279,30 @@ Context::matrix_table_type(const rapidjson::Document &d) {
 		  parse_type(d["genotype_schema"].GetString())));
 }
 
+const TTable *
+Context::table_type(const rapidjson::Document &d) {
+  const Type *row_type = parse_type(d["schema"].GetString());
+  const TStruct *ts = dyn_cast<TStruct>(row_type);
+  if (!ts)
+    throw std::runtime_error(fmt::format("table rows are not structs: {}", row_type->to_string()));
+  
+  std::vector<std::string> key;
+  const rapidjson::Value &key_names = d["key"];
+  for (rapidjson::SizeType i = 0; i < key_names.Size(); ++i) {
+    std::string name = key_names[i].GetString();
+    if (std::none_of(ts->fields.begin(), ts->fields.end(),
+		     [&name](const Field &f) { return f.name == name; }))
+      throw std::runtime_error(fmt::format("no key field {} in {}", name, row_type->to_string()));
+    key.push_back(name);
+  }
+  
+  const Type *global_type = d.HasMember("global_schema")
+    ? parse_type(d["global_schema"].GetString())
+    : struct_type(std::vector<Field>(), false);
+  
+  return intern(new TTable(global_type, row_type, key));
+}
+
 const Type *
 Context::alt_allele_representation(bool required) {
   return struct_type(std::vector<Field> {
@@ -290,4 +329,12 @@ Context::variant_representation(bool required) {
     }, required);
 }
 
+const Type *
+Context::interval_representation(const std::string &gr, bool required) {
+  return struct_type(std::vector<Field> {
+      Field { "start", locus_type(gr, true) },
+	Field { "end", locus_type(gr, true) }
+    }, required);
+}
+
 } // namespace hail
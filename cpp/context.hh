@@ -97,8 +97,11 @@ public:
   const TSet *set_type(const Type *element_type, bool required);
   const TLocus *locus_type(const std::string &gr, bool required);
   const TVariant *variant_type(const std::string &gr, bool required);
+  const TInterval *interval_type(const std::string &gr, bool required);
   
   const TMatrixTable *matrix_table_type(const rapidjson::Document &d);
+  // from Table metadata: schema, key and optional global_schema
+  const TTable *table_type(const rapidjson::Document &d);
   
   const Type *parse_type(TypeLexer &lexer);
   const Type *parse_type(const char *s);
@@ -107,6 +110,7 @@ public:
   const Type *alt_allele_representation(bool required);
   const Type *locus_representation(bool required);
   const Type *variant_representation(bool required);
+  const Type *interval_representation(const std::string &gr, bool required);
 };
 
 // FIXME
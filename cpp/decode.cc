@@ -0,0 +1,407 @@
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "casting.hh"
+#include "decode.hh"
+
+namespace hail {
+
+namespace {
+
+bool
+test_bit(const uint8_t *bits, uint64_t i) {
+  return (bits[i >> 3] & (1 << (i & 7))) != 0;
+}
+
+// The encoded size of t if t is a required Boolean, Float32 or
+// Float64, or a required struct of them, whose values are then stored
+// back to back with no missing bits; otherwise 0.
+uint64_t
+fixed_width(const Type *t) {
+  if (!t->required)
+    return 0;
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    return 1;
+  case BaseType::Kind::FLOAT32:
+    return 4;
+  case BaseType::Kind::FLOAT64:
+    return 8;
+  case BaseType::Kind::STRUCT:
+    {
+      uint64_t w = 0;
+      for (const auto &f : cast<TStruct>(t)->fields) {
+	if (f.type->kind == BaseType::Kind::STRUCT)
+	  return 0;
+	uint64_t fw = fixed_width(f.type);
+	if (fw == 0)
+	  return 0;
+	w += fw;
+      }
+      return w;
+    }
+  default:
+    return 0;
+  }
+}
+
+// decode k elements of fixed-width type t from src, w bytes each, to
+// dst, element_size bytes apart
+void
+decode_fixed(char *dst, const char *src, uint64_t k, const Type *t, uint64_t w, uint64_t element_size) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    for (uint64_t i = 0; i < k; ++i)
+      dst[i] = src[i] != 0;
+    break;
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+    assert(element_size == w);
+    memcpy(dst, src, k * w);
+    break;
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(t);
+      for (uint64_t i = 0; i < k; ++i, dst += element_size) {
+	for (uint64_t j = 0; j < ts->fields.size(); ++j) {
+	  char *fdst = dst + ts->field_offset[j];
+	  switch (ts->fields[j].type->kind) {
+	  case BaseType::Kind::BOOLEAN:
+	    *fdst = *src != 0;
+	    src += 1;
+	    break;
+	  case BaseType::Kind::FLOAT32:
+	    memcpy(fdst, src, 4);
+	    src += 4;
+	    break;
+	  case BaseType::Kind::FLOAT64:
+	    memcpy(fdst, src, 8);
+	    src += 8;
+	    break;
+	  default: abort();
+	  }
+	}
+      }
+    }
+    break;
+  default: abort();
+  }
+}
+
+// decode n elements of fixed-width type t, w bytes each, a block's
+// worth at a time
+void
+decode_fixed_elements(BlockInputBuffer &in, Region &region, offset_t off, const Type *t,
+		      uint64_t n, uint64_t w, uint64_t element_size) {
+  std::vector<char> split;
+  while (n > 0) {
+    uint64_t k = std::min<uint64_t>(n, in.available() / w);
+    if (k == 0) {
+      // a struct split between blocks
+      split.resize(w);
+      in.read_bytes(split.data(), w);
+      decode_fixed(region.mem + off, split.data(), 1, t, w, element_size);
+      k = 1;
+    } else {
+      decode_fixed(region.mem + off, in.peek(), k, t, w, element_size);
+      in.consume(k * w);
+    }
+    off += k * element_size;
+    n -= k;
+  }
+}
+
+// The most bytes a Boolean or numeric value of t takes encoded;
+// otherwise 0.
+uint64_t
+max_scalar_size(const Type *t) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    return 1;
+  case BaseType::Kind::INT32:
+    return max_varint_size<int32_t>();
+  case BaseType::Kind::INT64:
+    return max_varint_size<int64_t>();
+  case BaseType::Kind::FLOAT32:
+    return 4;
+  case BaseType::Kind::FLOAT64:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+// decode a Boolean or numeric value of t at p to dst, advancing p,
+// without bounds checks
+void
+decode_scalar(const char *&p, char *dst, const Type *t) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    *dst = *p++ != 0;
+    break;
+  case BaseType::Kind::INT32:
+    {
+      int32_t x = read_varint<int32_t>(p);
+      memcpy(dst, &x, 4);
+    }
+    break;
+  case BaseType::Kind::INT64:
+    {
+      int64_t x = read_varint<int64_t>(p);
+      memcpy(dst, &x, 8);
+    }
+    break;
+  case BaseType::Kind::FLOAT32:
+    memcpy(dst, p, 4);
+    p += 4;
+    break;
+  case BaseType::Kind::FLOAT64:
+    memcpy(dst, p, 8);
+    p += 8;
+    break;
+  default: abort();
+  }
+}
+
+// Decode n required Int32 or Int64 elements, each run that surely lies
+// in the current block without checks, and the last few of a block
+// one at a time.
+template<typename T> void
+decode_varint_elements(BlockInputBuffer &in, Region &region, offset_t off, uint64_t n) {
+  while (n > 0) {
+    uint64_t k = std::min<uint64_t>(n, in.available() / max_varint_size<T>());
+    if (k == 0) {
+      T x = sizeof(T) == 4 ? in.read_int() : in.read_long();
+      memcpy(region.mem + off, &x, sizeof(T));
+      k = 1;
+    } else {
+      const char *begin = in.peek(), *p = begin;
+      char *dst = region.mem + off;
+      for (uint64_t i = 0; i < k; ++i) {
+	T x = read_varint<T>(p);
+	memcpy(dst + i * sizeof(T), &x, sizeof(T));
+      }
+      in.consume(p - begin);
+    }
+    off += k * sizeof(T);
+    n -= k;
+  }
+}
+
+template<typename T> void
+skip_varint_elements(BlockInputBuffer &in, uint64_t n) {
+  while (n > 0) {
+    uint64_t k = std::min<uint64_t>(n, in.available() / max_varint_size<T>());
+    if (k == 0) {
+      in.skip_varint();
+      k = 1;
+    } else {
+      const char *begin = in.peek(), *p = begin;
+      for (uint64_t i = 0; i < k; ++i)
+	skip_varint<T>(p);
+      in.consume(p - begin);
+    }
+    n -= k;
+  }
+}
+
+} // namespace
+
+void
+decode(BlockInputBuffer &in, Region &region, offset_t off, const Type *t) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    region.store_bool(off, in.read_bool());
+    break;
+  case BaseType::Kind::INT32:
+    region.store_int(off, in.read_int());
+    break;
+  case BaseType::Kind::INT64:
+    region.store_long(off, in.read_long());
+    break;
+  case BaseType::Kind::FLOAT32:
+    region.store_float(off, in.read_float());
+    break;
+  case BaseType::Kind::FLOAT64:
+    region.store_double(off, in.read_double());
+    break;
+  case BaseType::Kind::STRING:
+    {
+      uint32_t n = in.read_int();
+      uint64_t soff = region.allocate(4, 4 + n);
+      region.store_int(soff, n);
+      in.read_bytes(region, soff + 4, n);
+      region.store_offset(off, soff);
+    }
+    break;
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(t);
+      uint64_t n_fields = ts->fields.size();
+      in.read_bytes(region, off, ts->missing_bits_size());
+      // Each run of defined Boolean and numeric fields is decoded with
+      // one bounds check when the block has room for the longest
+      // encoding of all of them, and field by field otherwise, as is
+      // the string or array field that ends the run.
+      for (uint64_t i = 0; i < n_fields; ) {
+	uint64_t j = i, bound = 0;
+	for (; j < n_fields; ++j) {
+	  if (!region.is_field_defined(ts, off, j))
+	    continue;
+	  uint64_t s = max_scalar_size(ts->fields[j].type);
+	  if (s == 0)
+	    break;
+	  bound += s;
+	}
+	if (bound > 0 && in.available() >= bound) {
+	  const char *begin = in.peek(), *p = begin;
+	  for (; i < j; ++i)
+	    if (region.is_field_defined(ts, off, i))
+	      decode_scalar(p, region.mem + off + ts->field_offset[i], ts->fields[i].type);
+	  in.consume(p - begin);
+	  continue;
+	}
+	for (uint64_t end = std::min(j + 1, n_fields); i < end; ++i)
+	  if (region.is_field_defined(ts, off, i))
+	    decode(in, region, off + ts->field_offset[i], ts->fields[i].type);
+      }
+    }
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(t);
+      uint32_t n = in.read_int();
+      uint64_t aoff = region.allocate(ta->content_alignment(),
+				      ta->content_size(n));
+      region.store_int(aoff, n);
+      uint64_t elements_off = aoff + ta->elements_offset(n);
+      uint64_t element_size = ta->element_size();
+      if (ta->element_type->kind == BaseType::Kind::INT32
+	  && ta->element_type->required) {
+	assert(element_size == 4);
+	decode_varint_elements<int32_t>(in, region, elements_off, n);
+      } else if (ta->element_type->kind == BaseType::Kind::INT64
+		 && ta->element_type->required) {
+	assert(element_size == 8);
+	decode_varint_elements<int64_t>(in, region, elements_off, n);
+      } else if (uint64_t w = fixed_width(ta->element_type)) {
+	decode_fixed_elements(in, region, elements_off, ta->element_type, n, w, element_size);
+      } else {
+	in.read_bytes(region, aoff + 4, ta->missing_bits_size(n));
+	for (uint64_t i = 0; i < n; ++i)
+	  if (region.is_element_defined(ta, aoff, i))
+	    decode(in, region, elements_off + i*element_size, ta->element_type);
+      }
+      region.store_offset(off, aoff);
+    }
+    break;
+  default: abort();
+  }
+}
+
+void
+decode_elements(BlockInputBuffer &in, Region &region, offset_t off, const TArray *t,
+		const std::vector<uint64_t> &indices) {
+  uint32_t n = in.read_int();
+  uint64_t m = indices.size();
+  if (m > 0 && indices.back() >= n)
+    throw std::runtime_error(fmt::format("array has {} elements, selected element {}", n, indices.back()));
+  
+  const Type *et = t->element_type;
+  std::vector<uint8_t> bits;
+  if (!et->required) {
+    bits.resize(t->missing_bits_size(n));
+    in.read_bytes((char *)bits.data(), bits.size());
+  }
+  
+  uint64_t aoff = region.allocate(t->content_alignment(), t->content_size(m));
+  region.store_int(aoff, m);
+  memset(region.mem + aoff + 4, 0, t->missing_bits_size(m));
+  uint64_t elements_off = aoff + t->elements_offset(m);
+  uint64_t element_size = t->element_size();
+  uint64_t j = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    bool missing = !bits.empty() && test_bit(bits.data(), i);
+    if (j < m && indices[j] == i) {
+      if (missing)
+	region.set_bit(aoff + 4, j);
+      else
+	decode(in, region, elements_off + j*element_size, et);
+      ++j;
+    } else if (!missing)
+      skip(in, et);
+  }
+  region.store_offset(off, aoff);
+}
+
+void
+skip(BlockInputBuffer &in, const Type *t) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    in.skip_bytes(1);
+    break;
+  case BaseType::Kind::INT32:
+  case BaseType::Kind::INT64:
+    in.skip_varint();
+    break;
+  case BaseType::Kind::FLOAT32:
+    in.skip_bytes(4);
+    break;
+  case BaseType::Kind::FLOAT64:
+    in.skip_bytes(8);
+    break;
+  case BaseType::Kind::STRING:
+    in.skip_bytes((uint32_t)in.read_int());
+    break;
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(t);
+      uint64_t nbytes = ts->missing_bits_size();
+      uint8_t small[16];
+      std::vector<uint8_t> large;
+      uint8_t *bits = small;
+      if (nbytes > sizeof(small)) {
+	large.resize(nbytes);
+	bits = large.data();
+      }
+      in.read_bytes((char *)bits, nbytes);
+      for (uint64_t i = 0; i < ts->fields.size(); ++i) {
+	if (ts->fields[i].type->required
+	    || !test_bit(bits, ts->field_missing_bit[i]))
+	  skip(in, ts->fields[i].type);
+      }
+    }
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(t);
+      uint32_t n = in.read_int();
+      const Type *et = ta->element_type;
+      if (uint64_t w = fixed_width(et))
+	in.skip_bytes(w * n);
+      else if (et->required && et->kind == BaseType::Kind::INT32)
+	skip_varint_elements<int32_t>(in, n);
+      else if (et->required && et->kind == BaseType::Kind::INT64)
+	skip_varint_elements<int64_t>(in, n);
+      else if (et->required) {
+	for (uint64_t i = 0; i < n; ++i)
+	  skip(in, et);
+      } else {
+	std::vector<uint8_t> bits(ta->missing_bits_size(n));
+	in.read_bytes((char *)bits.data(), bits.size());
+	for (uint64_t i = 0; i < n; ++i)
+	  if (!test_bit(bits.data(), i))
+	    skip(in, et);
+      }
+    }
+    break;
+  default: abort();
+  }
+}
+
+} // namespace hail
@@ -0,0 +1,27 @@
+#ifndef HAIL_DECODE_HH
+#define HAIL_DECODE_HH
+#pragma once
+
+#include <vector>
+
+#include "region.hh"
+#include "inputbuffer.hh"
+
+namespace hail {
+
+// decode a value of fundamental type t from in into region at off
+extern void decode(BlockInputBuffer &in, Region &region, offset_t off, const Type *t);
+
+// decode the elements of array type t at indices, which are sorted,
+// from in as a compacted array of indices.size() elements, skipping the
+// other elements.  Stores the array's offset at off.  Throws
+// std::runtime_error if an index is past the end of the array.
+extern void decode_elements(BlockInputBuffer &in, Region &region, offset_t off, const TArray *t,
+			    const std::vector<uint64_t> &indices);
+
+// advance in past a value of fundamental type t without decoding it
+extern void skip(BlockInputBuffer &in, const Type *t);
+
+} // namespace hail
+
+#endif // HAIL_DECODE_HH
@@ -0,0 +1,1230 @@
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include <fmt/format.h>
+
+#include "casting.hh"
+#include "context.hh"
+#include "expr.hh"
+
+namespace hail {
+
+Expr::Expr(Kind kind)
+  : kind(kind),
+    literal_kind(BaseType::Kind::BOOLEAN),
+    bool_value(false),
+    int_value(0),
+    double_value(0) {}
+
+namespace {
+
+std::shared_ptr<Expr>
+make_expr(Expr::Kind kind, std::vector<ExprPtr> children) {
+  auto e = std::make_shared<Expr>(kind);
+  e->children = std::move(children);
+  return e;
+}
+
+std::shared_ptr<Expr>
+make_literal(BaseType::Kind k) {
+  auto e = std::make_shared<Expr>(Expr::Kind::LITERAL);
+  e->literal_kind = k;
+  return e;
+}
+
+} // namespace
+
+ExprPtr
+ref(const std::string &name) {
+  auto e = make_expr(Expr::Kind::REF, {});
+  e->name = name;
+  return e;
+}
+
+ExprPtr
+bool_literal(bool b) {
+  auto e = make_literal(BaseType::Kind::BOOLEAN);
+  e->bool_value = b;
+  return e;
+}
+
+ExprPtr
+int32_literal(int32_t i) {
+  auto e = make_literal(BaseType::Kind::INT32);
+  e->int_value = i;
+  return e;
+}
+
+ExprPtr
+int64_literal(int64_t l) {
+  auto e = make_literal(BaseType::Kind::INT64);
+  e->int_value = l;
+  return e;
+}
+
+ExprPtr
+float64_literal(double d) {
+  auto e = make_literal(BaseType::Kind::FLOAT64);
+  e->double_value = d;
+  return e;
+}
+
+ExprPtr
+string_literal(const std::string &s) {
+  auto e = make_literal(BaseType::Kind::STRING);
+  e->string_value = s;
+  return e;
+}
+
+ExprPtr
+get_field(ExprPtr e, const std::string &name) {
+  auto g = make_expr(Expr::Kind::GET_FIELD, { e });
+  g->name = name;
+  return g;
+}
+
+ExprPtr
+binary(Expr::Kind kind, ExprPtr l, ExprPtr r) {
+  return make_expr(kind, { l, r });
+}
+
+ExprPtr
+logical_not(ExprPtr e) {
+  return make_expr(Expr::Kind::NOT, { e });
+}
+
+ExprPtr
+is_missing(ExprPtr e) {
+  return make_expr(Expr::Kind::IS_MISSING, { e });
+}
+
+ExprPtr
+array_length(ExprPtr a) {
+  return make_expr(Expr::Kind::ARRAY_LENGTH, { a });
+}
+
+ExprPtr
+array_sum(ExprPtr a) {
+  return make_expr(Expr::Kind::ARRAY_SUM, { a });
+}
+
+ExprPtr
+array_map(ExprPtr a, const std::string &name, ExprPtr body) {
+  auto e = make_expr(Expr::Kind::ARRAY_MAP, { a, body });
+  e->name = name;
+  return e;
+}
+
+ExprPtr
+array_filter(ExprPtr a, const std::string &name, ExprPtr cond) {
+  auto e = make_expr(Expr::Kind::ARRAY_FILTER, { a, cond });
+  e->name = name;
+  return e;
+}
+
+void
+Column::reset(const Type *t, size_t n) {
+  type = t;
+  size = n;
+  missing.assign(n, 0);
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    bools.resize(n);
+    break;
+  case BaseType::Kind::INT32:
+    ints.resize(n);
+    break;
+  case BaseType::Kind::INT64:
+    longs.resize(n);
+    break;
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+    doubles.resize(n);
+    break;
+  case BaseType::Kind::STRING:
+  case BaseType::Kind::STRUCT:
+    offsets.resize(n);
+    break;
+  case BaseType::Kind::ARRAY:
+    starts.assign(n + 1, 0);
+    if (!elements)
+      elements = std::make_unique<Column>();
+    break;
+  default: abort();
+  }
+}
+
+// Binding of the innermost variable for a batch.  parent maps each
+// position of this batch to its position in the outer batch.
+class Scope {
+public:
+  const std::string &name;
+  const Column &value;
+  const Scope *outer;
+  const std::vector<uint64_t> *parent;
+  size_t n;
+};
+
+class ExprNode {
+public:
+  const Type *type;
+
+  ExprNode(const Type *type) : type(type) {}
+  virtual ~ExprNode() {}
+
+  virtual void eval(const Region &region, const Scope &scope, Column &out) const = 0;
+
+  // whether this node and its children implement eval_scalar()
+  virtual bool has_scalar() const { return false; }
+  // evaluate for the root value at offset root
+  virtual void eval_scalar(const Region &region, offset_t root, Scalar &out) const { abort(); }
+};
+
+namespace {
+
+using NodePtr = std::shared_ptr<const ExprNode>;
+
+bool
+is_numeric(const Type *t) {
+  switch (t->kind) {
+  case BaseType::Kind::INT32:
+  case BaseType::Kind::INT64:
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the type of a column holding values of region type t
+const Type *
+column_type(Context &c, const Type *t) {
+  t = t->fundamental_type;
+  if (t->kind == BaseType::Kind::FLOAT32)
+    return c.float64_type(t->required);
+  if (auto ta = dyn_cast<TArray>(t))
+    return c.array_type(column_type(c, ta->element_type), ta->required);
+  return t;
+}
+
+// Load the values at slots (offsets of the value in region, e.g. a
+// struct field) into out, whose missing bits are already set.  The
+// switch on t is hoisted out of the loop over the batch.
+void
+load_values(const Region &region, const Type *t, const Type *ct,
+	    const std::vector<offset_t> &slots, Column &out) {
+  size_t n = slots.size();
+  const uint8_t *missing = out.missing.data();
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	out.bools[i] = region.load_bool(slots[i]);
+    break;
+  case BaseType::Kind::INT32:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	out.ints[i] = region.load_int(slots[i]);
+    break;
+  case BaseType::Kind::INT64:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	out.longs[i] = region.load_long(slots[i]);
+    break;
+  case BaseType::Kind::FLOAT32:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	out.doubles[i] = region.load_float(slots[i]);
+    break;
+  case BaseType::Kind::FLOAT64:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	out.doubles[i] = region.load_double(slots[i]);
+    break;
+  case BaseType::Kind::STRING:
+    for (size_t i = 0; i < n; ++i)
+      if (!missing[i])
+	out.offsets[i] = region.load_offset(slots[i]);
+    break;
+  case BaseType::Kind::STRUCT:
+    for (size_t i = 0; i < n; ++i)
+      out.offsets[i] = slots[i];
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(t);
+      const Type *et = ta->element_type->fundamental_type;
+      uint64_t element_size = ta->element_size();
+
+      out.starts[0] = 0;
+      for (size_t i = 0; i < n; ++i) {
+	uint64_t len = missing[i] ? 0 : region.load_int(region.load_offset(slots[i]));
+	out.starts[i + 1] = out.starts[i] + len;
+      }
+
+      Column &elements = *out.elements;
+      elements.reset(cast<TArray>(ct)->element_type, out.starts[n]);
+      std::vector<offset_t> element_slots(out.starts[n]);
+      for (size_t i = 0; i < n; ++i) {
+	if (missing[i])
+	  continue;
+	offset_t aoff = region.load_offset(slots[i]);
+	uint64_t len = out.starts[i + 1] - out.starts[i];
+	offset_t elements_off = aoff + ta->elements_offset(len);
+	uint64_t k = out.starts[i];
+	for (uint64_t j = 0; j < len; ++j) {
+	  element_slots[k + j] = elements_off + j * element_size;
+	  elements.missing[k + j] = region.is_element_missing(ta, aoff, j);
+	}
+      }
+      load_values(region, et, elements.type, element_slots, elements);
+    }
+    break;
+  default: abort();
+  }
+}
+
+// out[i] = in[index[i]]
+void
+gather(const Column &in, const std::vector<uint64_t> &index, Column &out) {
+  size_t n = index.size();
+  out.reset(in.type, n);
+  for (size_t i = 0; i < n; ++i)
+    out.missing[i] = in.missing[index[i]];
+  switch (in.type->kind) {
+  case BaseType::Kind::BOOLEAN:
+    for (size_t i = 0; i < n; ++i)
+      out.bools[i] = in.bools[index[i]];
+    break;
+  case BaseType::Kind::INT32:
+    for (size_t i = 0; i < n; ++i)
+      out.ints[i] = in.ints[index[i]];
+    break;
+  case BaseType::Kind::INT64:
+    for (size_t i = 0; i < n; ++i)
+      out.longs[i] = in.longs[index[i]];
+    break;
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+    for (size_t i = 0; i < n; ++i)
+      out.doubles[i] = in.doubles[index[i]];
+    break;
+  case BaseType::Kind::STRING:
+  case BaseType::Kind::STRUCT:
+    for (size_t i = 0; i < n; ++i)
+      out.offsets[i] = in.offsets[index[i]];
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      std::vector<uint64_t> element_index;
+      out.starts[0] = 0;
+      for (size_t i = 0; i < n; ++i) {
+	uint64_t b = in.starts[index[i]], e = in.starts[index[i] + 1];
+	for (uint64_t j = b; j < e; ++j)
+	  element_index.push_back(j);
+	out.starts[i + 1] = out.starts[i] + (e - b);
+      }
+      gather(*in.elements, element_index, *out.elements);
+    }
+    break;
+  default: abort();
+  }
+}
+
+// numeric values of c converted to T
+template<typename T> void
+numeric_values(const Column &c, std::vector<T> &v) {
+  v.resize(c.size);
+  switch (c.type->kind) {
+  case BaseType::Kind::INT32:
+    std::copy(c.ints.begin(), c.ints.end(), v.begin());
+    break;
+  case BaseType::Kind::INT64:
+    std::copy(c.longs.begin(), c.longs.end(), v.begin());
+    break;
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+    std::copy(c.doubles.begin(), c.doubles.end(), v.begin());
+    break;
+  default: abort();
+  }
+}
+
+template<typename T> std::vector<T> &
+column_values(Column &c);
+
+template<> std::vector<int32_t> &column_values(Column &c) { return c.ints; }
+template<> std::vector<int64_t> &column_values(Column &c) { return c.longs; }
+template<> std::vector<double> &column_values(Column &c) { return c.doubles; }
+
+// the numeric value of s, of column type t, converted to T
+template<typename T> T
+numeric_value(const Type *t, const Scalar &s) {
+  switch (t->kind) {
+  case BaseType::Kind::INT32: return s.i;
+  case BaseType::Kind::INT64: return s.l;
+  case BaseType::Kind::FLOAT64: return s.d;
+  default: abort();
+  }
+}
+
+template<typename T> T &scalar_value(Scalar &s);
+
+template<> int32_t &scalar_value(Scalar &s) { return s.i; }
+template<> int64_t &scalar_value(Scalar &s) { return s.l; }
+template<> double &scalar_value(Scalar &s) { return s.d; }
+
+// Integer arithmetic wraps around: it is done in the unsigned type,
+// as signed overflow is undefined, and converted back.
+template<typename T> T
+add(T a, T b) {
+  if constexpr (std::is_integral<T>::value)
+    return (T)((std::make_unsigned_t<T>)a + (std::make_unsigned_t<T>)b);
+  else
+    return a + b;
+}
+
+template<typename T> T
+subtract(T a, T b) {
+  if constexpr (std::is_integral<T>::value)
+    return (T)((std::make_unsigned_t<T>)a - (std::make_unsigned_t<T>)b);
+  else
+    return a - b;
+}
+
+template<typename T> T
+multiply(T a, T b) {
+  if constexpr (std::is_integral<T>::value)
+    return (T)((std::make_unsigned_t<T>)a * (std::make_unsigned_t<T>)b);
+  else
+    return a * b;
+}
+
+// the value at slot in region of type t into out, defined
+void
+load_scalar(const Region &region, const Type *t, offset_t slot, Scalar &out) {
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN: out.b = region.load_bool(slot); break;
+  case BaseType::Kind::INT32: out.i = region.load_int(slot); break;
+  case BaseType::Kind::INT64: out.l = region.load_long(slot); break;
+  case BaseType::Kind::FLOAT32: out.d = region.load_float(slot); break;
+  case BaseType::Kind::FLOAT64: out.d = region.load_double(slot); break;
+  case BaseType::Kind::STRING:
+  case BaseType::Kind::ARRAY:
+    out.offset = region.load_offset(slot);
+    break;
+  case BaseType::Kind::STRUCT: out.offset = slot; break;
+  default: abort();
+  }
+}
+
+class RefNode : public ExprNode {
+public:
+  std::string name;
+
+  RefNode(const Type *type, const std::string &name)
+    : ExprNode(type), name(name) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    const Scope *s = &scope;
+    std::vector<uint64_t> index;
+    bool composed = false;
+    while (s->name != name) {
+      // map positions of the inner batch to the enclosing batch
+      const std::vector<uint64_t> &parent = *s->parent;
+      if (!composed) {
+	index = parent;
+	composed = true;
+      } else {
+	for (auto &i : index)
+	  i = parent[i];
+      }
+      s = s->outer;
+    }
+    if (composed)
+      gather(s->value, index, out);
+    else {
+      std::vector<uint64_t> identity(s->n);
+      for (size_t i = 0; i < s->n; ++i)
+	identity[i] = i;
+      gather(s->value, identity, out);
+    }
+  }
+
+  // outside array_map bodies, only the root is in scope
+  bool has_scalar() const { return true; }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    out.missing = false;
+    out.offset = root;
+  }
+};
+
+class LiteralNode : public ExprNode {
+public:
+  ExprPtr e;
+
+  LiteralNode(const Type *type, ExprPtr e)
+    : ExprNode(type), e(e) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    out.reset(type, scope.n);
+    switch (type->kind) {
+    case BaseType::Kind::BOOLEAN:
+      std::fill(out.bools.begin(), out.bools.end(), e->bool_value);
+      break;
+    case BaseType::Kind::INT32:
+      std::fill(out.ints.begin(), out.ints.end(), e->int_value);
+      break;
+    case BaseType::Kind::INT64:
+      std::fill(out.longs.begin(), out.longs.end(), e->int_value);
+      break;
+    case BaseType::Kind::FLOAT64:
+      std::fill(out.doubles.begin(), out.doubles.end(), e->double_value);
+      break;
+    default: abort();
+    }
+  }
+
+  bool has_scalar() const { return true; }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    out.missing = false;
+    switch (type->kind) {
+    case BaseType::Kind::BOOLEAN: out.b = e->bool_value; break;
+    case BaseType::Kind::INT32: out.i = e->int_value; break;
+    case BaseType::Kind::INT64: out.l = e->int_value; break;
+    case BaseType::Kind::FLOAT64: out.d = e->double_value; break;
+    default: abort();
+    }
+  }
+};
+
+class GetFieldNode : public ExprNode {
+public:
+  NodePtr child;
+  const TStruct *ts;
+  uint64_t index;
+
+  GetFieldNode(const Type *type, NodePtr child, const TStruct *ts, uint64_t index)
+    : ExprNode(type), child(child), ts(ts), index(index) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column s;
+    child->eval(region, scope, s);
+    out.reset(type, s.size);
+    std::vector<offset_t> slots(s.size);
+    for (size_t i = 0; i < s.size; ++i) {
+      out.missing[i] = s.missing[i] || region.is_field_missing(ts, s.offsets[i], index);
+      slots[i] = s.offsets[i] + ts->field_offset[index];
+    }
+    load_values(region, ts->fields[index].type->fundamental_type, type, slots, out);
+  }
+
+  bool has_scalar() const { return child->has_scalar(); }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar s;
+    child->eval_scalar(region, root, s);
+    out.missing = s.missing || region.is_field_missing(ts, s.offset, index);
+    if (!out.missing)
+      load_scalar(region, ts->fields[index].type->fundamental_type, s.offset + ts->field_offset[index], out);
+  }
+};
+
+class ArithmeticNode : public ExprNode {
+public:
+  Expr::Kind op;
+  NodePtr l, r;
+
+  ArithmeticNode(const Type *type, Expr::Kind op, NodePtr l, NodePtr r)
+    : ExprNode(type), op(op), l(l), r(r) {}
+
+  template<typename T, typename F> static void
+  apply(const Column &lc, const Column &rc, Column &out, F f) {
+    std::vector<T> lv, rv;
+    numeric_values(lc, lv);
+    numeric_values(rc, rv);
+    std::vector<T> &ov = column_values<T>(out);
+    size_t n = out.size;
+    for (size_t i = 0; i < n; ++i)
+      ov[i] = f(lv[i], rv[i]);
+  }
+
+  // DIV is Float64 only, so never divides integers
+  template<typename T> static T
+  divide(T a, T b) {
+    if constexpr (std::is_integral<T>::value)
+      abort();
+    else
+      return a / b;
+  }
+
+  template<typename T> void
+  apply_op(const Column &lc, const Column &rc, Column &out) const {
+    switch (op) {
+    case Expr::Kind::ADD: apply<T>(lc, rc, out, add<T>); break;
+    case Expr::Kind::SUB: apply<T>(lc, rc, out, subtract<T>); break;
+    case Expr::Kind::MUL: apply<T>(lc, rc, out, multiply<T>); break;
+    case Expr::Kind::DIV: apply<T>(lc, rc, out, divide<T>); break;
+    default: abort();
+    }
+  }
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column lc, rc;
+    l->eval(region, scope, lc);
+    r->eval(region, scope, rc);
+    out.reset(type, lc.size);
+    for (size_t i = 0; i < out.size; ++i)
+      out.missing[i] = lc.missing[i] | rc.missing[i];
+    // missing slots hold arbitrary (but initialized) values, which the
+    // ops are defined on
+    switch (type->kind) {
+    case BaseType::Kind::INT32: apply_op<int32_t>(lc, rc, out); break;
+    case BaseType::Kind::INT64: apply_op<int64_t>(lc, rc, out); break;
+    case BaseType::Kind::FLOAT64: apply_op<double>(lc, rc, out); break;
+    default: abort();
+    }
+  }
+
+  template<typename T> void
+  apply_scalar(const Scalar &ls, const Scalar &rs, Scalar &out) const {
+    T a = numeric_value<T>(l->type, ls), b = numeric_value<T>(r->type, rs);
+    T &o = scalar_value<T>(out);
+    switch (op) {
+    case Expr::Kind::ADD: o = add(a, b); break;
+    case Expr::Kind::SUB: o = subtract(a, b); break;
+    case Expr::Kind::MUL: o = multiply(a, b); break;
+    case Expr::Kind::DIV: o = divide(a, b); break;
+    default: abort();
+    }
+  }
+
+  bool has_scalar() const { return l->has_scalar() && r->has_scalar(); }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar ls, rs;
+    l->eval_scalar(region, root, ls);
+    r->eval_scalar(region, root, rs);
+    out.missing = ls.missing || rs.missing;
+    if (out.missing)
+      return;
+    switch (type->kind) {
+    case BaseType::Kind::INT32: apply_scalar<int32_t>(ls, rs, out); break;
+    case BaseType::Kind::INT64: apply_scalar<int64_t>(ls, rs, out); break;
+    case BaseType::Kind::FLOAT64: apply_scalar<double>(ls, rs, out); break;
+    default: abort();
+    }
+  }
+};
+
+class CompareNode : public ExprNode {
+public:
+  Expr::Kind op;
+  NodePtr l, r;
+  // kind both sides are compared as
+  BaseType::Kind compare_kind;
+
+  CompareNode(const Type *type, Expr::Kind op, NodePtr l, NodePtr r, BaseType::Kind compare_kind)
+    : ExprNode(type), op(op), l(l), r(r), compare_kind(compare_kind) {}
+
+  template<typename T, typename F> static void
+  apply(const std::vector<T> &lv, const std::vector<T> &rv, Column &out, F f) {
+    size_t n = out.size;
+    for (size_t i = 0; i < n; ++i)
+      out.bools[i] = f(lv[i], rv[i]);
+  }
+
+  template<typename T> void
+  apply_op(const std::vector<T> &lv, const std::vector<T> &rv, Column &out) const {
+    switch (op) {
+    case Expr::Kind::EQ: apply(lv, rv, out, [](T a, T b) { return a == b; }); break;
+    case Expr::Kind::NE: apply(lv, rv, out, [](T a, T b) { return a != b; }); break;
+    case Expr::Kind::LT: apply(lv, rv, out, [](T a, T b) { return a < b; }); break;
+    case Expr::Kind::LE: apply(lv, rv, out, [](T a, T b) { return a <= b; }); break;
+    case Expr::Kind::GT: apply(lv, rv, out, [](T a, T b) { return a > b; }); break;
+    case Expr::Kind::GE: apply(lv, rv, out, [](T a, T b) { return a >= b; }); break;
+    default: abort();
+    }
+  }
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column lc, rc;
+    l->eval(region, scope, lc);
+    r->eval(region, scope, rc);
+    size_t n = lc.size;
+    out.reset(type, n);
+    for (size_t i = 0; i < n; ++i)
+      out.missing[i] = lc.missing[i] | rc.missing[i];
+    switch (compare_kind) {
+    case BaseType::Kind::BOOLEAN:
+      apply_op(lc.bools, rc.bools, out);
+      break;
+    case BaseType::Kind::INT32:
+      apply_op(lc.ints, rc.ints, out);
+      break;
+    case BaseType::Kind::INT64:
+      {
+	std::vector<int64_t> lv, rv;
+	numeric_values(lc, lv);
+	numeric_values(rc, rv);
+	apply_op(lv, rv, out);
+      }
+      break;
+    case BaseType::Kind::FLOAT64:
+      {
+	std::vector<double> lv, rv;
+	numeric_values(lc, lv);
+	numeric_values(rc, rv);
+	apply_op(lv, rv, out);
+      }
+      break;
+    case BaseType::Kind::STRING:
+      {
+	// right side is a literal or a string column
+	bool equal_is_true = op == Expr::Kind::EQ;
+	for (size_t i = 0; i < n; ++i) {
+	  if (out.missing[i])
+	    continue;
+	  const char *a = region.mem + lc.offsets[i];
+	  const char *b = region.mem + rc.offsets[i];
+	  uint32_t alen = *(const uint32_t *)a, blen = *(const uint32_t *)b;
+	  bool equal = alen == blen && memcmp(a + 4, b + 4, alen) == 0;
+	  out.bools[i] = equal == equal_is_true;
+	}
+      }
+      break;
+    default: abort();
+    }
+  }
+
+  template<typename T> bool
+  compare(T a, T b) const {
+    switch (op) {
+    case Expr::Kind::EQ: return a == b;
+    case Expr::Kind::NE: return a != b;
+    case Expr::Kind::LT: return a < b;
+    case Expr::Kind::LE: return a <= b;
+    case Expr::Kind::GT: return a > b;
+    case Expr::Kind::GE: return a >= b;
+    default: abort();
+    }
+  }
+
+  bool has_scalar() const { return l->has_scalar() && r->has_scalar(); }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar ls, rs;
+    l->eval_scalar(region, root, ls);
+    r->eval_scalar(region, root, rs);
+    out.missing = ls.missing || rs.missing;
+    if (out.missing)
+      return;
+    switch (compare_kind) {
+    case BaseType::Kind::BOOLEAN:
+      out.b = compare(ls.b, rs.b);
+      break;
+    case BaseType::Kind::INT32:
+      out.b = compare(ls.i, rs.i);
+      break;
+    case BaseType::Kind::INT64:
+      out.b = compare(numeric_value<int64_t>(l->type, ls), numeric_value<int64_t>(r->type, rs));
+      break;
+    case BaseType::Kind::FLOAT64:
+      out.b = compare(numeric_value<double>(l->type, ls), numeric_value<double>(r->type, rs));
+      break;
+    case BaseType::Kind::STRING:
+      {
+	const char *a = region.mem + ls.offset;
+	const char *b = region.mem + rs.offset;
+	uint32_t alen = *(const uint32_t *)a, blen = *(const uint32_t *)b;
+	bool equal = alen == blen && memcmp(a + 4, b + 4, alen) == 0;
+	out.b = equal == (op == Expr::Kind::EQ);
+      }
+      break;
+    default: abort();
+    }
+  }
+};
+
+// String literals are compared by content, so they are copied into a
+// buffer laid out like a region string and compared through a second
+// region.
+class StringCompareLiteralNode : public ExprNode {
+public:
+  Expr::Kind op;
+  NodePtr l;
+  std::string value;
+
+  StringCompareLiteralNode(const Type *type, Expr::Kind op, NodePtr l, const std::string &value)
+    : ExprNode(type), op(op), l(l), value(value) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column lc;
+    l->eval(region, scope, lc);
+    size_t n = lc.size;
+    out.reset(type, n);
+    bool equal_is_true = op == Expr::Kind::EQ;
+    uint32_t vlen = value.size();
+    for (size_t i = 0; i < n; ++i) {
+      out.missing[i] = lc.missing[i];
+      if (out.missing[i])
+	continue;
+      const char *a = region.mem + lc.offsets[i];
+      uint32_t alen = *(const uint32_t *)a;
+      bool equal = alen == vlen && memcmp(a + 4, value.data(), alen) == 0;
+      out.bools[i] = equal == equal_is_true;
+    }
+  }
+
+  bool has_scalar() const { return l->has_scalar(); }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar ls;
+    l->eval_scalar(region, root, ls);
+    out.missing = ls.missing;
+    if (out.missing)
+      return;
+    const char *a = region.mem + ls.offset;
+    uint32_t alen = *(const uint32_t *)a;
+    bool equal = alen == value.size() && memcmp(a + 4, value.data(), alen) == 0;
+    out.b = equal == (op == Expr::Kind::EQ);
+  }
+};
+
+class LogicalNode : public ExprNode {
+public:
+  Expr::Kind op;
+  NodePtr l, r;
+
+  LogicalNode(const Type *type, Expr::Kind op, NodePtr l, NodePtr r)
+    : ExprNode(type), op(op), l(l), r(r) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column lc;
+    l->eval(region, scope, lc);
+    size_t n = lc.size;
+    out.reset(type, n);
+    if (op == Expr::Kind::NOT) {
+      for (size_t i = 0; i < n; ++i) {
+	out.missing[i] = lc.missing[i];
+	out.bools[i] = !lc.bools[i];
+      }
+      return;
+    }
+
+    Column rc;
+    r->eval(region, scope, rc);
+    // the dominant value decides regardless of missingness
+    uint8_t dominant = op == Expr::Kind::OR;
+    for (size_t i = 0; i < n; ++i) {
+      bool ld = !lc.missing[i] && lc.bools[i] == dominant;
+      bool rd = !rc.missing[i] && rc.bools[i] == dominant;
+      if (ld || rd) {
+	out.missing[i] = 0;
+	out.bools[i] = dominant;
+      } else {
+	out.missing[i] = lc.missing[i] | rc.missing[i];
+	out.bools[i] = !dominant;
+      }
+    }
+  }
+
+  bool has_scalar() const { return l->has_scalar() && (!r || r->has_scalar()); }
+  // r is not evaluated if l decides
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar ls;
+    l->eval_scalar(region, root, ls);
+    if (op == Expr::Kind::NOT) {
+      out.missing = ls.missing;
+      out.b = !ls.b;
+      return;
+    }
+    bool dominant = op == Expr::Kind::OR;
+    out.missing = false;
+    out.b = dominant;
+    if (!ls.missing && ls.b == dominant)
+      return;
+    Scalar rs;
+    r->eval_scalar(region, root, rs);
+    if (!rs.missing && rs.b == dominant)
+      return;
+    out.missing = ls.missing || rs.missing;
+    out.b = !dominant;
+  }
+};
+
+class IsMissingNode : public ExprNode {
+public:
+  NodePtr child;
+
+  IsMissingNode(const Type *type, NodePtr child)
+    : ExprNode(type), child(child) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column c;
+    child->eval(region, scope, c);
+    out.reset(type, c.size);
+    std::copy(c.missing.begin(), c.missing.end(), out.bools.begin());
+  }
+
+  bool has_scalar() const { return child->has_scalar(); }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar c;
+    child->eval_scalar(region, root, c);
+    out.missing = false;
+    out.b = c.missing;
+  }
+};
+
+class ArrayLengthNode : public ExprNode {
+public:
+  NodePtr child;
+
+  ArrayLengthNode(const Type *type, NodePtr child)
+    : ExprNode(type), child(child) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column a;
+    child->eval(region, scope, a);
+    out.reset(type, a.size);
+    for (size_t i = 0; i < a.size; ++i) {
+      out.missing[i] = a.missing[i];
+      out.ints[i] = a.starts[i + 1] - a.starts[i];
+    }
+  }
+
+  bool has_scalar() const { return child->has_scalar(); }
+  void eval_scalar(const Region &region, offset_t root, Scalar &out) const {
+    Scalar a;
+    child->eval_scalar(region, root, a);
+    out.missing = a.missing;
+    if (!out.missing)
+      out.i = region.load_int(a.offset);
+  }
+};
+
+class ArraySumNode : public ExprNode {
+public:
+  NodePtr child;
+
+  ArraySumNode(const Type *type, NodePtr child)
+    : ExprNode(type), child(child) {}
+
+  template<typename T> void
+  sum(const Column &a, Column &out) const {
+    std::vector<T> ev;
+    numeric_values(*a.elements, ev);
+    const uint8_t *emissing = a.elements->missing.data();
+    std::vector<T> &ov = column_values<T>(out);
+    for (size_t i = 0; i < a.size; ++i) {
+      T s = 0;
+      for (uint64_t j = a.starts[i]; j < a.starts[i + 1]; ++j)
+	s = add<T>(s, emissing[j] ? 0 : ev[j]);
+      ov[i] = s;
+    }
+  }
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column a;
+    child->eval(region, scope, a);
+    out.reset(type, a.size);
+    out.missing = a.missing;
+    if (type->kind == BaseType::Kind::INT64)
+      sum<int64_t>(a, out);
+    else
+      sum<double>(a, out);
+  }
+};
+
+class ArrayMapNode : public ExprNode {
+public:
+  NodePtr array;
+  std::string name;
+  NodePtr body;
+  bool filter;
+
+  ArrayMapNode(const Type *type, NodePtr array, const std::string &name, NodePtr body, bool filter)
+    : ExprNode(type), array(array), name(name), body(body), filter(filter) {}
+
+  void eval(const Region &region, const Scope &scope, Column &out) const {
+    Column a;
+    array->eval(region, scope, a);
+    size_t n = a.size;
+
+    // the body runs once over the elements of every array in the batch
+    uint64_t n_elements = a.starts[n];
+    std::vector<uint64_t> parent(n_elements);
+    for (size_t i = 0; i < n; ++i)
+      for (uint64_t j = a.starts[i]; j < a.starts[i + 1]; ++j)
+	parent[j] = i;
+    Scope element_scope { name, *a.elements, &scope, &parent, n_elements };
+
+    Column b;
+    body->eval(region, element_scope, b);
+
+    out.reset(type, n);
+    out.missing = a.missing;
+    if (!filter) {
+      out.starts = a.starts;
+      *out.elements = std::move(b);
+      return;
+    }
+
+    std::vector<uint64_t> keep;
+    out.starts[0] = 0;
+    for (size_t i = 0; i < n; ++i) {
+      for (uint64_t j = a.starts[i]; j < a.starts[i + 1]; ++j)
+	if (!b.missing[j] && b.bools[j])
+	  keep.push_back(j);
+      out.starts[i + 1] = keep.size();
+    }
+    gather(*a.elements, keep, *out.elements);
+  }
+};
+
+class TypeEnv {
+public:
+  const std::string &name;
+  const Type *type;
+  const TypeEnv *outer;
+};
+
+const char *
+op_name(Expr::Kind k) {
+  switch (k) {
+  case Expr::Kind::ADD: return "+";
+  case Expr::Kind::SUB: return "-";
+  case Expr::Kind::MUL: return "*";
+  case Expr::Kind::DIV: return "/";
+  case Expr::Kind::EQ: return "==";
+  case Expr::Kind::NE: return "!=";
+  case Expr::Kind::LT: return "<";
+  case Expr::Kind::LE: return "<=";
+  case Expr::Kind::GT: return ">";
+  case Expr::Kind::GE: return ">=";
+  case Expr::Kind::AND: return "&&";
+  case Expr::Kind::OR: return "||";
+  default: abort();
+  }
+}
+
+// common kind for arithmetic and comparison
+BaseType::Kind
+promote(const Type *l, const Type *r) {
+  if (l->kind == BaseType::Kind::FLOAT64 || r->kind == BaseType::Kind::FLOAT64)
+    return BaseType::Kind::FLOAT64;
+  if (l->kind == BaseType::Kind::INT64 || r->kind == BaseType::Kind::INT64)
+    return BaseType::Kind::INT64;
+  return BaseType::Kind::INT32;
+}
+
+NodePtr
+check(Context &c, const ExprPtr &e, const TypeEnv *env) {
+  switch (e->kind) {
+  case Expr::Kind::REF:
+    for (const TypeEnv *s = env; s; s = s->outer)
+      if (s->name == e->name)
+	return std::make_shared<RefNode>(s->type, e->name);
+    throw ExprError(fmt::format("unbound variable: {}", e->name));
+
+  case Expr::Kind::LITERAL:
+    switch (e->literal_kind) {
+    case BaseType::Kind::BOOLEAN:
+      return std::make_shared<LiteralNode>(c.boolean_type(true), e);
+    case BaseType::Kind::INT32:
+      return std::make_shared<LiteralNode>(c.int32_type(true), e);
+    case BaseType::Kind::INT64:
+      return std::make_shared<LiteralNode>(c.int64_type(true), e);
+    case BaseType::Kind::FLOAT64:
+      return std::make_shared<LiteralNode>(c.float64_type(true), e);
+    default:
+      throw ExprError("string literals are only supported as the right side of == and !=");
+    }
+
+  case Expr::Kind::GET_FIELD:
+    {
+      NodePtr s = check(c, e->children[0], env);
+      auto ts = dyn_cast<TStruct>(s->type);
+      if (!ts)
+	throw ExprError(fmt::format("field {} of non-struct {}", e->name, s->type->to_string()));
+      for (uint64_t i = 0; i < ts->fields.size(); ++i)
+	if (ts->fields[i].name == e->name)
+	  return std::make_shared<GetFieldNode>(column_type(c, ts->fields[i].type), s, ts, i);
+      throw ExprError(fmt::format("no field {} in {}", e->name, ts->to_string()));
+    }
+
+  case Expr::Kind::ADD:
+  case Expr::Kind::SUB:
+  case Expr::Kind::MUL:
+  case Expr::Kind::DIV:
+    {
+      NodePtr l = check(c, e->children[0], env);
+      NodePtr r = check(c, e->children[1], env);
+      if (!is_numeric(l->type) || !is_numeric(r->type))
+	throw ExprError(fmt::format("{} of {} and {}", op_name(e->kind),
+				    l->type->to_string(), r->type->to_string()));
+      BaseType::Kind k = e->kind == Expr::Kind::DIV ? BaseType::Kind::FLOAT64 : promote(l->type, r->type);
+      const Type *t;
+      if (k == BaseType::Kind::FLOAT64)
+	t = c.float64_type(false);
+      else if (k == BaseType::Kind::INT64)
+	t = c.int64_type(false);
+      else
+	t = c.int32_type(false);
+      return std::make_shared<ArithmeticNode>(t, e->kind, l, r);
+    }
+
+  case Expr::Kind::EQ:
+  case Expr::Kind::NE:
+  case Expr::Kind::LT:
+  case Expr::Kind::LE:
+  case Expr::Kind::GT:
+  case Expr::Kind::GE:
+    {
+      NodePtr l = check(c, e->children[0], env);
+      const ExprPtr &re = e->children[1];
+      bool equality = e->kind == Expr::Kind::EQ || e->kind == Expr::Kind::NE;
+      if (l->type->kind == BaseType::Kind::STRING) {
+	if (!equality)
+	  throw ExprError(fmt::format("{} of strings", op_name(e->kind)));
+	if (re->kind == Expr::Kind::LITERAL && re->literal_kind == BaseType::Kind::STRING)
+	  return std::make_shared<StringCompareLiteralNode>(c.boolean_type(false), e->kind, l, re->string_value);
+	NodePtr r = check(c, re, env);
+	if (r->type->kind != BaseType::Kind::STRING)
+	  throw ExprError(fmt::format("{} of String and {}", op_name(e->kind), r->type->to_string()));
+	return std::make_shared<CompareNode>(c.boolean_type(false), e->kind, l, r, BaseType::Kind::STRING);
+      }
+      NodePtr r = check(c, re, env);
+      if (l->type->kind == BaseType::Kind::BOOLEAN && r->type->kind == BaseType::Kind::BOOLEAN)
+	return std::make_shared<CompareNode>(c.boolean_type(false), e->kind, l, r, BaseType::Kind::BOOLEAN);
+      if (!is_numeric(l->type) || !is_numeric(r->type))
+	throw ExprError(fmt::format("{} of {} and {}", op_name(e->kind),
+				    l->type->to_string(), r->type->to_string()));
+      return std::make_shared<CompareNode>(c.boolean_type(false), e->kind, l, r, promote(l->type, r->type));
+    }
+
+  case Expr::Kind::AND:
+  case Expr::Kind::OR:
+  case Expr::Kind::NOT:
+    {
+      NodePtr l = check(c, e->children[0], env);
+      NodePtr r;
+      if (e->kind != Expr::Kind::NOT)
+	r = check(c, e->children[1], env);
+      if (l->type->kind != BaseType::Kind::BOOLEAN
+	  || (r && r->type->kind != BaseType::Kind::BOOLEAN))
+	throw ExprError("logical operator on non-Boolean operand");
+      return std::make_shared<LogicalNode>(c.boolean_type(false), e->kind, l, r);
+    }
+
+  case Expr::Kind::IS_MISSING:
+    return std::make_shared<IsMissingNode>(c.boolean_type(true), check(c, e->children[0], env));
+
+  case Expr::Kind::ARRAY_LENGTH:
+  case Expr::Kind::ARRAY_SUM:
+    {
+      NodePtr a = check(c, e->children[0], env);
+      auto ta = dyn_cast<TArray>(a->type);
+      if (!ta)
+	throw ExprError(fmt::format("array operation on {}", a->type->to_string()));
+      if (e->kind == Expr::Kind::ARRAY_LENGTH)
+	return std::make_shared<ArrayLengthNode>(c.int32_type(false), a);
+      if (!is_numeric(ta->element_type))
+	throw ExprError(fmt::format("sum of {}", ta->to_string()));
+      const Type *t = ta->element_type->kind == BaseType::Kind::FLOAT64
+	? (const Type *)c.float64_type(false)
+	: (const Type *)c.int64_type(false);
+      return std::make_shared<ArraySumNode>(t, a);
+    }
+
+  case Expr::Kind::ARRAY_MAP:
+  case Expr::Kind::ARRAY_FILTER:
+    {
+      NodePtr a = check(c, e->children[0], env);
+      auto ta = dyn_cast<TArray>(a->type);
+      if (!ta)
+	throw ExprError(fmt::format("array operation on {}", a->type->to_string()));
+      TypeEnv element_env { e->name, ta->element_type, env };
+      NodePtr body = check(c, e->children[1], &element_env);
+      if (e->kind == Expr::Kind::ARRAY_MAP)
+	return std::make_shared<ArrayMapNode>(c.array_type(body->type, false), a, e->name, body, false);
+      if (body->type->kind != BaseType::Kind::BOOLEAN)
+	throw ExprError("filter condition is not Boolean");
+      return std::make_shared<ArrayMapNode>(ta, a, e->name, body, true);
+    }
+  }
+  abort();
+}
+
+} // namespace
+
+bool
+references_field(const ExprPtr &e, const std::string &root, const std::string &field) {
+  // the whole value, field included
+  if (e->kind == Expr::Kind::REF)
+    return e->name == root;
+  if (e->kind == Expr::Kind::GET_FIELD
+      && e->children[0]->kind == Expr::Kind::REF && e->children[0]->name == root)
+    return e->name == field;
+  for (const auto &child : e->children)
+    if (references_field(child, root, field))
+      return true;
+  return false;
+}
+
+CompiledExpr::CompiledExpr(std::shared_ptr<const ExprNode> root, const std::string &root_name, const Type *root_type)
+  : root(root), scalar(root->has_scalar()), root_name(root_name), root_type(root_type), type(root->type) {}
+
+void
+CompiledExpr::eval(const Region &region, const offset_t *offsets, size_t n, Column &out) const {
+  Column values;
+  values.reset(root_type, n);
+  std::vector<offset_t> slots(offsets, offsets + n);
+  load_values(region, root_type, root_type, slots, values);
+  Scope scope { root_name, values, nullptr, nullptr, n };
+  root->eval(region, scope, out);
+}
+
+void
+CompiledExpr::eval(TypedRegionValue v, Column &out) const {
+  offset_t off = v.get_offset();
+  eval(*v.get_region(), &off, 1, out);
+}
+
+void
+CompiledExpr::eval_scalar(const Region &region, offset_t offset, Scalar &out) const {
+  assert(scalar);
+  root->eval_scalar(region, offset, out);
+}
+
+CompiledExpr
+compile(Context &c, const ExprPtr &e,
+	const std::string &root_name, const Type *root_type) {
+  // rows and entries are structs, whose columns hold region offsets
+  if (!isa<TStruct>(root_type->fundamental_type))
+    throw ExprError(fmt::format("root {} is not a struct", root_type->to_string()));
+  const Type *t = root_type->fundamental_type;
+  TypeEnv env { root_name, t, nullptr };
+  return CompiledExpr(check(c, e, &env), root_name, t);
+}
+
+RowPredicate
+row_filter(Context &c, const ExprPtr &e, const TMatrixTable *t) {
+  if (references_field(e, "row", "gs"))
+    throw ExprError("row filter references gs");
+  auto compiled = std::make_shared<CompiledExpr>(compile(c, e, "row", t->row_impl_type));
+  if (compiled->type->kind != BaseType::Kind::BOOLEAN)
+    throw ExprError(fmt::format("row filter has type {}", compiled->type->to_string()));
+  if (compiled->has_scalar())
+    return [compiled](TypedRegionValue row) {
+      Scalar result;
+      compiled->eval_scalar(*row.get_region(), row.get_offset(), result);
+      return !result.missing && result.b;
+    };
+  return [compiled](TypedRegionValue row) {
+    Column result;
+    compiled->eval(row, result);
+    return result.is_defined(0) && result.bools[0];
+  };
+}
+
+} // namespace hail
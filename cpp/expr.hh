@@ -0,0 +1,176 @@
+#ifndef HAIL_EXPR_HH
+#define HAIL_EXPR_HH
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "type.hh"
+#include "region.hh"
+#include "matrixtable.hh"
+
+namespace hail {
+
+class Expr;
+using ExprPtr = std::shared_ptr<const Expr>;
+
+// Untyped expression tree.  Build with the functions below and
+// compile() against the type of the root variable.
+class Expr {
+public:
+  enum class Kind {
+    REF,
+    LITERAL,
+    GET_FIELD,
+    // arithmetic: numeric operands, promoted Int32 < Int64 < Float64;
+    // integer results wrap around.  DIV is always Float64, so division
+    // by zero gives an infinity or NaN.
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    // comparison: numeric, Boolean or (EQ, NE only) String operands
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE,
+    // three-valued logic: missing && false is false, missing || true is true
+    AND,
+    OR,
+    NOT,
+    IS_MISSING,
+    ARRAY_LENGTH,
+    // sum of the defined elements
+    ARRAY_SUM,
+    ARRAY_MAP,
+    ARRAY_FILTER,
+  };
+
+  Kind kind;
+  // REF: variable; GET_FIELD: field; ARRAY_MAP, ARRAY_FILTER: element variable
+  std::string name;
+  std::vector<ExprPtr> children;
+
+  // LITERAL
+  BaseType::Kind literal_kind;
+  bool bool_value;
+  int64_t int_value;
+  double double_value;
+  std::string string_value;
+
+  Expr(Kind kind);
+};
+
+extern ExprPtr ref(const std::string &name);
+extern ExprPtr bool_literal(bool b);
+extern ExprPtr int32_literal(int32_t i);
+extern ExprPtr int64_literal(int64_t l);
+extern ExprPtr float64_literal(double d);
+extern ExprPtr string_literal(const std::string &s);
+extern ExprPtr get_field(ExprPtr e, const std::string &name);
+extern ExprPtr binary(Expr::Kind kind, ExprPtr l, ExprPtr r);
+extern ExprPtr logical_not(ExprPtr e);
+extern ExprPtr is_missing(ExprPtr e);
+extern ExprPtr array_length(ExprPtr a);
+extern ExprPtr array_sum(ExprPtr a);
+extern ExprPtr array_map(ExprPtr a, const std::string &name, ExprPtr body);
+extern ExprPtr array_filter(ExprPtr a, const std::string &name, ExprPtr cond);
+
+class ExprError : public std::runtime_error {
+public:
+  ExprError(const std::string &what)
+    : std::runtime_error(what) {}
+};
+
+// Values of one expression for a batch.  Storage depends on type:
+// Boolean in bools, Int32 in ints, Int64 in longs, Float32 and Float64
+// in doubles, String and Struct as region offsets (of the string and
+// of the struct) in offsets.  Arrays are segmented: the elements of
+// value i are elements[starts[i] .. starts[i + 1]).
+class Column {
+public:
+  const Type *type;
+  size_t size;
+
+  std::vector<uint8_t> missing;
+  std::vector<uint8_t> bools;
+  std::vector<int32_t> ints;
+  std::vector<int64_t> longs;
+  std::vector<double> doubles;
+  std::vector<offset_t> offsets;
+  std::vector<uint64_t> starts;
+  std::unique_ptr<Column> elements;
+
+  Column() : type(nullptr), size(0) {}
+
+  // resize for n values of type t, all defined
+  void reset(const Type *t, size_t n);
+
+  bool is_missing(size_t i) const { return missing[i] != 0; }
+  bool is_defined(size_t i) const { return missing[i] == 0; }
+};
+
+// A single value of an expression, in the member for its type as in
+// Column: b for Boolean, i for Int32, l for Int64, d for Float64, and
+// the region offset of strings, structs and arrays.
+class Scalar {
+public:
+  bool missing;
+  bool b;
+  int32_t i;
+  int64_t l;
+  double d;
+  offset_t offset;
+};
+
+class ExprNode;
+
+// An expression type-checked against its root variable.  Evaluation
+// runs each node once per batch over all values in the batch (and, for
+// array operations, over all their elements at once).
+class CompiledExpr {
+  std::shared_ptr<const ExprNode> root;
+  bool scalar;
+
+public:
+  std::string root_name;
+  const Type *root_type;
+  // result type; Float32 values are widened to Float64
+  const Type *type;
+
+  CompiledExpr(std::shared_ptr<const ExprNode> root, const std::string &root_name, const Type *root_type);
+
+  // evaluate for the n values of root_type at offsets in region
+  void eval(const Region &region, const offset_t *offsets, size_t n, Column &out) const;
+
+  void eval(TypedRegionValue v, Column &out) const;
+
+  // whether eval_scalar() applies: no array_sum, array_map or
+  // array_filter
+  bool has_scalar() const { return scalar; }
+
+  // evaluate for the one value of root_type at offset in region, node
+  // by node without columns
+  void eval_scalar(const Region &region, offset_t offset, Scalar &out) const;
+};
+
+// throws ExprError if e is not well-typed
+extern CompiledExpr compile(Context &c, const ExprPtr &e,
+			    const std::string &root_name, const Type *root_type);
+
+// whether e might read field of the struct root: through a get_field
+// of it, or by using root as a whole
+extern bool references_field(const ExprPtr &e, const std::string &root, const std::string &field);
+
+// A Boolean expression over the row as a row filter; missing is false.
+// The filter runs before gs is decoded, so e must not reference gs.
+// It is evaluated a row at a time, with eval_scalar() if it can be.
+extern RowPredicate row_filter(Context &c, const ExprPtr &e, const TMatrixTable *t);
+
+} // namespace hail
+
+#endif // HAIL_EXPR_HH
@@ -0,0 +1,55 @@
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "genome.hh"
+
+namespace hail {
+
+namespace {
+
+std::vector<std::string>
+human_contigs(const std::string &prefix, const std::string &mito) {
+  std::vector<std::string> contigs;
+  for (int i = 1; i <= 22; ++i)
+    contigs.push_back(prefix + std::to_string(i));
+  contigs.push_back(prefix + "X");
+  contigs.push_back(prefix + "Y");
+  contigs.push_back(prefix + mito);
+  return contigs;
+}
+
+} // namespace
+
+ReferenceGenome::ReferenceGenome(const std::string &name, const std::vector<std::string> &contigs)
+  : name(name), contigs(contigs) {
+  for (uint64_t i = 0; i < contigs.size(); ++i)
+    contig_index.emplace(contigs[i], i);
+}
+
+const ReferenceGenome &
+ReferenceGenome::get(const std::string &name) {
+  static const ReferenceGenome grch37("GRCh37", human_contigs("", "MT"));
+  static const ReferenceGenome grch38("GRCh38", human_contigs("chr", "M"));
+  if (name == grch37.name)
+    return grch37;
+  if (name == grch38.name)
+    return grch38;
+  throw std::runtime_error(fmt::format("unknown reference genome: {}", name));
+}
+
+int
+ReferenceGenome::compare_contigs(const std::string &a, const std::string &b) const {
+  int64_t ia = contig_id(a), ib = contig_id(b);
+  if (ia != ib) {
+    // contigs of the reference first
+    if (ia == -1 || ib == -1)
+      return ia == -1 ? 1 : -1;
+    return ia < ib ? -1 : 1;
+  }
+  if (ia != -1)
+    return 0;
+  return a.compare(b);
+}
+
+} // namespace hail
@@ -0,0 +1,37 @@
+#ifndef HAIL_GENOME_HH
+#define HAIL_GENOME_HH
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hail {
+
+// The contigs of a reference genome, named by the gr of Locus and
+// Variant types, in their order in the reference.
+class ReferenceGenome {
+  std::unordered_map<std::string, int64_t> contig_index;
+
+public:
+  std::string name;
+  std::vector<std::string> contigs;
+
+  ReferenceGenome(const std::string &name, const std::vector<std::string> &contigs);
+
+  // GRCh37 or GRCh38; throws std::runtime_error for other names
+  static const ReferenceGenome &get(const std::string &name);
+
+  // index of contig in contigs, or -1 if it is not in the reference
+  int64_t contig_id(const std::string &contig) const {
+    auto i = contig_index.find(contig);
+    return i == contig_index.end() ? -1 : i->second;
+  }
+
+  // Contigs order as in the reference, then those not in it lexically.
+  int compare_contigs(const std::string &a, const std::string &b) const;
+};
+
+} // namespace hail
+
+#endif // HAIL_GENOME_HH
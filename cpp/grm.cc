@@ -0,0 +1,192 @@
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "grm.hh"
+
+namespace hail {
+
+namespace {
+
+const uint64_t T = GrmAccumulator::tile_size;
+
+// acc[r][s] += sum_p a[p][r] b[p][s] for r < 4, s < 8, where rows of
+// a, b and acc are T apart
+void
+kernel_4x8(const double *a, const double *b, uint64_t m, double *acc) {
+  double c[4][8] = {};
+  for (uint64_t p = 0; p < m; ++p) {
+    const double *bp = b + p * T;
+    for (int r = 0; r < 4; ++r) {
+      double x = a[p * T + r];
+      for (int s = 0; s < 8; ++s)
+	c[r][s] += x * bp[s];
+    }
+  }
+  for (int r = 0; r < 4; ++r)
+    for (int s = 0; s < 8; ++s)
+      acc[r * T + s] += c[r][s];
+}
+
+#ifdef AVX2_KERNELS
+
+// kernel_4x8 with acc 32-byte aligned
+TARGET_AVX2_FMA void
+kernel_4x8_avx2(const double *a, const double *b, uint64_t m, double *acc) {
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  for (uint64_t p = 0; p < m; ++p) {
+    __m256d b0 = _mm256_loadu_pd(b + p * T);
+    __m256d b1 = _mm256_loadu_pd(b + p * T + 4);
+    __m256d x = _mm256_broadcast_sd(a + p * T);
+    c00 = _mm256_fmadd_pd(x, b0, c00);
+    c01 = _mm256_fmadd_pd(x, b1, c01);
+    x = _mm256_broadcast_sd(a + p * T + 1);
+    c10 = _mm256_fmadd_pd(x, b0, c10);
+    c11 = _mm256_fmadd_pd(x, b1, c11);
+    x = _mm256_broadcast_sd(a + p * T + 2);
+    c20 = _mm256_fmadd_pd(x, b0, c20);
+    c21 = _mm256_fmadd_pd(x, b1, c21);
+    x = _mm256_broadcast_sd(a + p * T + 3);
+    c30 = _mm256_fmadd_pd(x, b0, c30);
+    c31 = _mm256_fmadd_pd(x, b1, c31);
+  }
+  _mm256_store_pd(acc, _mm256_add_pd(_mm256_load_pd(acc), c00));
+  _mm256_store_pd(acc + 4, _mm256_add_pd(_mm256_load_pd(acc + 4), c01));
+  _mm256_store_pd(acc + T, _mm256_add_pd(_mm256_load_pd(acc + T), c10));
+  _mm256_store_pd(acc + T + 4, _mm256_add_pd(_mm256_load_pd(acc + T + 4), c11));
+  _mm256_store_pd(acc + 2 * T, _mm256_add_pd(_mm256_load_pd(acc + 2 * T), c20));
+  _mm256_store_pd(acc + 2 * T + 4, _mm256_add_pd(_mm256_load_pd(acc + 2 * T + 4), c21));
+  _mm256_store_pd(acc + 3 * T, _mm256_add_pd(_mm256_load_pd(acc + 3 * T), c30));
+  _mm256_store_pd(acc + 3 * T + 4, _mm256_add_pd(_mm256_load_pd(acc + 3 * T + 4), c31));
+}
+
+#endif
+
+} // namespace
+
+GrmAccumulator::GrmAccumulator(const std::string &filename, uint64_t n,
+			       unsigned n_threads, uint64_t panel_size)
+  : g(BlockMatrix::create(filename, n, n, tile_size)),
+    n(n),
+    panel_size(panel_size),
+    n_threads(n_threads ? n_threads : std::max(1u, std::thread::hardware_concurrency())),
+    n_tiles((n + T - 1) / T),
+    panel(n_tiles * panel_size * T),
+    n_panel_rows(0),
+    n_rows(0) {
+  if (panel_size == 0)
+    throw std::runtime_error("panel size must be positive");
+}
+
+void
+GrmAccumulator::add_row(const double *row) {
+  for (uint64_t j = 0; j < n_tiles; ++j) {
+    uint64_t cols = std::min(T, n - j * T);
+    std::copy(row + j * T, row + j * T + cols, &panel[(j * panel_size + n_panel_rows) * T]);
+  }
+  ++n_rows;
+  if (++n_panel_rows == panel_size)
+    accumulate();
+}
+
+// acc is T * T scratch, 32-byte aligned
+void
+GrmAccumulator::accumulate_tile(uint64_t i, uint64_t j, double *acc) {
+  std::fill(acc, acc + T * T, 0);
+  const double *a = &panel[i * panel_size * T];
+  const double *b = &panel[j * panel_size * T];
+  auto kernel = kernel_4x8;
+#ifdef AVX2_KERNELS
+  if (cpu_has_avx2_fma())
+    kernel = kernel_4x8_avx2;
+#endif
+  for (uint64_t r = 0; r < T; r += 4)
+    for (uint64_t s = 0; s < T; s += 8)
+      kernel(a + r, b + s, n_panel_rows, acc + r * T + s);
+
+  double *tile = g->block(i, j);
+  uint64_t rows = g->block_rows(i), cols = g->block_cols(j);
+  for (uint64_t r = 0; r < rows; ++r)
+    for (uint64_t s = 0; s < cols; ++s)
+      tile[r * cols + s] += acc[r * T + s];
+}
+
+void
+GrmAccumulator::accumulate() {
+  if (n_panel_rows == 0)
+    return;
+
+  // tiles (i, j), i <= j, numbered row by row
+  uint64_t n_work = n_tiles * (n_tiles + 1) / 2;
+  std::atomic<uint64_t> next(0);
+  auto work = [this, n_work, &next]() {
+    alignas(32) double acc[T * T];
+    uint64_t i = 0, j = 0, w = 0;
+    for (uint64_t k = next++; k < n_work; k = next++) {
+      // advance (i, j) from tile w to tile k
+      for (; w < k; ++w) {
+	if (++j == n_tiles)
+	  j = ++i;
+      }
+      accumulate_tile(i, j, acc);
+    }
+  };
+
+  unsigned n_workers = std::min<uint64_t>(n_threads, n_work);
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < n_workers; ++t)
+    threads.emplace_back(work);
+  work();
+  for (auto &t : threads)
+    t.join();
+
+  // stale rows past n_panel_rows of a partial panel are never read
+  n_panel_rows = 0;
+}
+
+void
+GrmAccumulator::finish() {
+  accumulate();
+  double scale = n_rows ? 1.0 / n_rows : 0;
+  for (uint64_t i = 0; i < n_tiles; ++i) {
+    for (uint64_t j = i; j < n_tiles; ++j) {
+      double *tile = g->block(i, j);
+      uint64_t rows = g->block_rows(i), cols = g->block_cols(j);
+      for (uint64_t k = 0; k < rows * cols; ++k)
+	tile[k] *= scale;
+      if (j == i)
+	continue;
+      double *mirror = g->block(j, i);
+      for (uint64_t r = 0; r < rows; ++r)
+	for (uint64_t s = 0; s < cols; ++s)
+	  mirror[s * rows + r] = tile[r * cols + s];
+    }
+  }
+  g.reset();
+}
+
+uint64_t
+grm(Context &c, const std::shared_ptr<const MatrixTable> &mt,
+    const std::string &filename, unsigned n_threads) {
+  DosageRows rows(c, mt, mt->all_partitions(), "GT", true);
+  GrmAccumulator acc(filename, rows.n_cols, n_threads);
+  std::vector<double> row(rows.n_cols);
+  while (rows.next(row.data())) {
+    // standardized monomorphic rows are all zero
+    if (std::any_of(row.begin(), row.end(), [](double x) { return x != 0; }))
+      acc.add_row(row.data());
+  }
+  acc.finish();
+  return acc.n_rows;
+}
+
+} // namespace hail
@@ -0,0 +1,60 @@
+#ifndef HAIL_GRM_HH
+#define HAIL_GRM_HH
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "blockmatrix.hh"
+#include "matrixtable.hh"
+
+namespace hail {
+
+// Accumulates X^T X / m for an m by n matrix X given a row at a time,
+// into an n by n BlockMatrix file.  Rows are collected into panels;
+// each full panel is multiplied into the upper triangle of tiles of
+// the result, the tiles split among threads, and the lower triangle is
+// filled in by finish().  Only one panel of X is ever in memory.
+class GrmAccumulator {
+  std::unique_ptr<BlockMatrix> g;
+  uint64_t n;
+  uint64_t panel_size;
+  unsigned n_threads;
+  uint64_t n_tiles;
+  // the panel by column tile: tile j is panel_size rows of the
+  // tile_size columns starting at j * tile_size, zero past n
+  std::vector<double> panel;
+  uint64_t n_panel_rows;
+
+  void accumulate_tile(uint64_t i, uint64_t j, double *acc);
+  void accumulate();
+
+public:
+  // the block size of the result, and the unit of work
+  static const uint64_t tile_size = 64;
+
+  uint64_t n_rows;
+
+  // n_threads 0 uses all hardware threads
+  GrmAccumulator(const std::string &filename, uint64_t n,
+		 unsigned n_threads = 0, uint64_t panel_size = 256);
+
+  void add_row(const double *row);
+
+  // scales by 1/n_rows and fills in the lower triangle; the file is
+  // incomplete until then
+  void finish();
+};
+
+// Writes the genetic relatedness matrix of mt to filename: the sample
+// by sample matrix X^T X / m, where X is the m by n_cols matrix of
+// standardized GT alternate allele counts with missing calls
+// mean-imputed.  Monomorphic rows are skipped and not counted in m.
+// Returns m.
+extern uint64_t grm(Context &c, const std::shared_ptr<const MatrixTable> &mt,
+		    const std::string &filename, unsigned n_threads = 0);
+
+} // namespace hail
+
+#endif // HAIL_GRM_HH
@@ -1,49 +1,121 @@
 
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <cstdlib>
+#include <stdexcept>
 
-#define LZ4_DISABLE_DEPRECATE_WARNINGS
-#include <lz4.h>
+#include <fmt/format.h>
 
 #include "inputbuffer.hh"
+#include "perfcounters.hh"
+#include "trace.hh"
 
 namespace hail {
 
-LZ4InputBuffer::LZ4InputBuffer()
-  : fd(-1),
+FileContents::FileContents(const std::string &filename)
+  : capacity(0), kind(PageKind::MALLOC), data(nullptr), size(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("could not stat file: {}", filename));
+  }
+  size = st.st_size;
+  
+  capacity = std::max<size_t>(size, 1);
+  char *dst = allocate_pages(capacity, kind);
+  if (!dst) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("could not allocate {} bytes", size));
+  }
+  
+  size_t n = 0;
+  while (n < size) {
+    ssize_t nread = read(fd, dst + n, size - n);
+    if (nread <= 0) {
+      free_pages(dst, capacity, kind);
+      ::close(fd);
+      throw std::runtime_error(fmt::format("could not read file: {}", filename));
+    }
+    n += nread;
+  }
+  ::close(fd);
+  data = dst;
+}
+
+FileContents::~FileContents() {
+  free_pages(const_cast<char *>(data), capacity, kind);
+}
+
+void
+BlockInputBuffer::allocate_buffers() {
+  buffers_size = block_size + 4 + codec->max_compressed_size(block_size);
+  own_buf = allocate_pages(buffers_size, buffers_kind);
+  assert(own_buf != nullptr);
+  comp = own_buf + block_size;
+  buf = own_buf;
+}
+
+BlockInputBuffer::BlockInputBuffer(const BlockCodec *codec)
+  : codec(codec),
+    fd(-1),
     off(0),
-    end(0) {
-  buf = (char *)malloc(block_size);
-  comp = (char *)malloc(4 + LZ4_compressBound(block_size));
+    end(0),
+    cache(nullptr),
+    contents_off(0) {
+  allocate_buffers();
 }
 
-LZ4InputBuffer::LZ4InputBuffer(int fd_)
-  : fd(fd_),
+BlockInputBuffer::BlockInputBuffer(const BlockCodec *codec, int fd_)
+  : codec(codec),
+    fd(fd_),
     off(0),
-    end(0) {
-  buf = (char *)malloc(block_size);
-  comp = (char *)malloc(4 + LZ4_compressBound(block_size));
+    end(0),
+    cache(nullptr),
+    contents_off(0) {
+  allocate_buffers();
+  use_cache();
 }
 
-LZ4InputBuffer &
-LZ4InputBuffer::operator=(int fd_) {
+BlockInputBuffer &
+BlockInputBuffer::operator=(int fd_) {
   if (fd != -1)
     close(fd);
   fd = fd_;
   off = 0;
   end = 0;
+  buf = own_buf;
+  block.reset();
+  contents.reset();
+  use_cache();
+  return *this;
+}
+
+BlockInputBuffer &
+BlockInputBuffer::operator=(std::shared_ptr<const FileContents> contents_) {
+  *this = -1;
+  contents = std::move(contents_);
+  contents_off = 0;
   return *this;
 }
 
-LZ4InputBuffer::~LZ4InputBuffer() {
+BlockInputBuffer::~BlockInputBuffer() {
   close(fd);
-  free(buf);
-  free(comp);
+  free_pages(own_buf, buffers_size, buffers_kind);
 }
 
 void
-LZ4InputBuffer::read_fully(void *dst0, size_t n) {
+BlockInputBuffer::use_cache() {
+  BlockCache &c = BlockCache::global();
+  cache = fd != -1 && c.enabled() && BlockCache::file_key(fd, file_key) ? &c : nullptr;
+}
+
+void
+BlockInputBuffer::read_fully(void *dst0, size_t n) {
   assert(fd != -1);
   char *dst = (char *)dst0;
   while (n > 0) {
@@ -54,26 +126,167 @@ LZ4InputBuffer::read_fully(void *dst0, size_t n) {
   }
   assert(n == 0);
 }
+
+// reads up to n bytes, fewer only at the end of the file
+size_t
+BlockInputBuffer::pread_fully(void *dst0, size_t n, uint64_t offset) {
+  assert(fd != -1);
+  char *dst = (char *)dst0;
+  size_t total = 0;
+  while (total < n) {
+    ssize_t nread = pread(fd, dst + total, n - total, offset + total);
+    assert(nread >= 0);
+    if (nread == 0)
+      break;
+    total += nread;
+  }
+  return total;
+}
   
 void
-LZ4InputBuffer::read_block() {
-  assert(off == end);
+BlockInputBuffer::read_block() {
+#ifndef NDEBUG
+  bool ok =
+#endif
+    next_block();
+  assert(ok);
+}
+
+// a varint that may end past the current block
+int32_t
+BlockInputBuffer::read_int_slow() {
+  uint32_t x = 0;
+  for (unsigned shift = 0; shift < 32; shift += 7) {
+    int8_t b = read_byte();
+    x |= (uint32_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      break;
+  }
+  return x;
+}
+
+int64_t
+BlockInputBuffer::read_long_slow() {
+  uint64_t x = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int8_t b = read_byte();
+    x |= (uint64_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      break;
+  }
+  return x;
+}
+
+void
+BlockInputBuffer::skip_varint_slow() {
+  for (unsigned shift = 0; shift < 64; shift += 7)
+    if ((read_byte() & 0x80) == 0)
+      break;
+}
+
+bool
+BlockInputBuffer::next_cached_block() {
+  block = cache->lookup(file_key);
+  if (!block) {
+    // comp_len, then comp: decomp_len and the compressed bytes
+    int32_t comp_len;
+    {
+      TraceSpan read_span("read");
+      ProfileStage stage(Profiler::READ);
+      size_t nread = pread_fully(&comp_len, 4, file_key.offset);
+      if (nread == 0)
+	return false;
+      assert(nread == 4);
+      assert((size_t)comp_len <= codec->max_compressed_size(block_size));
+#ifndef NDEBUG
+      nread =
+#endif
+	pread_fully(comp, 4 + comp_len, file_key.offset + 4);
+      assert(nread == (size_t)(4 + comp_len));
+    }
+    int decomp_len = *(int32_t *)comp;
+    assert(decomp_len <= block_size);
     
-  // read the header
+    auto b = std::make_shared<CachedBlock>(decomp_len, 8 + comp_len);
+    {
+      TraceSpan decompress_span("decompress");
+      ProfileStage stage(Profiler::DECOMPRESS);
+      codec->decompress(comp + 4, comp_len, b->data.get(), decomp_len);
+    }
+    cache->insert(file_key, b);
+    block = std::move(b);
+  }
+  
+  // readers never write to buf
+  buf = const_cast<char *>(block->data.get());
+  off = 0;
+  end = block->size;
+  file_key.offset += block->encoded_size;
+  return true;
+}
+
+bool
+BlockInputBuffer::next_memory_block() {
+  if (contents_off == contents->size)
+    return false;
+  
+  const char *p = contents->data + contents_off;
+  assert(contents_off + 8 <= contents->size);
+  int32_t comp_len = *(const int32_t *)p;
+  int32_t decomp_len = *(const int32_t *)(p + 4);
+  assert(contents_off + 8 + comp_len <= contents->size);
+  assert(decomp_len <= block_size);
+  {
+    TraceSpan decompress_span("decompress");
+    ProfileStage stage(Profiler::DECOMPRESS);
+    codec->decompress(p + 8, comp_len, own_buf, decomp_len);
+  }
+  
+  buf = own_buf;
+  off = 0;
+  end = decomp_len;
+  contents_off += 8 + comp_len;
+  return true;
+}
+
+bool
+BlockInputBuffer::next_block() {
+  assert(off == end);
+  TraceSpan span("read_block");
+  if (contents)
+    return next_memory_block();
+  if (cache)
+    return next_cached_block();
+  
   int32_t comp_len;
-  read_fully(&comp_len, 4);
+  {
+    TraceSpan read_span("read");
+    ProfileStage stage(Profiler::READ);
+    
+    // read the header
+    assert(fd != -1);
+    ssize_t nread = read(fd, &comp_len, 4);
+    if (nread == 0)
+      return false;
+    assert(nread > 0);
+    if (nread < 4)
+      read_fully((char *)&comp_len + nread, 4 - nread);
+    assert((size_t)comp_len <= codec->max_compressed_size(block_size));
     
-  read_fully(comp, 4 + comp_len);
+    read_fully(comp, 4 + comp_len);
+  }
   int decomp_len = *(int32_t *)comp;
+  assert(decomp_len <= block_size);
 
-#ifndef NDEBUG
-  int comp_len2 =
-#endif
-    LZ4_decompress_fast(comp + 4, buf, decomp_len);
-  assert(comp_len2 == comp_len);
+  {
+    TraceSpan decompress_span("decompress");
+    ProfileStage stage(Profiler::DECOMPRESS);
+    codec->decompress(comp + 4, comp_len, buf, decomp_len);
+  }
     
   off = 0;
   end = decomp_len;
+  return true;
 }
 
 } // namespace hail
@@ -3,26 +3,104 @@
 
 #pragma once
 
+#include <memory>
+#include <type_traits>
+
 #include "util.hh"
 #include "region.hh"
+#include "codec.hh"
+#include "blockcache.hh"
+#include "pages.hh"
 
 namespace hail {
 
-class LZ4InputBuffer {
+// Varints are at most 5 bytes for Int32 and 10 for Int64.
+template<typename T> constexpr size_t max_varint_size() { return (8 * sizeof(T) + 6) / 7; }
+
+// Decode a varint at p, advancing p, without bounds checks: the caller
+// has checked that max_varint_size<T>() bytes at p are readable.
+template<typename T> inline T
+read_varint(const char *&p) {
+  using U = typename std::make_unsigned<T>::type;
+  int8_t b = *p++;
+  U x = b & 0x7f;
+  for (unsigned shift = 7; (b & 0x80) != 0 && shift < 8 * sizeof(T); shift += 7) {
+    b = *p++;
+    x |= (U)(b & 0x7f) << shift;
+  }
+  return (T)x;
+}
+
+template<typename T> inline void
+skip_varint(const char *&p) {
+  for (unsigned shift = 0; (*p++ & 0x80) != 0 && shift + 7 < 8 * sizeof(T); shift += 7)
+    ;
+}
+
+// The contents of a file held in memory from allocate_pages.
+class FileContents {
+  size_t capacity;
+  PageKind kind;
+  
+public:
+  const char *data;
+  size_t size;
+  
+  // throws std::runtime_error if filename can't be read
+  FileContents(const std::string &filename);
+  FileContents(const FileContents &) = delete;
+  ~FileContents();
+  
+  FileContents &operator=(const FileContents &) = delete;
+};
+
+class BlockInputBuffer {
   // private:
 public:
   static const int block_size = 128 * 1024;
   
+  const BlockCodec *codec;
+  
   int fd;
+  // the current block: own_buf, or a block shared with the cache
   char *buf;
   // FIXME don't store offsets store pointers
   size_t off;
   size_t end;
   
+  // own_buf and comp are one allocation
+  char *own_buf;
   char *comp;
+  size_t buffers_size;
+  PageKind buffers_kind;
+  
+  void allocate_buffers();
+  
+  // set if the block cache was enabled when fd was opened; blocks are
+  // then read with pread at file_key.offset
+  BlockCache *cache;
+  BlockCache::Key file_key;
+  std::shared_ptr<const CachedBlock> block;
+  
+  // set to read blocks from memory instead of fd
+  std::shared_ptr<const FileContents> contents;
+  size_t contents_off;
   
   void read_fully(void *dst0, size_t n);
+  size_t pread_fully(void *dst0, size_t n, uint64_t offset);
   void read_block();
+  int32_t read_int_slow();
+  int64_t read_long_slow();
+  void skip_varint_slow();
+  void use_cache();
+  bool next_cached_block();
+  bool next_memory_block();
+  
+public:
+  // reads the next block into buf; returns false at end of file
+  bool next_block();
+  
+  // private:
   
   void ensure(size_t n) {
     if (UNLIKELY(off == end))
@@ -31,11 +109,13 @@ public:
   }
   
 public:
-  LZ4InputBuffer();
-  LZ4InputBuffer(int fd_);
-  ~LZ4InputBuffer();
+  BlockInputBuffer(const BlockCodec *codec = BlockCodec::lz4());
+  BlockInputBuffer(const BlockCodec *codec, int fd_);
+  ~BlockInputBuffer();
   
-  LZ4InputBuffer &operator=(int fd_);
+  BlockInputBuffer &operator=(int fd_);
+  // read the blocks of a file loaded into memory
+  BlockInputBuffer &operator=(std::shared_ptr<const FileContents> contents_);
   
   int8_t read_byte_() {
     assert(off < end);
@@ -67,31 +147,23 @@ public:
     return d;
   }
   
+  // Varints are read without checks when the current block has room
+  // for the longest one, and a byte at a time near the end of a block.
   int32_t read_int() {
-    ensure(1);
-    
-    int8_t b = read_byte_();
-    int32_t x = b & 0x7f;
-    int shift = 7;
-    while ((b & 0x80) != 0) {
-      b = read_byte_();
-      x |= ((b & 0x7f) << shift);
-      shift += 7;
-    }
+    if (UNLIKELY(end - off < max_varint_size<int32_t>()))
+      return read_int_slow();
+    const char *p = buf + off;
+    int32_t x = read_varint<int32_t>(p);
+    off = p - buf;
     return x;
   }
 
   int64_t read_long() {
-    ensure(1);
-    
-    int8_t b = read_byte_();
-    int64_t x = b & 0x7f;
-    int shift = 7;
-    while ((b & 0x80) != 0) {
-      b = read_byte_();
-      x |= ((b & 0x7f) << shift);
-      shift += 7;
-    }
+    if (UNLIKELY(end - off < max_varint_size<int64_t>()))
+      return read_long_slow();
+    const char *p = buf + off;
+    int64_t x = read_varint<int64_t>(p);
+    off = p - buf;
     return x;
   }
   
@@ -108,6 +180,55 @@ public:
       off += p;
     }
   }
+  
+  void read_bytes(char *dst, size_t n) {
+    while (n > 0) {
+      if (end == off)
+	read_block();
+      size_t p = std::min(end - off, n);
+      memcpy(dst, buf + off, p);
+      dst += p;
+      n -= p;
+      off += p;
+    }
+  }
+  
+  void skip_bytes(size_t n) {
+    while (n > 0) {
+      if (end == off)
+	read_block();
+      size_t p = std::min(end - off, n);
+      n -= p;
+      off += p;
+    }
+  }
+  
+  // The unread bytes of the current block, reading the next block
+  // first if this one is used up.  Values are written so that none
+  // straddles two blocks, but a struct can.
+  size_t available() {
+    if (end == off)
+      read_block();
+    return end - off;
+  }
+  
+  const char *peek() const { return buf + off; }
+  
+  void consume(size_t n) {
+    assert(off + n <= end);
+    off += n;
+  }
+  
+  // skips an encoded Int32 or Int64
+  void skip_varint() {
+    if (UNLIKELY(end - off < max_varint_size<int64_t>())) {
+      skip_varint_slow();
+      return;
+    }
+    const char *p = buf + off;
+    hail::skip_varint<int64_t>(p);
+    off = p - buf;
+  }
 };
 
 } // namespace hail
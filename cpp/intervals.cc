@@ -0,0 +1,130 @@
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "gzstream.h"
+#include "intervals.hh"
+
+namespace hail {
+
+IntervalIndex::IntervalIndex(const std::vector<Interval> &intervals)
+  : n_intervals(0) {
+  std::vector<std::vector<std::pair<int32_t, int32_t>>> by_contig;
+  for (const auto &iv : intervals) {
+    if (iv.start > iv.end)
+      continue;
+    auto p = contig_ids.emplace(iv.contig, by_contig.size());
+    if (p.second)
+      by_contig.emplace_back();
+    by_contig[p.first->second].emplace_back(iv.start, iv.end);
+    ++n_intervals;
+  }
+  
+  contigs.resize(by_contig.size());
+  for (uint64_t i = 0; i < by_contig.size(); ++i) {
+    auto &ivs = by_contig[i];
+    std::sort(ivs.begin(), ivs.end());
+    ContigIntervals &ci = contigs[i];
+    ci.starts.reserve(ivs.size());
+    ci.max_ends.reserve(ivs.size());
+    int32_t max_end = std::numeric_limits<int32_t>::min();
+    for (const auto &iv : ivs) {
+      max_end = std::max(max_end, iv.second);
+      ci.starts.push_back(iv.first);
+      ci.max_ends.push_back(max_end);
+    }
+  }
+}
+
+std::shared_ptr<const IntervalIndex>
+IntervalIndex::read_bed(const std::string &filename) {
+  igzstream is(filename.c_str());
+  if (!is.rdbuf()->is_open() || is.fail())
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+  
+  std::vector<Interval> intervals;
+  std::string line;
+  uint64_t line_number = 0;
+  while (std::getline(is, line)) {
+    ++line_number;
+    if (line.empty()
+	|| line[0] == '#'
+	|| line.compare(0, 5, "track") == 0
+	|| line.compare(0, 7, "browser") == 0)
+      continue;
+    
+    std::istringstream fields(line);
+    std::string contig;
+    int64_t start, end;
+    if (!(fields >> contig >> start >> end)
+	|| start < 0
+	|| end < start
+	|| end > std::numeric_limits<int32_t>::max())
+      throw std::runtime_error(fmt::format("{}:{}: malformed BED line", filename, line_number));
+    // [start, end) 0-based is [start + 1, end] 1-based
+    intervals.push_back(Interval { contig, (int32_t)(start + 1), (int32_t)end });
+  }
+  if (is.bad())
+    throw std::runtime_error(fmt::format("error reading file: {}", filename));
+  
+  return std::make_shared<const IntervalIndex>(intervals);
+}
+
+uint64_t
+IntervalIndex::n_starting(int64_t id, int32_t pos) const {
+  const auto &starts = contigs[id].starts;
+  return std::upper_bound(starts.begin(), starts.end(), pos) - starts.begin();
+}
+
+IntervalCursor::IntervalCursor(std::shared_ptr<const IntervalIndex> index)
+  : index(std::move(index)), id(-1), pos(0), n_starting(0) {}
+
+void
+IntervalCursor::seek_contig(const char *s, uint32_t n) {
+  contig.assign(s, n);
+  id = index->contig_id(contig);
+  pos = 0;
+  n_starting = 0;
+}
+
+bool
+IntervalCursor::contains(const char *s, uint32_t n, int32_t new_pos) {
+  if (n != contig.size() || memcmp(s, contig.data(), n) != 0)
+    seek_contig(s, n);
+  if (id < 0)
+    return false;
+  
+  if (new_pos < pos)
+    n_starting = index->n_starting(id, new_pos);
+  else {
+    uint64_t m = index->n_contig_intervals(id);
+    while (n_starting < m && index->start(id, n_starting) <= new_pos)
+      ++n_starting;
+  }
+  pos = new_pos;
+  return index->covered(id, n_starting, pos);
+}
+
+RowPredicate
+interval_filter(std::shared_ptr<const IntervalIndex> index) {
+  // copied with the predicate, so each iterator walks its own cursor
+  IntervalCursor cursor(std::move(index));
+  return [cursor](TypedRegionValue row) mutable {
+    if (row.is_field_missing(0))
+      return false;
+    // pk is a Locus: Struct { contig: !String, pos: !Int32 }
+    TypedRegionValue pk = row.load_field(0);
+    const Region *region = pk.get_region();
+    offset_t soff = region->load_offset(pk.load_field(0).get_offset());
+    uint32_t n = region->load_int(soff);
+    return cursor.contains((const char *)(region->mem + soff + 4), n,
+			   pk.load_field(1).load_int());
+  };
+}
+
+} // namespace hail
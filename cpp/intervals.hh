@@ -0,0 +1,102 @@
+#ifndef HAIL_INTERVALS_HH
+#define HAIL_INTERVALS_HH
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "matrixtable.hh"
+
+namespace hail {
+
+// A set of intervals of loci, indexed for point queries.  Per contig,
+// the intervals are sorted by start alongside the running maximum of
+// their ends, so pos is covered iff the last interval starting at or
+// before pos has a running maximum end at or after it: one binary
+// search over a contiguous array, however the intervals overlap.
+class IntervalIndex {
+  class ContigIntervals {
+  public:
+    std::vector<int32_t> starts;
+    std::vector<int32_t> max_ends;
+  };
+  
+  std::unordered_map<std::string, uint64_t> contig_ids;
+  std::vector<ContigIntervals> contigs;
+  
+public:
+  // 1-based loci, start and end inclusive
+  class Interval {
+  public:
+    std::string contig;
+    int32_t start;
+    int32_t end;
+  };
+  
+  uint64_t n_intervals;
+  
+  // empty intervals are dropped
+  IntervalIndex(const std::vector<Interval> &intervals);
+  
+  // Reads the first three columns of a BED file, possibly gzipped.
+  // BED intervals are 0-based and half-open.  Header, track and browser
+  // lines are skipped; throws std::runtime_error on other malformed
+  // lines.
+  static std::shared_ptr<const IntervalIndex> read_bed(const std::string &filename);
+  
+  // id of contig, or -1 if no interval is on it
+  int64_t contig_id(const std::string &contig) const {
+    auto i = contig_ids.find(contig);
+    return i == contig_ids.end() ? -1 : i->second;
+  }
+  
+  // the number of intervals on contig id starting at or before pos
+  uint64_t n_starting(int64_t id, int32_t pos) const;
+  
+  // whether pos is covered given the number of intervals on contig id
+  // starting at or before pos
+  bool covered(int64_t id, uint64_t n_starting, int32_t pos) const {
+    return n_starting > 0 && contigs[id].max_ends[n_starting - 1] >= pos;
+  }
+  
+  bool contains(int64_t id, int32_t pos) const {
+    return id >= 0 && covered(id, n_starting(id, pos), pos);
+  }
+  bool contains(const std::string &contig, int32_t pos) const {
+    return contains(contig_id(contig), pos);
+  }
+  
+  uint64_t n_contig_intervals(int64_t id) const { return contigs[id].starts.size(); }
+  int32_t start(int64_t id, uint64_t i) const { return contigs[id].starts[i]; }
+};
+
+// Point queries against an IntervalIndex for loci in sorted order:
+// the position in the index only moves forward, so a scan of sorted
+// rows costs amortized constant time per row.  Loci out of order fall
+// back to a binary search.
+class IntervalCursor {
+  std::shared_ptr<const IntervalIndex> index;
+  std::string contig;
+  int64_t id;
+  int32_t pos;
+  uint64_t n_starting;
+  
+  void seek_contig(const char *s, uint32_t n);
+  
+public:
+  IntervalCursor(std::shared_ptr<const IntervalIndex> index);
+  
+  bool contains(const char *contig, uint32_t contig_size, int32_t pos);
+  bool contains(const std::string &contig, int32_t pos) {
+    return contains(contig.data(), contig.size(), pos);
+  }
+};
+
+// rows whose pk is covered by an interval of index
+extern RowPredicate interval_filter(std::shared_ptr<const IntervalIndex> index);
+
+} // namespace hail
+
+#endif // HAIL_INTERVALS_HH
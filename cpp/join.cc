@@ -0,0 +1,286 @@
+
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include "casting.hh"
+#include "join.hh"
+
+namespace hail {
+
+namespace {
+
+const TStruct *
+variant_row_type(const TMatrixTable *t) {
+  if (!isa<TVariant>(t->row_key_type))
+    throw std::runtime_error(fmt::format("rows are not keyed by Variant: {}",
+					 t->row_key_type->to_string()));
+  return cast<TStruct>(t->row_impl_type->fundamental_type);
+}
+
+// the reference genome of both sides of a join
+const ReferenceGenome &
+join_genome(const TMatrixTable *left, const TMatrixTable *right) {
+  variant_row_type(left);
+  variant_row_type(right);
+  const std::string &gr = cast<TVariant>(left->row_key_type)->gr;
+  const std::string &right_gr = cast<TVariant>(right->row_key_type)->gr;
+  if (gr != right_gr)
+    throw std::runtime_error(fmt::format("join of datasets on different reference genomes: {} and {}",
+					 gr, right_gr));
+  return ReferenceGenome::get(gr);
+}
+
+// the first locus of each partition; an empty partition gets the
+// first locus of the next non-empty one, or none at the end
+class PartitionStarts {
+public:
+  const ReferenceGenome &genome;
+  std::vector<Locus> first;
+  // partitions [0, n_defined) have a first locus
+  uint64_t n_defined;
+
+  PartitionStarts(const std::shared_ptr<const MatrixTable> &mt, const ReferenceGenome &genome);
+
+  // number of partitions whose first locus is before locus (or at it,
+  // with or_equal); locus null is after every locus
+  uint64_t count_before(const Locus *locus, bool or_equal) const;
+};
+
+PartitionStarts::PartitionStarts(const std::shared_ptr<const MatrixTable> &mt, const ReferenceGenome &genome)
+  : genome(genome), first(mt->n_partitions), n_defined(0) {
+  std::vector<bool> empty(mt->n_partitions);
+  for (uint64_t k = 0; k < mt->n_partitions; ++k) {
+    auto it = mt->iterator(PartitionRange { k, k + 1 });
+    empty[k] = !it->has_next();
+    if (!empty[k]) {
+      load_locus(it->next(), first[k]);
+      n_defined = k + 1;
+    }
+  }
+  for (uint64_t k = n_defined; k-- > 0; )
+    if (empty[k])
+      first[k] = first[k + 1];
+}
+
+uint64_t
+PartitionStarts::count_before(const Locus *locus, bool or_equal) const {
+  if (!locus)
+    return n_defined;
+  uint64_t n = 0;
+  while (n < n_defined) {
+    int c = compare_loci(genome, first[n], *locus);
+    if (c > 0 || (c == 0 && !or_equal))
+      break;
+    ++n;
+  }
+  return n;
+}
+
+} // namespace
+
+int
+compare_loci(const ReferenceGenome &genome, const Locus &a, const Locus &b) {
+  int c = genome.compare_contigs(a.contig, b.contig);
+  if (c != 0)
+    return c;
+  return (a.pos > b.pos) - (a.pos < b.pos);
+}
+
+void
+load_locus(TypedRegionValue row, Locus &locus) {
+  if (row.is_field_missing(0))
+    throw std::runtime_error("missing locus");
+  TypedRegionValue pk = row.load_field(0);
+  TypedRegionValue contig = pk.load_field(0);
+  const Region *region = contig.get_region();
+  offset_t soff = region->load_offset(contig.get_offset());
+  locus.contig.assign(region->mem + soff + 4, (uint32_t)region->load_int(soff));
+  locus.pos = pk.load_field(1).load_int();
+}
+
+JoinIterator::JoinIterator(const std::shared_ptr<const MatrixTable> &left_mt, PartitionRange left_parts,
+			   const std::shared_ptr<const MatrixTable> &right_mt, PartitionRange right_parts,
+			   JoinType how)
+  : left(left_mt->iterator(left_parts)),
+    right(right_mt->iterator(right_parts)),
+    how(how),
+    genome(join_genome(left_mt->type, right_mt->type)),
+    left_type(variant_row_type(left_mt->type)),
+    right_type(variant_row_type(right_mt->type)),
+    right_row_type(right_mt->type->row_impl_type),
+    v_ops(left_mt->type->row_key_type),
+    right_relocator(right_mt->type->row_impl_type),
+    right_pending(false),
+    group_defined(false),
+    left_pending(false),
+    next_match(0) {
+  if (left_mt->type->row_key_type->fundamental_type != right_mt->type->row_key_type->fundamental_type)
+    throw std::runtime_error(fmt::format("join keys differ: {} and {}",
+					 left_mt->type->row_key_type->to_string(),
+					 right_mt->type->row_key_type->to_string()));
+  advance_right();
+}
+
+void
+JoinIterator::advance_right() {
+  bool had_row = right_pending;
+  right_pending = right->has_next();
+  if (!right_pending)
+    return;
+  right_row = right->next();
+  if (!had_row) {
+    load_locus(right_row, right_locus);
+    return;
+  }
+  std::swap(right_locus, scratch_locus);
+  load_locus(right_row, right_locus);
+  if (compare_loci(genome, right_locus, scratch_locus) < 0)
+    throw std::runtime_error("right rows are not sorted by locus");
+}
+
+// buffer the right rows at left_locus, if not already
+void
+JoinIterator::fill_group() {
+  if (group_defined) {
+    int c = compare_loci(genome, group_locus, left_locus);
+    if (c == 0)
+      return;
+    if (c > 0)
+      throw std::runtime_error("left rows are not sorted by locus");
+  }
+
+  group_region.clear();
+  group.clear();
+  group_locus = left_locus;
+  group_defined = true;
+  while (right_pending && compare_loci(genome, right_locus, left_locus) < 0)
+    advance_right();
+  while (right_pending && compare_loci(genome, right_locus, left_locus) == 0) {
+    group.push_back(right_relocator.relocate(*right_row.get_region(), right_row.get_offset(), group_region));
+    advance_right();
+  }
+}
+
+uint64_t
+JoinIterator::n_outputs() const {
+  if (how == JoinType::LEFT && matches.empty())
+    return 1;
+  return matches.size();
+}
+
+bool
+JoinIterator::has_next() {
+  while (!left_pending || next_match >= n_outputs()) {
+    if (!left->has_next()) {
+      left_pending = false;
+      return false;
+    }
+    left_row = left->next();
+    left_pending = true;
+    load_locus(left_row, left_locus);
+    fill_group();
+
+    matches.clear();
+    next_match = 0;
+    const Region &lr = *left_row.get_region();
+    offset_t loff = left_row.get_offset();
+    if (lr.is_field_missing(left_type, loff, 1))
+      continue;
+    for (offset_t roff : group) {
+      if (group_region.is_field_defined(right_type, roff, 1)
+	  && v_ops.equal(lr, loff + left_type->field_offset[1],
+			 group_region, roff + right_type->field_offset[1]))
+	matches.push_back(roff);
+    }
+  }
+  return true;
+}
+
+JoinedRow
+JoinIterator::next() {
+  bool ok = has_next();
+  assert(ok);
+  (void)ok;
+
+  JoinedRow r;
+  r.left = left_row;
+  r.right_defined = !matches.empty();
+  if (r.right_defined)
+    r.right = TypedRegionValue(&group_region, matches[next_match], right_row_type);
+  ++next_match;
+  return r;
+}
+
+std::vector<std::pair<PartitionRange, PartitionRange>>
+co_partition(const std::shared_ptr<const MatrixTable> &left,
+	     const std::shared_ptr<const MatrixTable> &right) {
+  const ReferenceGenome &genome = join_genome(left->type, right->type);
+  PartitionStarts left_starts(left, genome), right_starts(right, genome);
+
+  std::vector<std::pair<PartitionRange, PartitionRange>> shards;
+  for (uint64_t k = 0; k < left->n_partitions; ++k) {
+    // partition k's rows are in [start, end]; end is also the first
+    // locus of the next partition
+    const Locus *start = k < left_starts.n_defined ? &left_starts.first[k] : nullptr;
+    const Locus *end = k + 1 < left_starts.n_defined ? &left_starts.first[k + 1] : nullptr;
+    // the last right partition starting before start can hold rows at
+    // start; partitions starting after end hold nothing needed
+    uint64_t begin = right_starts.count_before(start, false);
+    if (begin > 0)
+      --begin;
+    uint64_t right_end = end ? right_starts.count_before(end, true) : right->n_partitions;
+    right_end = std::max(begin, right_end);
+    shards.emplace_back(PartitionRange { k, k + 1 }, PartitionRange { begin, right_end });
+  }
+  return shards;
+}
+
+void
+parallel_join(const std::shared_ptr<const MatrixTable> &left,
+	      const std::shared_ptr<const MatrixTable> &right,
+	      JoinType how, unsigned n_threads,
+	      const std::function<void(uint64_t shard, JoinIterator &join)> &f) {
+  auto shards = co_partition(left, right);
+  uint64_t n_shards = shards.size();
+  if (n_shards == 0)
+    return;
+
+  if (n_threads == 0)
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  n_threads = std::min<uint64_t>(n_threads, n_shards);
+
+  std::atomic<uint64_t> next_shard(0);
+  std::vector<std::exception_ptr> errors(n_threads);
+  auto work = [&](unsigned t) {
+    try {
+      for (;;) {
+	uint64_t k = next_shard++;
+	if (k >= n_shards)
+	  break;
+	JoinIterator join(left, shards[k].first, right, shards[k].second, how);
+	f(k, join);
+      }
+    } catch (...) {
+      errors[t] = std::current_exception();
+      // stop the other workers
+      next_shard = n_shards;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < n_threads; ++t)
+    threads.emplace_back(work, t);
+  work(0);
+  for (auto &t : threads)
+    t.join();
+  for (auto &e : errors)
+    if (e)
+      std::rethrow_exception(e);
+}
+
+} // namespace hail
@@ -0,0 +1,114 @@
+#ifndef HAIL_JOIN_HH
+#define HAIL_JOIN_HH
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "genome.hh"
+#include "matrixtable.hh"
+#include "relocate.hh"
+#include "valueops.hh"
+
+namespace hail {
+
+class Locus {
+public:
+  std::string contig;
+  int32_t pos;
+};
+
+// by contig in the order of the reference genome, then by pos
+extern int compare_loci(const ReferenceGenome &genome, const Locus &a, const Locus &b);
+
+// the pk of a row of a Variant-keyed MatrixTable; throws
+// std::runtime_error if it is missing
+extern void load_locus(TypedRegionValue row, Locus &locus);
+
+enum class JoinType {
+  INNER,
+  LEFT,
+};
+
+class JoinedRow {
+public:
+  TypedRegionValue left;
+  // false for a left row with no match in a left join
+  bool right_defined;
+  TypedRegionValue right;
+};
+
+// Merge join of two MatrixTables keyed by Variant and sorted by locus,
+// matching rows with equal v.  Emits a row per matching pair, in left
+// row order; with JoinType::LEFT, also left rows with no match.  Only
+// the right rows at the current locus are buffered, relocated out of
+// the right iterator's region.  Loci order by the contigs of the
+// datasets' reference genome; throws std::runtime_error if the
+// datasets are on different references.
+class JoinIterator {
+  std::shared_ptr<MatrixTableIterator> left;
+  std::shared_ptr<MatrixTableIterator> right;
+  JoinType how;
+  const ReferenceGenome &genome;
+  // fundamental row types; v is field 1
+  const TStruct *left_type;
+  const TStruct *right_type;
+  const Type *right_row_type;
+  ValueOps v_ops;
+  Relocator right_relocator;
+
+  // the next right row not yet buffered
+  bool right_pending;
+  TypedRegionValue right_row;
+  Locus right_locus;
+  Locus scratch_locus;
+
+  // right rows at group_locus
+  bool group_defined;
+  Locus group_locus;
+  Region group_region;
+  std::vector<offset_t> group;
+
+  // the current left row and its matches in group
+  bool left_pending;
+  TypedRegionValue left_row;
+  Locus left_locus;
+  std::vector<offset_t> matches;
+  uint64_t next_match;
+
+  void advance_right();
+  void fill_group();
+  // rows to emit for the current left row
+  uint64_t n_outputs() const;
+
+public:
+  JoinIterator(const std::shared_ptr<const MatrixTable> &left_mt, PartitionRange left_parts,
+	       const std::shared_ptr<const MatrixTable> &right_mt, PartitionRange right_parts,
+	       JoinType how);
+
+  bool has_next();
+
+  // valid until the next call to has_next() or next()
+  JoinedRow next();
+};
+
+// Splits the join of left and right into one shard per left partition,
+// each with the right partitions that may hold rows at its loci.
+// Reads the first row of each partition.
+extern std::vector<std::pair<PartitionRange, PartitionRange>> co_partition(const std::shared_ptr<const MatrixTable> &left,
+									   const std::shared_ptr<const MatrixTable> &right);
+
+// Runs f(shard, join) for each shard of co_partition(left, right) on a
+// pool of n_threads workers (0 for one per core).  f is called
+// concurrently for different shards.  Rethrows the first exception
+// thrown by a worker.
+extern void parallel_join(const std::shared_ptr<const MatrixTable> &left,
+			  const std::shared_ptr<const MatrixTable> &right,
+			  JoinType how, unsigned n_threads,
+			  const std::function<void(uint64_t shard, JoinIterator &join)> &f);
+
+} // namespace hail
+
+#endif // HAIL_JOIN_HH
@@ -0,0 +1,173 @@
+
+#include <cmath>
+#include <deque>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "blockmatrix.hh"
+#include "casting.hh"
+#include "join.hh"
+#include "ld.hh"
+
+namespace hail {
+
+namespace {
+
+const uint64_t low_bits = 0x5555555555555555ULL;
+
+inline uint64_t
+popcount(uint64_t x) {
+  return __builtin_popcountll(x);
+}
+
+// r^2 from sums over the samples defined in x (n_x, sx, sxx), in y,
+// and over the samples defined in both (n, sx_y: sum of x where y is
+// defined, sy_x, sxy)
+double
+r2_from_sums(double n_x, double sx, double sxx,
+	     double n_y, double sy, double syy,
+	     double n, double sx_y, double sy_x, double sxy) {
+  if (n_x == 0 || n_y == 0)
+    return NAN;
+  double mx = sx / n_x, my = sy / n_y;
+  double vx = sxx - sx * mx, vy = syy - sy * my;
+  if (vx <= 0 || vy <= 0)
+    return NAN;
+  // imputed values contribute nothing
+  double cov = sxy - mx * sy_x - my * sx_y + n * mx * my;
+  return cov * cov / (vx * vy);
+}
+
+class WindowRow {
+public:
+  uint64_t index;
+  Locus locus;
+  // packed calls are retained; other rows keep their dosages
+  RetainedRow row;
+  std::vector<double> dosages;
+};
+
+} // namespace
+
+double
+ld_r2(const PackedCalls &x, const PackedCalls &y) {
+  assert(x.n == y.n);
+  const uint64_t *xw = x.words(), *yw = y.words();
+  uint64_t nw = PackedCalls::n_words(x.n);
+  // per-sample counts, with het and hom-var counted separately
+  uint64_t n_x = 0, x1 = 0, x2 = 0, n_y = 0, y1 = 0, y2 = 0;
+  uint64_t n = 0, x1_y = 0, x2_y = 0, y1_x = 0, y2_x = 0;
+  uint64_t x1y1 = 0, x1y2 = 0, x2y1 = 0, x2y2 = 0;
+  for (uint64_t k = 0; k < nw; ++k) {
+    // low bits of the samples in this word
+    uint64_t valid = (k + 1 < nw || (x.n & 31) == 0)
+      ? low_bits
+      : low_bits & ((1ULL << (2 * (x.n & 31))) - 1);
+    uint64_t xl = xw[k] & low_bits, xh = (xw[k] >> 1) & low_bits;
+    uint64_t yl = yw[k] & low_bits, yh = (yw[k] >> 1) & low_bits;
+    uint64_t dx = valid & ~(xl & xh), dy = valid & ~(yl & yh);
+    uint64_t xhet = xl & ~xh, xhv = xh & ~xl;
+    uint64_t yhet = yl & ~yh, yhv = yh & ~yl;
+
+    n_x += popcount(dx);
+    x1 += popcount(xhet);
+    x2 += popcount(xhv);
+    n_y += popcount(dy);
+    y1 += popcount(yhet);
+    y2 += popcount(yhv);
+    n += popcount(dx & dy);
+    x1_y += popcount(xhet & dy);
+    x2_y += popcount(xhv & dy);
+    y1_x += popcount(yhet & dx);
+    y2_x += popcount(yhv & dx);
+    x1y1 += popcount(xhet & yhet);
+    x1y2 += popcount(xhet & yhv);
+    x2y1 += popcount(xhv & yhet);
+    x2y2 += popcount(xhv & yhv);
+  }
+  return r2_from_sums(n_x, x1 + 2 * x2, x1 + 4 * x2,
+		      n_y, y1 + 2 * y2, y1 + 4 * y2,
+		      n, x1_y + 2 * x2_y, y1_x + 2 * y2_x,
+		      x1y1 + 2 * (x1y2 + x2y1) + 4 * x2y2);
+}
+
+double
+ld_r2(const double *x, const double *y, uint64_t n) {
+  double n_x = 0, sx = 0, sxx = 0, n_y = 0, sy = 0, syy = 0;
+  double n_xy = 0, sx_y = 0, sy_x = 0, sxy = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    bool dx = x[i] == x[i], dy = y[i] == y[i];
+    double xi = dx ? x[i] : 0, yi = dy ? y[i] : 0;
+    n_x += dx;
+    sx += xi;
+    sxx += xi * xi;
+    n_y += dy;
+    sy += yi;
+    syy += yi * yi;
+    n_xy += dx & dy;
+    sx_y += dy ? xi : 0;
+    sy_x += dx ? yi : 0;
+    sxy += xi * yi;
+  }
+  return r2_from_sums(n_x, sx, sxx, n_y, sy, syy, n_xy, sx_y, sy_x, sxy);
+}
+
+std::vector<LDPair>
+windowed_ld(Context &c, const std::shared_ptr<const MatrixTable> &mt,
+	    const std::string &field, uint64_t window_bp, double min_r2) {
+  if (!isa<TVariant>(mt->type->row_key_type))
+    throw std::runtime_error(fmt::format("rows are not keyed by Variant: {}",
+					 mt->type->row_key_type->to_string()));
+
+  // mean-imputed dosages give the same r2 as leaving them missing
+  DosageRows rows(c, mt, mt->all_partitions(), field, false);
+  uint64_t n = rows.n_cols;
+  std::vector<double> x(n), y(n);
+  std::deque<WindowRow> window;
+  std::vector<LDPair> pairs;
+  for (uint64_t j = 0; rows.advance(); ++j) {
+    WindowRow w;
+    w.index = j;
+    load_locus(rows.row(), w.locus);
+    if (rows.calls_packed())
+      w.row = rows.retain();
+    else {
+      w.dosages.resize(n);
+      rows.fill(w.dosages.data());
+    }
+
+    while (!window.empty()
+	   && (window.front().locus.contig != w.locus.contig
+	       || (uint64_t)(w.locus.pos - window.front().locus.pos) > window_bp))
+      window.pop_front();
+
+    // w as dosages, for pairs with rows whose calls are not packed
+    const double *wd = w.dosages.data();
+    bool w_converted = false;
+    for (const WindowRow &u : window) {
+      double r2;
+      if (u.row.calls_packed && w.row.calls_packed)
+	r2 = ld_r2(u.row.packed_calls, w.row.packed_calls);
+      else {
+	const double *ud = u.dosages.data();
+	if (u.row.calls_packed) {
+	  u.row.packed_calls.to_dosages(x.data(), NAN);
+	  ud = x.data();
+	}
+	if (w.row.calls_packed && !w_converted) {
+	  w.row.packed_calls.to_dosages(y.data(), NAN);
+	  wd = y.data();
+	  w_converted = true;
+	}
+	r2 = ld_r2(ud, wd, n);
+      }
+      if (r2 >= min_r2)
+	pairs.push_back(LDPair { u.index, j, r2 });
+    }
+    window.push_back(std::move(w));
+  }
+  return pairs;
+}
+
+} // namespace hail
@@ -0,0 +1,38 @@
+#ifndef HAIL_LD_HH
+#define HAIL_LD_HH
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "matrixtable.hh"
+#include "packedcalls.hh"
+
+namespace hail {
+
+// Squared correlation of two variants' alternate allele counts, with
+// the missing values of each mean-imputed.  NaN if either is constant.
+extern double ld_r2(const PackedCalls &x, const PackedCalls &y);
+// missing values are NaN
+extern double ld_r2(const double *x, const double *y, uint64_t n);
+
+class LDPair {
+public:
+  // row indices, i < j, in iteration order
+  uint64_t i;
+  uint64_t j;
+  double r2;
+};
+
+// r2 of each pair of rows on the same contig at most window_bp apart,
+// for the pairs with r2 at least min_r2.  The field is GT, giving the
+// number of alternate alleles, or numeric, such as a dosage; see
+// DosageRows.  Biallelic GT rows are kept in the window as retained
+// packed calls and compared by popcount.  Rows must be keyed by
+// Variant and sorted.
+extern std::vector<LDPair> windowed_ld(Context &c, const std::shared_ptr<const MatrixTable> &mt,
+				       const std::string &field, uint64_t window_bp, double min_r2);
+
+} // namespace hail
+
+#endif // HAIL_LD_HH
@@ -1,22 +1,85 @@
 
+#include <cstdio>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include <fmt/format.h>
 
 #include "type.hh"
 #include "context.hh"
 #include "matrixtable.hh"
+#include "perfcounters.hh"
+#include "shard.hh"
+#include "trace.hh"
 
 int
-main(int argc, char **argv) {
+run(int argc, char **argv) {
   hail::Context c;
   
   std::string vds = "/home/cotton/sample.vds";
   //  std::string vds = "/home/cotton/gnomad.vds";
   
+  bool perf = false;
+  uint64_t shard_i = 0, shard_n = 0;
+  std::string out;
+  std::vector<std::string> merge;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--trace" && i + 1 < argc)
+      hail::Tracer::start(argv[++i]);
+    else if (arg == "--perf")
+      perf = true;
+    else if (arg == "--shard" && i + 1 < argc
+	     && sscanf(argv[i + 1], "%lu/%lu", &shard_i, &shard_n) == 2)
+      ++i;
+    else if (arg == "--out" && i + 1 < argc)
+      out = argv[++i];
+    else if (arg == "--merge") {
+      merge.assign(argv + i + 1, argv + argc);
+      break;
+    } else if (arg.size() > 0 && arg[0] == '-') {
+      std::cerr << fmt::format("usage: {} [--trace trace.json] [--perf] [--shard i/n [--out partial]] [vds]\n", argv[0]);
+      std::cerr << fmt::format("       {} --merge partial...", argv[0]) << "\n";
+      return 1;
+    } else
+      vds = arg;
+  }
+  
+  if (!merge.empty()) {
+    std::vector<hail::ShardResult> shards;
+    for (const auto &f : merge)
+      shards.push_back(hail::ShardResult::read(f));
+    auto r = hail::ShardResult::merge(std::move(shards));
+    std::cout << fmt::format("read {} rows ", r.n_rows) << "\n";
+    return 0;
+  }
+  
+  if (perf)
+    hail::Profiler::start();
+  
   auto mt = std::make_shared<hail::MatrixTable>(c, vds);
-  std::cout << fmt::format("read {} rows ", mt->count_rows()) << "\n";
+  if (shard_n > 0) {
+    auto r = hail::ShardResult::scan(mt, shard_i, shard_n);
+    if (!out.empty())
+      r.write(out);
+    std::cout << fmt::format("read {} rows from partitions [{}, {})",
+			     r.n_rows, r.parts.begin, r.parts.end) << "\n";
+  } else
+    std::cout << fmt::format("read {} rows ", mt->count_rows()) << "\n";
+  
+  if (perf)
+    hail::Profiler::report(std::cout);
   
   return 0;
 }
+
+int
+main(int argc, char **argv) {
+  try {
+    return run(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << "error: " << e.what() << "\n";
+    return 1;
+  }
+}
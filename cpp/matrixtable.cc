@@ -1,127 +1,454 @@
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
 #include <fmt/format.h>
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
 
 #include "gzstream.h"
 
 #include "context.hh"
+#include "decode.hh"
 #include "matrixtable.hh"
+#include "outputbuffer.hh"
+#include "perfcounters.hh"
+#include "trace.hh"
 
 namespace hail {
 
-// FIXME move to ... region?
-void
-decode(LZ4InputBuffer &in, Region &region, uint64_t off, const Type *t) {
-  switch (t->kind) {
-  case BaseType::Kind::BOOLEAN:
-    region.store_bool(off, in.read_bool());
-    break;
-  case BaseType::Kind::INT32:
-    region.store_int(off, in.read_int());
-    break;
-  case BaseType::Kind::INT64:
-    region.store_long(off, in.read_long());
-    break;
-  case BaseType::Kind::FLOAT32:
-    region.store_float(off, in.read_float());
-    break;
-  case BaseType::Kind::FLOAT64:
-    region.store_double(off, in.read_double());
-    break;
-  case BaseType::Kind::STRING:
-    {
-      uint32_t n = in.read_int();
-      uint64_t soff = region.allocate(4, 4 + n);
-      region.store_int(soff, n);
-      in.read_bytes(region, soff + 4, n);
-      region.store_offset(off, soff);
-    }
-    break;
-  case BaseType::Kind::STRUCT:
-    {
-      const TStruct *ts = cast<TStruct>(t);
-      in.read_bytes(region, off, ts->missing_bits_size());
-      for (uint64_t i = 0; i < ts->fields.size(); ++i)
-	if (region.is_field_defined(ts, off, i))
-	  decode(in, region, off + ts->field_offset[i], ts->fields[i].type);
-    }
-    break;
-  case BaseType::Kind::ARRAY:
-    {
-      const TArray *ta = cast<TArray>(t);
-      uint32_t n = in.read_int();
-      uint64_t aoff = region.allocate(ta->content_alignment(),
-				      ta->content_size(n));
-      region.store_int(aoff, n);
-      uint64_t elements_off = aoff + ta->elements_offset(n);
-      uint64_t element_size = ta->element_size();
-      if (ta->element_type->kind  == BaseType::Kind::INT32
-	  && ta->element_type->required) {
-	for (uint64_t i = 0; i < n; ++i)
-	  region.store_int(elements_off + i*element_size, in.read_int());
-      } else {
-	in.read_bytes(region, aoff + 4, ta->missing_bits_size(n));
-	for (uint64_t i = 0; i < n; ++i)
-	  if (region.is_element_defined(ta, aoff, i))
-	    decode(in, region, elements_off + i*element_size, ta->element_type);
-      }
-      region.store_offset(off, aoff);
-    }
-    break;
-  default: abort();
-  }
+namespace {
+
+uint64_t
+field_index(const TStruct *ts, const std::string &name) {
+  for (uint64_t i = 0; i < ts->fields.size(); ++i)
+    if (ts->fields[i].name == name)
+      return i;
+  throw std::runtime_error(fmt::format("no field {} in {}", name, ts->to_string()));
 }
 
+} // namespace
+
 void
 MatrixTableIterator::start_part() {
-  int n_digits = std::to_string(mt->n_partitions).size();
+  part_begin = Tracer::enabled() ? Tracer::now() : 0;
+  TraceSpan span("start_part", "part", part);
   
-  auto part_s = std::to_string(part);
-  std::string pad(n_digits - part_s.size(), '0');
-  std::string part_filename = mt->filename + "/parts/part-" + pad + part_s;
+  cached.reset();
+  if (mt->row_cache && !pack && !sparse_decoder && !samples_selected) {
+    cached = mt->row_cache->open(mt->row_cache_key, part);
+    if (cached) {
+      cached_next = cached->begin();
+      return;
+    }
+    if (!filter && !lazy && !batching)
+      cache_writer = mt->row_cache->create(mt->row_cache_key, part);
+  }
+  
+  if (!mt->part_contents.empty()) {
+    in = mt->part_contents[part];
+    return;
+  }
   
-  int fd = open(part_filename.c_str(), O_RDONLY);
+  int fd = open(mt->part_filename(part).c_str(), O_RDONLY);
   assert(fd != -1);
   in = fd;
 }
 
+void
+MatrixTableIterator::end_batch() {
+  if (batch_rows > 0) {
+    if (Tracer::enabled())
+      Tracer::record("decode_batch", batch_begin, Tracer::now(), "rows", batch_rows);
+    batch_rows = 0;
+  }
+}
+
+void
+MatrixTableIterator::end_part() {
+  end_batch();
+  if (cache_writer) {
+    cache_writer->commit();
+    cache_writer.reset();
+  }
+  if (part_begin != 0 && Tracer::enabled())
+    Tracer::record("partition", part_begin, Tracer::now(), "part", part);
+}
+
 void
 MatrixTableIterator::advance() {
-  bool cont = in.read_byte();
-  while (!cont && part < mt->n_partitions) {
+  auto more = [this]() -> bool { return cached ? cached_next != cached->end() : in.read_byte(); };
+  bool cont = more();
+  while (!cont && part < part_end) {
+    end_part();
     ++part;
-    if (part < mt->n_partitions) {
+    if (part < part_end) {
       start_part();
-      cont = in.read_byte();
+      cont = more();
     }
   }
 }
 
 MatrixTableIterator::MatrixTableIterator(const std::shared_ptr<const MatrixTable> &mt)
+  : MatrixTableIterator(mt, mt->all_partitions()) {}
+
+MatrixTableIterator::MatrixTableIterator(const std::shared_ptr<const MatrixTable> &mt,
+					 PartitionRange parts)
   : mt(mt),
-    part(0) {
-  start_part();
-  advance();
+    region(std::make_shared<Region>()),
+    started(false),
+    part(parts.begin),
+    part_end(parts.end),
+    in(mt->codec),
+    cached_next(nullptr),
+    row_pending(false),
+    lazy(false),
+    entries_pending(false),
+    advance_pending(false),
+    pack(false),
+    row_packed(false),
+    row_sparse(false),
+    samples_selected(false),
+    batching(false),
+    part_begin(0),
+    batch_begin(0),
+    batch_rows(0) {
+  assert(parts.begin <= parts.end && parts.end <= mt->n_partitions);
+}
+
+// the first partition is opened once the iterator's options are set
+void
+MatrixTableIterator::start() {
+  started = true;
+  if (part < part_end) {
+    start_part();
+    advance();
+  }
+}
+
+void
+MatrixTableIterator::filter_rows(RowPredicate p) {
+  assert(!started);
+  filter = std::move(p);
+}
+
+void
+MatrixTableIterator::find_entry_fields() {
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type);
+  v_field = field_index(ts, "v");
+  alt_alleles_field = field_index(cast<TStruct>(ts->fields[v_field].type->fundamental_type), "altAlleles");
+  
+  const TStruct *entry = dyn_cast<TStruct>(mt->type->entry_type);
+  if (!entry)
+    throw std::runtime_error(fmt::format("entries are not structs: {}", mt->type->entry_type->to_string()));
+  gt_field = field_index(entry, "GT");
+  if (entry->fields[gt_field].type->kind != BaseType::Kind::CALL)
+    throw std::runtime_error(fmt::format("GT is not a call: {}", entry->fields[gt_field].type->to_string()));
+}
+
+void
+MatrixTableIterator::pack_calls() {
+  assert(!started);
+  find_entry_fields();
+  pack = true;
+}
+
+void
+MatrixTableIterator::use_sparse_entries(double max_density) {
+  assert(!started);
+  if (samples_selected)
+    throw std::runtime_error("sparse entries with selected samples are not supported");
+  find_entry_fields();
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type);
+  sparse_decoder = std::make_unique<SparseEntryDecoder>(ts->fields.back().type, gt_field, max_density);
+}
+
+void
+MatrixTableIterator::select_samples(std::vector<uint64_t> s) {
+  assert(!started);
+  if (sparse_decoder)
+    throw std::runtime_error("sparse entries with selected samples are not supported");
+  for (uint64_t i = 0; i < s.size(); ++i) {
+    if (s[i] >= mt->n_cols)
+      throw std::runtime_error(fmt::format("sample {} out of range, {} samples", s[i], mt->n_cols));
+    if (i > 0 && s[i] <= s[i - 1])
+      throw std::runtime_error("selected samples are not strictly increasing");
+  }
+  samples_selected = true;
+  samples = std::move(s);
+}
+
+uint64_t
+MatrixTableIterator::n_cols() const {
+  return samples_selected ? samples.size() : mt->n_cols;
+}
+
+std::vector<std::string>
+MatrixTableIterator::col_annotations() const {
+  if (!samples_selected)
+    return mt->col_annotations;
+  std::vector<std::string> r;
+  r.reserve(samples.size());
+  for (uint64_t i : samples)
+    r.push_back(mt->col_annotations[i]);
+  return r;
+}
+
+void
+MatrixTableIterator::use_batches() {
+  assert(!started);
+  batching = true;
+  relocator = std::make_unique<Relocator>(mt->type->row_impl_type->fundamental_type);
+}
+
+void
+MatrixTableIterator::clear_batch() {
+  assert(batching && !row_pending);
+  clear_region();
+}
+
+void
+MatrixTableIterator::lazy_entries() {
+  assert(!started);
+  lazy = true;
+}
+
+void
+MatrixTableIterator::load_entries() {
+  if (entries_pending) {
+    entries_pending = false;
+    decode_entries();
+  }
+}
+
+RetainedRow
+MatrixTableIterator::retain() const {
+  RetainedRow r;
+  if (row_cached) {
+    // the row is in the mapping, so keep that too
+    auto held = std::make_shared<std::pair<std::shared_ptr<Region>, std::shared_ptr<const CachedPartition>>>(region, row_cached);
+    r.region = std::shared_ptr<const Region>(held, held->first.get());
+  } else
+    r.region = region;
+  r.value = TypedRegionValue(region.get(), row_offset, mt->type->row_impl_type);
+  r.calls_packed = row_packed;
+  if (row_packed)
+    r.packed_calls = packed_calls();
+  r.entries_sparse = row_sparse;
+  if (row_sparse)
+    r.sparse_entries = sparse;
+  return r;
+}
+
+PackedCalls
+MatrixTableIterator::packed_calls() const {
+  assert(row_packed);
+  return PackedCalls(region.get(), packed_offset, n_packed);
+}
+
+const SparseEntries &
+MatrixTableIterator::sparse_entries() const {
+  assert(row_sparse);
+  return sparse;
+}
+
+// Rows are decoded into a region only the iterator holds.  If the last
+// row was retained, switch to a retired region no longer held by any
+// retained row, or a new one.
+void
+MatrixTableIterator::clear_region() {
+  if (region.use_count() > 1) {
+    auto i = std::find_if(retired.begin(), retired.end(),
+			  [](const std::shared_ptr<Region> &r) { return r.use_count() == 1; });
+    if (i == retired.end()) {
+      retired.push_back(std::move(region));
+      region = std::make_shared<Region>();
+    } else
+      std::swap(region, *i);
+  }
+  region->clear();
+  row_cached.reset();
+}
+
+// a batch of rows is cleared by clear_batch()
+void
+MatrixTableIterator::reset_region() {
+  if (!batching)
+    clear_region();
+}
+
+// view the next cached row in the region, or with batching, copy it
+// into the batch
+void
+MatrixTableIterator::load_cached_row() {
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type->fundamental_type);
+  if (batching) {
+    offset_t off;
+    cached_next = cached->load_row(cached_next, ts->size, cached_region, off);
+    row_offset = relocator->relocate(cached_region, off, *region);
+  } else {
+    reset_region();
+    cached_next = cached->load_row(cached_next, ts->size, *region, row_offset);
+    row_cached = cached;
+  }
+  entries_defined = region->is_field_defined(ts, row_offset, ts->fields.size() - 1);
+}
+
+// decode the row up to gs and mark gs missing
+void
+MatrixTableIterator::decode_prefix() {
+  if (cached) {
+    load_cached_row();
+    return;
+  }
+  
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type->fundamental_type);
+  uint64_t gs = ts->fields.size() - 1;
+  assert(ts->fields[gs].name == "gs" && !ts->fields[gs].type->required);
+  
+  reset_region();
+  row_offset = region->allocate(ts->alignment, ts->size);
+  ProfileStage stage(Profiler::DECODE);
+  in.read_bytes(*region, row_offset, ts->missing_bits_size());
+  for (uint64_t i = 0; i < gs; ++i)
+    if (region->is_field_defined(ts, row_offset, i))
+      decode(in, *region, row_offset + ts->field_offset[i], ts->fields[i].type);
+  
+  entries_defined = region->is_field_defined(ts, row_offset, gs);
+  region->set_bit(row_offset, ts->field_missing_bit[gs]);
 }
 
 bool
-MatrixTableIterator::has_next() const {
-  return part < mt->n_partitions;
+MatrixTableIterator::is_biallelic() const {
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type->fundamental_type);
+  if (region->is_field_missing(ts, row_offset, v_field))
+    return false;
+  const TStruct *vt = cast<TStruct>(ts->fields[v_field].type);
+  offset_t voff = row_offset + ts->field_offset[v_field];
+  if (region->is_field_missing(vt, voff, alt_alleles_field))
+    return false;
+  offset_t aoff = region->load_offset(voff + vt->field_offset[alt_alleles_field]);
+  return region->load_int(aoff) == 1;
+}
+
+void
+MatrixTableIterator::decode_entries() {
+  row_packed = false;
+  row_sparse = false;
+  if (!entries_defined || cached)
+    return;
+  
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type->fundamental_type);
+  uint64_t gs = ts->fields.size() - 1;
+  const TArray *gs_type = cast<TArray>(ts->fields[gs].type);
+  ProfileStage stage(Profiler::DECODE);
+  if (pack && is_biallelic()) {
+    packed_offset = decode_packed_calls(in, *region, gs_type, gt_field, n_packed,
+					samples_selected ? &samples : nullptr);
+    row_packed = true;
+  } else if (sparse_decoder) {
+    row_sparse = sparse_decoder->decode(in, *region, row_offset + ts->field_offset[gs], sparse);
+    if (!row_sparse)
+      region->clear_bit(row_offset, ts->field_missing_bit[gs]);
+  } else {
+    region->clear_bit(row_offset, ts->field_missing_bit[gs]);
+    if (samples_selected)
+      decode_elements(in, *region, row_offset + ts->field_offset[gs], gs_type, samples);
+    else
+      decode(in, *region, row_offset + ts->field_offset[gs], gs_type);
+  }
+}
+
+void
+MatrixTableIterator::skip_entries() {
+  const TStruct *ts = cast<TStruct>(mt->type->row_impl_type->fundamental_type);
+  ProfileStage stage(Profiler::DECODE);
+  skip(in, ts->fields.back().type);
+}
+
+// move the stream past the row last returned by next()
+void
+MatrixTableIterator::finish_row() {
+  if (entries_pending) {
+    entries_pending = false;
+    skip_entries();
+  }
+  if (advance_pending) {
+    advance_pending = false;
+    advance();
+  }
+}
+
+void
+MatrixTableIterator::find_row() {
+  const auto &row_impl = mt->type->row_impl_type;
+  
+  while (!row_pending && part < part_end) {
+    // with batching, the region holds the batch so far
+    size_t batch_end = batching ? region->end : 0;
+    decode_prefix();
+    if (filter(TypedRegionValue(region.get(), row_offset, row_impl))) {
+      row_pending = true;
+      return;
+    }
+    
+    if (batching)
+      region->truncate(batch_end);
+    if (entries_defined && !cached)
+      skip_entries();
+    advance();
+  }
+}
+
+bool
+MatrixTableIterator::has_next() {
+  if (!started)
+    start();
+  finish_row();
+  if (filter)
+    find_row();
+  return part < part_end;
 }
 
 TypedRegionValue
 MatrixTableIterator::next() {
   const auto &row_impl = mt->type->row_impl_type;
   
-  region.clear();
-  uint64_t offset = region.allocate(row_impl->alignment,
-				    row_impl->size);
-  decode(in, region, offset, row_impl->fundamental_type);
+  if (!started)
+    start();
+  finish_row();
+  if (Tracer::enabled() && batch_rows == 0)
+    batch_begin = Tracer::now();
+  
+  if (filter) {
+    find_row();
+    assert(row_pending);
+    row_pending = false;
+  } else
+    decode_prefix();
+  if (lazy) {
+    row_packed = false;
+    row_sparse = false;
+    entries_pending = entries_defined && !cached;
+  } else
+    decode_entries();
+  if (cache_writer)
+    cache_writer->append(*region, row_offset);
   
-  advance();
+  // the batch span covers wall time from the first row of the batch,
+  // including time spent by the caller between rows
+  if (++batch_rows == trace_batch_size)
+    end_batch();
   
-  return TypedRegionValue(&region, offset, row_impl);
+  if (lazy)
+    advance_pending = true;
+  else
+    advance();
+  
+  return TypedRegionValue(region.get(), row_offset, row_impl);
 }
 
 MatrixTable::MatrixTable(Context &c, const std::string &filename)
@@ -130,7 +457,6 @@ MatrixTable::MatrixTable(Context &c, const std::string &filename)
   igzstream is(metadata_filename.c_str());
   if (!is.rdbuf()->is_open() || is.fail())
     throw std::runtime_error(fmt::format("could not open file: {}", metadata_filename));
-  std::string metadata;
   metadata.assign(std::istreambuf_iterator<char>(is),
 		  std::istreambuf_iterator<char>());
   
@@ -139,6 +465,133 @@ MatrixTable::MatrixTable(Context &c, const std::string &filename)
   
   type = c.matrix_table_type(d);
   n_partitions = d["n_partitions"].GetUint64();
+  if (d.HasMember("codec"))
+    codec = BlockCodec::lookup(d["codec"].GetString());
+  else
+    codec = BlockCodec::lz4();
+  
+  // without sample_annotations, every column's annotation is missing
+  if (!d.HasMember("sample_annotations") || !d["sample_annotations"].IsArray()) {
+    n_cols = first_row_n_cols();
+    col_annotations.assign(n_cols, "null");
+    return;
+  }
+  n_cols = d["sample_annotations"].Size();
+  col_annotations.reserve(n_cols);
+  for (rapidjson::SizeType i = 0; i < n_cols; ++i) {
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    d["sample_annotations"][i].Accept(writer);
+    col_annotations.emplace_back(sb.GetString(), sb.GetSize());
+  }
+}
+
+uint64_t
+MatrixTable::first_row_n_cols() const {
+  // a pointer to this that doesn't own it, for the iterator
+  std::shared_ptr<const MatrixTable> self(std::shared_ptr<const MatrixTable>(), this);
+  const TStruct *ts = cast<TStruct>(type->row_impl_type);
+  uint64_t gs = ts->fields.size() - 1;
+  MatrixTableIterator i(self, all_partitions());
+  while (i.has_next()) {
+    TypedRegionValue row = i.next();
+    if (row.is_field_defined(gs))
+      return row.load_field(gs).array_size();
+  }
+  return 0;
+}
+
+std::string
+MatrixTable::resolved_filename() const {
+  char *path = realpath(filename.c_str(), nullptr);
+  if (!path)
+    throw std::runtime_error(fmt::format("could not resolve {}: {}", filename, strerror(errno)));
+  std::string r = path;
+  free(path);
+  return r;
+}
+
+std::string
+MatrixTable::part_stamps() const {
+  std::string r;
+  for (uint64_t part = 0; part < n_partitions; ++part) {
+    struct stat st;
+    if (stat(part_filename(part).c_str(), &st) == -1)
+      throw std::runtime_error(fmt::format("could not stat file: {}", part_filename(part)));
+    r += fmt::format("{} {} {}.{:09}\n", part, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+  }
+  return r;
+}
+
+void
+MatrixTable::use_row_cache(std::shared_ptr<RowCache> cache) {
+  std::string key = fmt::format("{}\n{}\n{}", resolved_filename(), type->row_impl_type->to_string(), part_stamps());
+  row_cache = std::move(cache);
+  row_cache_key = std::move(key);
+}
+
+uint64_t
+MatrixTable::load_into_memory() {
+  std::vector<std::shared_ptr<const FileContents>> contents;
+  uint64_t n_bytes = 0;
+  for (uint64_t part = 0; part < n_partitions; ++part) {
+    contents.push_back(std::make_shared<const FileContents>(part_filename(part)));
+    n_bytes += contents.back()->size;
+  }
+  part_contents = std::move(contents);
+  return n_bytes;
+}
+
+std::string
+MatrixTable::part_filename(uint64_t part) const {
+  int n_digits = std::to_string(n_partitions).size();
+  
+  auto part_s = std::to_string(part);
+  std::string pad(n_digits - part_s.size(), '0');
+  return filename + "/parts/part-" + pad + part_s;
+}
+
+std::vector<uint64_t>
+MatrixTable::part_sizes() const {
+  std::vector<uint64_t> sizes(n_partitions);
+  for (uint64_t part = 0; part < n_partitions; ++part) {
+    struct stat st;
+    if (stat(part_filename(part).c_str(), &st) == -1)
+      throw std::runtime_error(fmt::format("could not stat file: {}", part_filename(part)));
+    sizes[part] = st.st_size;
+  }
+  return sizes;
+}
+
+PartitionRange
+MatrixTable::shard(uint64_t i, uint64_t n) const {
+  if (n == 0 || i >= n)
+    throw std::runtime_error(fmt::format("invalid shard {} of {}", i, n));
+  
+  std::vector<uint64_t> sizes = part_sizes();
+  // cumulative[k] is the size of partitions [0, k)
+  std::vector<uint64_t> cumulative(n_partitions + 1);
+  cumulative[0] = 0;
+  for (uint64_t part = 0; part < n_partitions; ++part)
+    cumulative[part + 1] = cumulative[part] + sizes[part];
+  
+  // boundary j is the partition boundary nearest to j/n of the bytes
+  auto boundary = [&](uint64_t j) -> uint64_t {
+    if (j == n)
+      return n_partitions;
+    unsigned __int128 target = (unsigned __int128)cumulative[n_partitions] * j;
+    auto k = std::lower_bound(cumulative.begin(), cumulative.end(), target,
+			      [n](uint64_t c, unsigned __int128 t) {
+				return (unsigned __int128)c * n < t;
+			      }) - cumulative.begin();
+    if (k > 0
+	&& target - (unsigned __int128)cumulative[k - 1] * n
+	   <= (unsigned __int128)cumulative[k] * n - target)
+      --k;
+    return k;
+  };
+  
+  return PartitionRange { boundary(i), boundary(i + 1) };
 }
 
 std::shared_ptr<MatrixTableIterator>
@@ -146,9 +599,19 @@ MatrixTable::iterator() const {
   return std::make_unique<MatrixTableIterator>(shared_from_this());
 }
 
+std::shared_ptr<MatrixTableIterator>
+MatrixTable::iterator(PartitionRange parts) const {
+  return std::make_unique<MatrixTableIterator>(shared_from_this(), parts);
+}
+
 uint64_t
 MatrixTable::count_rows() const {
-  auto i = iterator();
+  return count_rows(all_partitions());
+}
+
+uint64_t
+MatrixTable::count_rows(PartitionRange parts) const {
+  auto i = iterator(parts);
   uint64_t nrows = 0;
   while (i->has_next()) {
     i->next();
@@ -157,4 +620,68 @@ MatrixTable::count_rows() const {
   return nrows;
 }
 
+uint64_t
+MatrixTable::count_rows(PartitionRange parts, RowPredicate filter) const {
+  auto i = iterator(parts);
+  i->filter_rows(std::move(filter));
+  uint64_t nrows = 0;
+  while (i->has_next()) {
+    i->next();
+    ++nrows;
+  }
+  return nrows;
+}
+
+void
+MatrixTable::write(const std::string &new_filename, const BlockCodec *new_codec) const {
+  std::string parts_dirname = new_filename + "/parts";
+  if (mkdir(new_filename.c_str(), 0777) == -1
+      || mkdir(parts_dirname.c_str(), 0777) == -1)
+    throw std::runtime_error(fmt::format("could not create directory {}: {}", parts_dirname, strerror(errno)));
+  
+  MatrixTable new_mt(*this);
+  new_mt.filename = new_filename;
+  new_mt.codec = new_codec;
+  
+  // block boundaries are preserved, so rows never need to be decoded
+  for (uint64_t part = 0; part < n_partitions; ++part) {
+    int fd = open(part_filename(part).c_str(), O_RDONLY);
+    if (fd == -1)
+      throw std::runtime_error(fmt::format("could not open file: {}", part_filename(part)));
+    BlockInputBuffer in(codec, fd);
+    
+    std::string new_part_filename = new_mt.part_filename(part);
+    int new_fd = open(new_part_filename.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (new_fd == -1)
+      throw std::runtime_error(fmt::format("could not create file: {}", new_part_filename));
+    BlockOutputBuffer out(new_codec, new_fd);
+    
+    while (in.next_block()) {
+      out.write_bytes(in.buf, in.end);
+      out.write_block();
+      in.off = in.end;
+    }
+    out.close();
+  }
+  
+  rapidjson::Document d;
+  d.Parse(metadata.c_str());
+  rapidjson::Value codec_name(new_codec->name(), d.GetAllocator());
+  if (d.HasMember("codec"))
+    d["codec"] = codec_name;
+  else
+    d.AddMember("codec", codec_name, d.GetAllocator());
+  
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  d.Accept(writer);
+  
+  std::string metadata_filename = new_filename + "/metadata.json.gz";
+  ogzstream os(metadata_filename.c_str());
+  os << sb.GetString();
+  os.close();
+  if (os.fail())
+    throw std::runtime_error(fmt::format("could not write file: {}", metadata_filename));
+}
+
 } // namespace hail
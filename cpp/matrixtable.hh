@@ -6,31 +6,200 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "region.hh"
+#include "codec.hh"
 #include "inputbuffer.hh"
+#include "packedcalls.hh"
+#include "relocate.hh"
+#include "rowcache.hh"
+#include "sparseentries.hh"
 
 namespace hail {
 
 class TMatrixTable;
 class MatrixTable;
 
+// partitions [begin, end)
+class PartitionRange {
+public:
+  uint64_t begin;
+  uint64_t end;
+  
+  bool empty() const { return begin == end; }
+};
+
+// Predicate on a row whose pk, v and va fields have been decoded.  gs
+// may not have been decoded yet, and then reads as missing.
+using RowPredicate = std::function<bool(TypedRegionValue row)>;
+
+// A row that stays valid for as long as it is held, together with
+// the views of its entries, see MatrixTableIterator::retain().
+class RetainedRow {
+public:
+  std::shared_ptr<const Region> region;
+  TypedRegionValue value;
+  bool calls_packed;
+  PackedCalls packed_calls;
+  bool entries_sparse;
+  SparseEntries sparse_entries;
+  
+  RetainedRow() : calls_packed(false), entries_sparse(false) {}
+};
+
 class MatrixTableIterator {
   std::shared_ptr<const MatrixTable> mt;
   
-  Region region;
+  // the region of the current row, and regions of earlier rows,
+  // reused once no retained row holds them
+  std::shared_ptr<Region> region;
+  std::vector<std::shared_ptr<Region>> retired;
   
+  bool started;
   uint64_t part;
-  LZ4InputBuffer in;
+  uint64_t part_end;
+  BlockInputBuffer in;
+  
+  // a partition in the row cache is read from cached, in place;
+  // otherwise, unfiltered rows decoded in full are written to
+  // cache_writer
+  std::shared_ptr<const CachedPartition> cached;
+  const char *cached_next;
+  // the partition region views; next() moves cached on to the next
+  // partition before the row is used
+  std::shared_ptr<const CachedPartition> row_cached;
+  std::unique_ptr<CachedPartitionWriter> cache_writer;
   
+  // with a filter, has_next() decodes the next row up to gs and runs
+  // the filter; rejected rows have their gs skipped in the stream
+  RowPredicate filter;
+  bool row_pending;
+  bool entries_defined;
+  offset_t row_offset;
+  
+  // with lazy entries, next() leaves the stream at the row's gs, to
+  // be decoded by load_entries() or skipped when the iterator moves on
+  bool lazy;
+  bool entries_pending;
+  bool advance_pending;
+  
+  // packed calls: field indices of v in the row, altAlleles in v and
+  // GT in the entry
+  bool pack;
+  uint64_t v_field;
+  uint64_t alt_alleles_field;
+  uint64_t gt_field;
+  bool row_packed;
+  offset_t packed_offset;
+  uint64_t n_packed;
+  
+  std::unique_ptr<SparseEntryDecoder> sparse_decoder;
+  bool row_sparse;
+  SparseEntries sparse;
+  
+  // with selected samples, entries are decoded for samples only
+  bool samples_selected;
+  std::vector<uint64_t> samples;
+  
+  // with batching, rows stay in region until clear_batch(); cached rows
+  // are viewed in cached_region and copied in
+  bool batching;
+  Region cached_region;
+  std::unique_ptr<Relocator> relocator;
+  
+  // tracing: rows are reported in batches of trace_batch_size
+  static const uint64_t trace_batch_size = 4096;
+  uint64_t part_begin;
+  uint64_t batch_begin;
+  uint64_t batch_rows;
+  
+  void start();
   void start_part();
+  void end_part();
+  void end_batch();
   void advance();
+  void clear_region();
+  void reset_region();
+  void decode_prefix();
+  void load_cached_row();
+  void decode_entries();
+  void skip_entries();
+  void finish_row();
+  bool is_biallelic() const;
+  void find_entry_fields();
+  void find_row();
   
 public:
   MatrixTableIterator(const std::shared_ptr<const MatrixTable> &mt);
+  MatrixTableIterator(const std::shared_ptr<const MatrixTable> &mt, PartitionRange parts);
+  
+  // set before the first call to has_next() or next()
+  void filter_rows(RowPredicate p);
+  
+  // Decode the entries of biallelic rows as packed calls, dropping the
+  // other entry fields; gs of those rows reads as missing.  Other rows
+  // are decoded in full.  Set before the first call to has_next() or
+  // next(); throws std::runtime_error if entries have no GT call.
+  void pack_calls();
   
-  bool has_next() const;
+  // Decode the entries of rows where fewer than max_density of the
+  // entries differ from the default (missing, or hom-ref) as
+  // SparseEntries; gs of those rows reads as missing.  Other rows
+  // decode as usual, see SparseEntryDecoder.  Rows whose calls are
+  // packed are not sparse.  Set before the first call to has_next() or
+  // next().
+  void use_sparse_entries(double max_density = 0.05);
+  
+  // Decode only the entries of samples, a strictly increasing list of
+  // column indices: gs of each row holds samples.size() entries, entry
+  // i for column samples[i], and packed calls are compacted the same
+  // way.  Other entries are skipped in the stream.  Set before the
+  // first call to has_next() or next(); throws std::runtime_error if
+  // samples are unsorted or out of range, or entries are sparse.
+  void select_samples(std::vector<uint64_t> samples);
+  
+  // the columns of the rows, after any selection: their number, and
+  // the JSON of their sample annotations
+  uint64_t n_cols() const;
+  std::vector<std::string> col_annotations() const;
+  
+  // Keep the rows returned by next() in one region until clear_batch(),
+  // so the rows of a batch can be evaluated together.  Rows are not
+  // written to the row cache.  Set before the first call to has_next()
+  // or next().
+  void use_batches();
+  
+  // start a new batch; the rows returned so far are no longer valid.
+  // Call after next(), not between has_next() and next().
+  void clear_batch();
+  
+  // Decode the entries of a row only when load_entries() is called;
+  // until then, gs of the row reads as missing.  Entries not loaded are
+  // skipped in the stream.  Set before the first call to has_next() or
+  // next().
+  void lazy_entries();
+  
+  // decode the entries of the row last returned by next(), if they are
+  // lazy and not yet decoded
+  void load_entries();
+  
+  // for the row last returned by next()
+  bool calls_packed() const { return row_packed; }
+  PackedCalls packed_calls() const;
+  bool entries_sparse() const { return row_sparse; }
+  const SparseEntries &sparse_entries() const;
+  
+  // Keep the row last returned by next() valid after the iterator
+  // advances.  The row's region is not reused while the RetainedRow,
+  // or a copy, is alive, so a window of k retained rows holds about k
+  // regions.
+  RetainedRow retain() const;
+  
+  bool has_next();
   
   TypedRegionValue next();
 };
@@ -38,16 +207,67 @@ public:
 class MatrixTable : public std::enable_shared_from_this<MatrixTable> {
 public:
   std::string filename;
+  std::string metadata;
   const TMatrixTable *type;
   uint64_t n_partitions;
+  // number of samples
+  uint64_t n_cols;
+  // JSON of each element of sample_annotations in the metadata, by
+  // column; null for every column if the metadata has none
+  std::vector<std::string> col_annotations;
+  const BlockCodec *codec;
+  
+  std::shared_ptr<RowCache> row_cache;
+  std::string row_cache_key;
+  
+  // compressed partition files, if loaded into memory
+  std::vector<std::shared_ptr<const FileContents>> part_contents;
+  
+private:
+  // the number of entries of the first row with gs defined, or 0
+  uint64_t first_row_n_cols() const;
   
 public:
   MatrixTable(Context &c, const std::string &filename);
   
+  // Read partitions from cache where it has them, and add partitions
+  // that iterators decode in full without a filter.  Iterators with
+  // packed calls, sparse entries or selected samples don't use the
+  // cache.  Rows are keyed by the dataset's path, the size and
+  // modification time of each partition file, and the row type.
+  void use_row_cache(std::shared_ptr<RowCache> cache);
+  
+  // Read the partition files, still compressed, into memory, and serve
+  // iterators created afterwards from there.  Returns the number of
+  // bytes loaded.
+  uint64_t load_into_memory();
+  
+  std::string part_filename(uint64_t part) const;
+  std::vector<uint64_t> part_sizes() const;
+  
+  // the absolute path of the dataset, with symlinks resolved, and a
+  // line of the size and modification time of each partition file;
+  // throw std::runtime_error if the files cannot be found
+  std::string resolved_filename() const;
+  std::string part_stamps() const;
+  
+  PartitionRange all_partitions() const { return PartitionRange { 0, n_partitions }; }
+  
+  // Shard i of n: a contiguous partition range chosen so that shards
+  // have roughly equal bytes on disk.  Depends only on the partition
+  // file sizes, so every process computes the same assignment.
+  PartitionRange shard(uint64_t i, uint64_t n) const;
+  
   // FIXME unique_ptr, but had trouble with unique_ptr in Cython
   std::shared_ptr<MatrixTableIterator> iterator() const;
+  std::shared_ptr<MatrixTableIterator> iterator(PartitionRange parts) const;
   
   uint64_t count_rows() const;
+  uint64_t count_rows(PartitionRange parts) const;
+  uint64_t count_rows(PartitionRange parts, RowPredicate filter) const;
+  
+  // copy to a new dataset, recompressing every block with codec
+  void write(const std::string &new_filename, const BlockCodec *new_codec) const;
 };
 
 #endif // HAIL_MATRIXTABLE_HH
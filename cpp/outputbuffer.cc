@@ -0,0 +1,60 @@
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "outputbuffer.hh"
+
+namespace hail {
+
+BlockOutputBuffer::BlockOutputBuffer(const BlockCodec *codec, int fd_)
+  : codec(codec),
+    fd(fd_),
+    off(0) {
+  buf = (char *)malloc(block_size);
+  comp = (char *)malloc(8 + codec->max_compressed_size(block_size));
+}
+
+BlockOutputBuffer::~BlockOutputBuffer() {
+  if (fd != -1)
+    close();
+  free(buf);
+  free(comp);
+}
+
+void
+BlockOutputBuffer::write_fully(const void *src0, size_t n) {
+  assert(fd != -1);
+  const char *src = (const char *)src0;
+  while (n > 0) {
+    ssize_t nwritten = write(fd, src, n);
+    assert(nwritten > 0);
+    src += nwritten;
+    n -= nwritten;
+  }
+}
+
+void
+BlockOutputBuffer::write_block() {
+  if (off == 0)
+    return;
+  
+  int32_t comp_len = codec->compress(buf, off, comp + 8,
+				     codec->max_compressed_size(block_size));
+  int32_t decomp_len = off;
+  memcpy(comp, &comp_len, 4);
+  memcpy(comp + 4, &decomp_len, 4);
+  write_fully(comp, 8 + comp_len);
+  
+  off = 0;
+}
+
+void
+BlockOutputBuffer::close() {
+  write_block();
+  ::close(fd);
+  fd = -1;
+}
+
+} // namespace hail
@@ -0,0 +1,96 @@
+#ifndef HAIL_OUTPUTBUFFER_HH
+#define HAIL_OUTPUTBUFFER_HH
+
+#pragma once
+
+#include "util.hh"
+#include "codec.hh"
+
+namespace hail {
+
+// Writer side of BlockInputBuffer: buffers up to block_size bytes and
+// writes them as one framed block compressed with codec.
+class BlockOutputBuffer {
+  // private:
+public:
+  static const int block_size = 128 * 1024;
+  
+  const BlockCodec *codec;
+  
+  int fd;
+  char *buf;
+  size_t off;
+  
+  char *comp;
+  
+  void write_fully(const void *src0, size_t n);
+  void write_block();
+  
+  void ensure(size_t n) {
+    if (UNLIKELY(off + n > block_size))
+      write_block();
+  }
+  
+public:
+  BlockOutputBuffer(const BlockCodec *codec, int fd_);
+  ~BlockOutputBuffer();
+  
+  void write_byte(int8_t b) {
+    ensure(1);
+    *(int8_t *)(buf + off) = b;
+    off += 1;
+  }
+  
+  void write_bool(bool b) { write_byte(b); }
+  
+  void write_float(float f) {
+    ensure(4);
+    *(float *)(buf + off) = f;
+    off += 4;
+  }
+  
+  void write_double(double d) {
+    ensure(8);
+    *(double *)(buf + off) = d;
+    off += 8;
+  }
+  
+  void write_int(int32_t i) {
+    ensure(5);
+    uint32_t x = i;
+    while (x >= 0x80) {
+      *(uint8_t *)(buf + off++) = (x & 0x7f) | 0x80;
+      x >>= 7;
+    }
+    *(uint8_t *)(buf + off++) = x;
+  }
+  
+  void write_long(int64_t l) {
+    ensure(10);
+    uint64_t x = l;
+    while (x >= 0x80) {
+      *(uint8_t *)(buf + off++) = (x & 0x7f) | 0x80;
+      x >>= 7;
+    }
+    *(uint8_t *)(buf + off++) = x;
+  }
+  
+  void write_bytes(const char *src, size_t n) {
+    while (n > 0) {
+      if (off == block_size)
+	write_block();
+      size_t p = std::min(block_size - off, n);
+      memcpy(buf + off, src, p);
+      src += p;
+      n -= p;
+      off += p;
+    }
+  }
+  
+  // flushes the last block and closes fd
+  void close();
+};
+
+} // namespace hail
+
+#endif // HAIL_OUTPUTBUFFER_HH
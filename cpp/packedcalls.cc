@@ -0,0 +1,186 @@
+
+#include <stdexcept>
+#include <vector>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <fmt/format.h>
+
+#include "casting.hh"
+#include "decode.hh"
+#include "packedcalls.hh"
+
+namespace hail {
+
+namespace {
+
+const uint64_t low_bits = 0x5555555555555555ULL;
+
+bool
+test_bit(const uint8_t *bits, uint64_t i) {
+  return (bits[i >> 3] & (1 << (i & 7))) != 0;
+}
+
+#ifdef AVX2_KERNELS
+
+// per-byte popcount by nibble lookup
+TARGET_AVX2_FMA inline __m256i
+popcount_bytes(__m256i v) {
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+				       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(v, nibble);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+}
+
+// popcount of each 64-bit lane
+TARGET_AVX2_FMA inline __m256i
+popcount_lanes(__m256i v) {
+  return _mm256_sad_epu8(popcount_bytes(v), _mm256_setzero_si256());
+}
+
+TARGET_AVX2_FMA uint64_t
+horizontal_sum(__m256i v) {
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, v);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// counts the codes of whole groups of 4 of the nw words at w; returns
+// the number of words counted
+TARGET_AVX2_FMA uint64_t
+count_codes_avx2(const uint64_t *w, uint64_t nw, uint64_t &het, uint64_t &hom_var, uint64_t &missing) {
+  const __m256i m = _mm256_set1_epi64x(low_bits);
+  __m256i het_v = _mm256_setzero_si256();
+  __m256i hom_var_v = _mm256_setzero_si256();
+  __m256i missing_v = _mm256_setzero_si256();
+  uint64_t k = 0;
+  for (; k + 4 <= nw; k += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(w + k));
+    __m256i lo = _mm256_and_si256(x, m);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi64(x, 1), m);
+    het_v = _mm256_add_epi64(het_v, popcount_lanes(_mm256_andnot_si256(hi, lo)));
+    hom_var_v = _mm256_add_epi64(hom_var_v, popcount_lanes(_mm256_andnot_si256(lo, hi)));
+    missing_v = _mm256_add_epi64(missing_v, popcount_lanes(_mm256_and_si256(lo, hi)));
+  }
+  het = horizontal_sum(het_v);
+  hom_var = horizontal_sum(hom_var_v);
+  missing = horizontal_sum(missing_v);
+  return k;
+}
+
+#endif
+
+} // namespace
+
+void
+PackedCalls::count_codes(uint64_t counts[4]) const {
+  const uint64_t *w = words();
+  uint64_t nw = n_words(n);
+  uint64_t het = 0, hom_var = 0, missing = 0;
+  uint64_t k = 0;
+
+#ifdef AVX2_KERNELS
+  if (cpu_has_avx2_fma())
+    k = count_codes_avx2(w, nw, het, hom_var, missing);
+#endif
+
+  for (; k < nw; ++k) {
+    uint64_t lo = w[k] & low_bits;
+    uint64_t hi = (w[k] >> 1) & low_bits;
+    het += __builtin_popcountll(lo & ~hi);
+    hom_var += __builtin_popcountll(hi & ~lo);
+    missing += __builtin_popcountll(lo & hi);
+  }
+
+  // padding is zero and so never counted
+  counts[HET] = het;
+  counts[HOM_VAR] = hom_var;
+  counts[MISSING] = missing;
+  counts[HOM_REF] = n - het - hom_var - missing;
+}
+
+uint64_t
+PackedCalls::alt_allele_count() const {
+  uint64_t counts[4];
+  count_codes(counts);
+  return counts[HET] + 2 * counts[HOM_VAR];
+}
+
+void
+PackedCalls::to_dosages(double *out, double missing_value) const {
+  const double values[4] = { 0, 1, 2, missing_value };
+  const uint8_t *bytes = (const uint8_t *)words();
+  uint64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint8_t b = bytes[i >> 2];
+    out[i] = values[b & 3];
+    out[i + 1] = values[(b >> 2) & 3];
+    out[i + 2] = values[(b >> 4) & 3];
+    out[i + 3] = values[b >> 6];
+  }
+  for (; i < n; ++i)
+    out[i] = values[get(i)];
+}
+
+offset_t
+decode_packed_calls(BlockInputBuffer &in, Region &region,
+		    const TArray *gs_type, uint64_t gt, uint64_t &n,
+		    const std::vector<uint64_t> *samples) {
+  const TStruct *ts = cast<TStruct>(gs_type->element_type->fundamental_type);
+  uint64_t n_entries = (uint32_t)in.read_int();
+  n = n_entries;
+  if (samples) {
+    if (!samples->empty() && samples->back() >= n_entries)
+      throw std::runtime_error(fmt::format("row has {} entries, selected sample {}", n_entries, samples->back()));
+    n = samples->size();
+  }
+  offset_t off = region.allocate(8, 8 * PackedCalls::n_words(n));
+
+  std::vector<uint8_t> element_bits;
+  if (!gs_type->element_type->required) {
+    element_bits.resize(gs_type->missing_bits_size(n_entries));
+    in.read_bytes((char *)element_bits.data(), element_bits.size());
+  }
+
+  std::vector<uint8_t> field_bits(ts->missing_bits_size());
+  uint64_t w = 0;
+  // k is the index of entry i among the packed calls
+  uint64_t k = 0;
+  for (uint64_t i = 0; i < n_entries; ++i) {
+    bool defined = element_bits.empty() || !test_bit(element_bits.data(), i);
+    if (samples && (k == n || (*samples)[k] != i)) {
+      if (defined)
+	skip(in, ts);
+      continue;
+    }
+    uint64_t code = PackedCalls::MISSING;
+    if (defined) {
+      in.read_bytes((char *)field_bits.data(), field_bits.size());
+      for (uint64_t j = 0; j < ts->fields.size(); ++j) {
+	if (!ts->fields[j].type->required
+	    && test_bit(field_bits.data(), ts->field_missing_bit[j]))
+	  continue;
+	if (j == gt) {
+	  int32_t c = in.read_int();
+	  if (c < 0 || c > 2)
+	    throw std::runtime_error(fmt::format("call {} is not biallelic diploid", c));
+	  code = c;
+	} else
+	  skip(in, ts->fields[j].type);
+      }
+    }
+    w |= code << ((k & 31) << 1);
+    if ((k & 31) == 31 || k == n - 1) {
+      region.store_long(off + 8 * (k >> 5), w);
+      w = 0;
+    }
+    ++k;
+  }
+  return off;
+}
+
+} // namespace hail
@@ -0,0 +1,94 @@
+#ifndef HAIL_PACKEDCALLS_HH
+#define HAIL_PACKEDCALLS_HH
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "region.hh"
+#include "inputbuffer.hh"
+
+namespace hail {
+
+// Biallelic diploid calls packed 2 bits each, 32 to a 64-bit word,
+// sample i in bits 2(i % 32) and 2(i % 32) + 1 of word i / 32.  Unused
+// bits of the last word are zero.  Views calls decoded into a region;
+// valid until the region is cleared.
+class PackedCalls {
+  const Region *region;
+  offset_t offset;
+
+public:
+  enum Code : uint8_t {
+    HOM_REF = 0,
+    HET = 1,
+    HOM_VAR = 2,
+    MISSING = 3,
+  };
+
+  uint64_t n;
+
+  PackedCalls() : region(nullptr), offset(0), n(0) {}
+  PackedCalls(const Region *region, offset_t offset, uint64_t n)
+    : region(region), offset(offset), n(n) {}
+
+  static uint64_t n_words(uint64_t n) { return (n + 31) >> 5; }
+
+  const uint64_t *words() const { return (const uint64_t *)(region->mem + offset); }
+
+  Code get(uint64_t i) const {
+    return (Code)((words()[i >> 5] >> ((i & 31) << 1)) & 3);
+  }
+
+  bool is_missing(uint64_t i) const { return get(i) == MISSING; }
+
+  // number of alternate alleles; i must not be missing
+  int n_alt(uint64_t i) const {
+    assert(!is_missing(i));
+    return get(i);
+  }
+
+  // counts[c] is the number of calls with code c
+  void count_codes(uint64_t counts[4]) const;
+
+  // het + 2 hom-var
+  uint64_t alt_allele_count() const;
+
+  // out[i] is the number of alternate alleles of call i, or
+  // missing_value
+  void to_dosages(double *out, double missing_value) const;
+};
+
+// alleles j <= k of the diploid call with index c = k(k + 1)/2 + j
+inline void
+call_alleles(int32_t c, int32_t &j, int32_t &k) {
+  k = (int32_t)((std::sqrt(8.0 * c + 1) - 1) / 2);
+  // correct for rounding
+  while ((k + 1) * (k + 2) / 2 <= c)
+    ++k;
+  while (k * (k + 1) / 2 > c)
+    --k;
+  j = c - k * (k + 1) / 2;
+}
+
+// number of non-reference alleles of call c
+inline int
+call_n_alt(int32_t c) {
+  int32_t j, k;
+  call_alleles(c, j, k);
+  return (j > 0) + (k > 0);
+}
+
+// decode entries of type gs_type (an array of structs whose field gt
+// is the call) as packed calls into region, skipping the other entry
+// fields.  Returns the offset of the words; n is set to the number of
+// entries.  With samples, a sorted list of entry indices, only those
+// entries are packed and the others skipped.  Throws std::runtime_error
+// on a call that is not biallelic, or a sample past the last entry.
+extern offset_t decode_packed_calls(BlockInputBuffer &in, Region &region,
+				    const TArray *gs_type, uint64_t gt, uint64_t &n,
+				    const std::vector<uint64_t> *samples = nullptr);
+
+} // namespace hail
+
+#endif // HAIL_PACKEDCALLS_HH
@@ -0,0 +1,153 @@
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "pages.hh"
+#include "util.hh"
+
+namespace hail {
+
+namespace {
+
+std::atomic<HugePagePolicy> policy(HugePagePolicy::NONE);
+std::atomic<size_t> policy_min_size(huge_page_size);
+
+std::atomic<uint64_t> n_allocated[(int)PageKind::N_KINDS];
+std::atomic<uint64_t> n_buffers[(int)PageKind::N_KINDS];
+std::atomic<uint64_t> n_bytes[(int)PageKind::N_KINDS];
+std::atomic<uint64_t> n_fallbacks(0);
+
+// false if transparent huge pages are off, or the kernel lacks them
+bool
+transparent_huge_pages_enabled() {
+  static const bool enabled = []() {
+    std::ifstream is("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string mode;
+    return std::getline(is, mode) && mode.find("[never]") == std::string::npos;
+  }();
+  return enabled;
+}
+
+// a mapping of n bytes aligned to a huge page, n a multiple of it
+char *
+map_aligned(size_t n) {
+  void *p = mmap(nullptr, n + huge_page_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return nullptr;
+  char *begin = (char *)p;
+  char *aligned = (char *)alignto((uintptr_t)begin, huge_page_size);
+  if (aligned != begin)
+    munmap(begin, aligned - begin);
+  if (aligned + n != begin + n + huge_page_size)
+    munmap(aligned + n, begin + n + huge_page_size - (aligned + n));
+  return aligned;
+}
+
+char *
+allocate(size_t &n, PageKind &kind) {
+  HugePagePolicy pol = policy.load(std::memory_order_relaxed);
+  if (pol == HugePagePolicy::NONE || n < policy_min_size.load(std::memory_order_relaxed)) {
+    kind = PageKind::MALLOC;
+    return (char *)malloc(n);
+  }
+  
+  size_t m = alignto(n, huge_page_size);
+  if (pol == HugePagePolicy::HUGETLBFS) {
+#ifdef MAP_HUGETLB
+    void *p = mmap(nullptr, m, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      n = m;
+      kind = PageKind::HUGETLB;
+      return (char *)p;
+    }
+#endif
+    ++n_fallbacks;
+  }
+  
+  if (char *p = map_aligned(m)) {
+    n = m;
+    kind = PageKind::PAGES;
+#ifdef MADV_HUGEPAGE
+    if (transparent_huge_pages_enabled() && madvise(p, m, MADV_HUGEPAGE) == 0)
+      kind = PageKind::TRANSPARENT_HUGE;
+#endif
+    if (kind == PageKind::PAGES)
+      ++n_fallbacks;
+    return p;
+  }
+  
+  ++n_fallbacks;
+  kind = PageKind::MALLOC;
+  return (char *)malloc(n);
+}
+
+} // namespace
+
+const char *
+page_kind_name(PageKind kind) {
+  switch (kind) {
+  case PageKind::MALLOC: return "malloc";
+  case PageKind::PAGES: return "pages";
+  case PageKind::TRANSPARENT_HUGE: return "transparent_huge";
+  case PageKind::HUGETLB: return "hugetlb";
+  default: abort();
+  }
+}
+
+void
+set_huge_page_policy(HugePagePolicy p, size_t min_size) {
+  policy = p;
+  policy_min_size = min_size;
+}
+
+char *
+allocate_pages(size_t &n, PageKind &kind) {
+  char *p = allocate(n, kind);
+  if (p) {
+    ++n_allocated[(int)kind];
+    ++n_buffers[(int)kind];
+    n_bytes[(int)kind] += n;
+  }
+  return p;
+}
+
+void
+free_pages(char *p, size_t n, PageKind kind) {
+  if (!p)
+    return;
+  --n_buffers[(int)kind];
+  n_bytes[(int)kind] -= n;
+  if (kind == PageKind::MALLOC)
+    free(p);
+  else
+    munmap(p, n);
+}
+
+PageStats
+page_stats() {
+  PageStats st;
+  for (int k = 0; k < (int)PageKind::N_KINDS; ++k) {
+    st.n_allocated[k] = n_allocated[k];
+    st.n_buffers[k] = n_buffers[k];
+    st.bytes[k] = n_bytes[k];
+  }
+  st.n_fallbacks = n_fallbacks;
+  
+  st.anon_huge_bytes = 0;
+  std::ifstream is("/proc/self/smaps_rollup");
+  std::string line;
+  while (std::getline(is, line))
+    if (line.compare(0, 14, "AnonHugePages:") == 0) {
+      st.anon_huge_bytes = std::stoull(line.substr(14)) << 10;
+      break;
+    }
+  return st;
+}
+
+} // namespace hail
@@ -0,0 +1,67 @@
+#ifndef HAIL_PAGES_HH
+#define HAIL_PAGES_HH
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hail {
+
+// Allocation of large buffers (region memory, block buffers, loaded
+// files), backed by huge pages where the policy asks for them and the
+// system provides them.  Buffers smaller than the policy's minimum
+// size come from malloc.
+
+static const size_t huge_page_size = 2 << 20;
+
+enum class HugePagePolicy {
+  // malloc only
+  NONE,
+  // 2MB-aligned anonymous mappings advised with MADV_HUGEPAGE
+  TRANSPARENT,
+  // MAP_HUGETLB from the hugetlbfs pool, else TRANSPARENT
+  HUGETLBFS,
+};
+
+// what a buffer actually got
+enum class PageKind : uint8_t {
+  MALLOC,
+  // an anonymous mapping of base pages, when transparent huge pages
+  // are disabled
+  PAGES,
+  TRANSPARENT_HUGE,
+  HUGETLB,
+  N_KINDS
+};
+
+extern const char *page_kind_name(PageKind kind);
+
+// the default is NONE; other policies apply to buffers of at least
+// min_size
+extern void set_huge_page_policy(HugePagePolicy policy, size_t min_size = huge_page_size);
+
+// Allocates at least n bytes.  Sets n to the usable size, which may be
+// larger, and kind to how it was allocated; both are needed to free it.
+// Returns null if no memory is available.
+extern char *allocate_pages(size_t &n, PageKind &kind);
+extern void free_pages(char *p, size_t n, PageKind kind);
+
+class PageStats {
+public:
+  // by PageKind: buffers allocated so far, and the live buffers and
+  // their bytes
+  uint64_t n_allocated[(int)PageKind::N_KINDS];
+  uint64_t n_buffers[(int)PageKind::N_KINDS];
+  uint64_t bytes[(int)PageKind::N_KINDS];
+  // huge page requests served by a fallback
+  uint64_t n_fallbacks;
+  // AnonHugePages of the whole process, as the kernel reports it; 0
+  // if unknown
+  uint64_t anon_huge_bytes;
+};
+
+extern PageStats page_stats();
+
+} // namespace hail
+
+#endif // HAIL_PAGES_HH
@@ -0,0 +1,263 @@
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "perfcounters.hh"
+
+namespace hail {
+
+namespace {
+
+const uint64_t counter_config[PerfCounters::N_COUNTERS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_REFERENCES,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+  PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+int
+perf_event_open(uint64_t config, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = (group_fd == -1);
+  // user space only, so perf_event_paranoid <= 2 is enough
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+uint64_t
+now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct StageTotals {
+  uint64_t calls;
+  uint64_t time_ns;
+  uint64_t counters[PerfCounters::N_COUNTERS];
+};
+
+struct ThreadProfile {
+  static const int max_depth = 16;
+
+  PerfCounters counters;
+
+  int depth;
+  Profiler::Stage stack[max_depth];
+
+  uint64_t last_time;
+  uint64_t last[PerfCounters::N_COUNTERS];
+
+  StageTotals totals[Profiler::N_STAGES];
+
+  ThreadProfile() : depth(0) {
+    memset(totals, 0, sizeof(totals));
+  }
+
+  // charge everything since the last snapshot to the innermost stage
+  void charge() {
+    uint64_t t = now_ns();
+    uint64_t values[PerfCounters::N_COUNTERS];
+    counters.read(values);
+    if (depth > 0) {
+      StageTotals &s = totals[stack[depth - 1]];
+      s.time_ns += t - last_time;
+      for (int c = 0; c < PerfCounters::N_COUNTERS; ++c)
+	s.counters[c] += values[c] - last[c];
+    }
+    last_time = t;
+    memcpy(last, values, sizeof(last));
+  }
+};
+
+std::mutex profiles_mutex;
+// never freed, so totals survive the threads that produced them
+std::vector<ThreadProfile *> profiles;
+
+thread_local ThreadProfile *this_thread_profile;
+
+ThreadProfile *
+thread_profile() {
+  if (UNLIKELY(this_thread_profile == nullptr)) {
+    auto p = new ThreadProfile;
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    profiles.push_back(p);
+    this_thread_profile = p;
+  }
+  return this_thread_profile;
+}
+
+} // namespace
+
+const char *
+PerfCounters::counter_name(int c) {
+  switch (c) {
+  case CYCLES: return "cycles";
+  case INSTRUCTIONS: return "instructions";
+  case CACHE_REFERENCES: return "cache_refs";
+  case CACHE_MISSES: return "cache_misses";
+  case BRANCHES: return "branches";
+  case BRANCH_MISSES: return "branch_misses";
+  default: abort();
+  }
+}
+
+PerfCounters::PerfCounters()
+  : leader(-1), n_open(0) {
+  for (int c = 0; c < N_COUNTERS; ++c) {
+    fds[c] = -1;
+    index[c] = -1;
+  }
+
+  leader = perf_event_open(counter_config[0], -1);
+  if (leader == -1) {
+    error_ = fmt::format("perf_event_open: {}", strerror(errno));
+    return;
+  }
+  fds[0] = leader;
+  index[0] = n_open++;
+
+  for (int c = 1; c < N_COUNTERS; ++c) {
+    int fd = perf_event_open(counter_config[c], leader);
+    if (fd != -1) {
+      fds[c] = fd;
+      index[c] = n_open++;
+    }
+  }
+
+  ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::~PerfCounters() {
+  for (int c = N_COUNTERS - 1; c >= 0; --c)
+    if (fds[c] != -1)
+      close(fds[c]);
+}
+
+void
+PerfCounters::read(uint64_t values[N_COUNTERS]) const {
+  // { nr, values[nr] }
+  uint64_t buf[1 + N_COUNTERS];
+  if (leader == -1
+      || ::read(leader, buf, sizeof(uint64_t) * (1 + n_open)) <= 0) {
+    memset(values, 0, sizeof(uint64_t) * N_COUNTERS);
+    return;
+  }
+  for (int c = 0; c < N_COUNTERS; ++c)
+    values[c] = index[c] == -1 ? 0 : buf[1 + index[c]];
+}
+
+std::atomic<bool> Profiler::enabled_(false);
+
+const char *
+Profiler::stage_name(int s) {
+  switch (s) {
+  case READ: return "read";
+  case DECOMPRESS: return "decompress";
+  case DECODE: return "decode";
+  default: abort();
+  }
+}
+
+void
+Profiler::start() {
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void
+Profiler::stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+void
+Profiler::enter(Stage s) {
+  ThreadProfile *p = thread_profile();
+  p->charge();
+  assert(p->depth < ThreadProfile::max_depth);
+  p->stack[p->depth++] = s;
+  p->totals[s].calls += 1;
+}
+
+void
+Profiler::exit() {
+  ThreadProfile *p = thread_profile();
+  p->charge();
+  assert(p->depth > 0);
+  --p->depth;
+}
+
+void
+Profiler::report(std::ostream &out) {
+  std::lock_guard<std::mutex> lock(profiles_mutex);
+
+  StageTotals totals[N_STAGES];
+  memset(totals, 0, sizeof(totals));
+  bool available[PerfCounters::N_COUNTERS] = { false };
+  std::string error;
+  for (ThreadProfile *p : profiles) {
+    if (p->counters.available()) {
+      for (int c = 0; c < PerfCounters::N_COUNTERS; ++c)
+	available[c] |= p->counters.available(c);
+    } else if (error.empty())
+      error = p->counters.error();
+    for (int s = 0; s < N_STAGES; ++s) {
+      totals[s].calls += p->totals[s].calls;
+      totals[s].time_ns += p->totals[s].time_ns;
+      for (int c = 0; c < PerfCounters::N_COUNTERS; ++c)
+	totals[s].counters[c] += p->totals[s].counters[c];
+    }
+  }
+
+  if (!available[PerfCounters::CYCLES])
+    out << fmt::format("hardware counters unavailable ({}); reporting wall time only\n",
+		       error.empty() ? "no profiled threads" : error);
+
+  out << fmt::format("{:<12}{:>12}{:>12}", "stage", "calls", "time_ms");
+  for (int c = 0; c < PerfCounters::N_COUNTERS; ++c)
+    if (available[c])
+      out << fmt::format("{:>16}", PerfCounters::counter_name(c));
+  if (available[PerfCounters::INSTRUCTIONS] && available[PerfCounters::CYCLES])
+    out << fmt::format("{:>8}", "IPC");
+  if (available[PerfCounters::CACHE_MISSES] && available[PerfCounters::CACHE_REFERENCES])
+    out << fmt::format("{:>10}", "cmiss%");
+  if (available[PerfCounters::BRANCH_MISSES] && available[PerfCounters::BRANCHES])
+    out << fmt::format("{:>10}", "bmiss%");
+  out << "\n";
+
+  auto ratio = [](uint64_t n, uint64_t d) { return d == 0 ? 0.0 : (double)n / d; };
+  for (int s = 0; s < N_STAGES; ++s) {
+    const StageTotals &t = totals[s];
+    const uint64_t *v = t.counters;
+    out << fmt::format("{:<12}{:>12}{:>12.3f}", stage_name(s), t.calls, t.time_ns * 1e-6);
+    for (int c = 0; c < PerfCounters::N_COUNTERS; ++c)
+      if (available[c])
+	out << fmt::format("{:>16}", v[c]);
+    if (available[PerfCounters::INSTRUCTIONS] && available[PerfCounters::CYCLES])
+      out << fmt::format("{:>8.2f}", ratio(v[PerfCounters::INSTRUCTIONS], v[PerfCounters::CYCLES]));
+    if (available[PerfCounters::CACHE_MISSES] && available[PerfCounters::CACHE_REFERENCES])
+      out << fmt::format("{:>10.2f}", 100 * ratio(v[PerfCounters::CACHE_MISSES], v[PerfCounters::CACHE_REFERENCES]));
+    if (available[PerfCounters::BRANCH_MISSES] && available[PerfCounters::BRANCHES])
+      out << fmt::format("{:>10.2f}", 100 * ratio(v[PerfCounters::BRANCH_MISSES], v[PerfCounters::BRANCHES]));
+    out << "\n";
+  }
+}
+
+} // namespace hail
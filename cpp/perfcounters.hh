@@ -0,0 +1,106 @@
+#ifndef HAIL_PERFCOUNTERS_HH
+#define HAIL_PERFCOUNTERS_HH
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "util.hh"
+
+namespace hail {
+
+// Hardware counters for the calling thread, opened as a single
+// perf_event_open group so they can be read with one syscall.
+// Counters that cannot be opened (no PMU, perf_event_paranoid,
+// containers) are reported as unavailable instead of failing.
+class PerfCounters {
+public:
+  enum Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_REFERENCES,
+    CACHE_MISSES,
+    BRANCHES,
+    BRANCH_MISSES,
+    N_COUNTERS
+  };
+
+  static const char *counter_name(int c);
+
+private:
+  int leader;
+  int fds[N_COUNTERS];
+  // position of each counter in the group read, or -1
+  int index[N_COUNTERS];
+  int n_open;
+  std::string error_;
+
+public:
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool available() const { return leader != -1; }
+  bool available(int c) const { return index[c] != -1; }
+  const std::string &error() const { return error_; }
+
+  // values of unavailable counters are set to 0
+  void read(uint64_t values[N_COUNTERS]) const;
+};
+
+// Attributes counter deltas and wall time to pipeline stages.  Stages
+// nest (a block read can happen in the middle of decoding a row); each
+// delta is charged to the innermost stage only.
+class Profiler {
+  static std::atomic<bool> enabled_;
+
+public:
+  enum Stage {
+    READ,
+    DECOMPRESS,
+    DECODE,
+    N_STAGES
+  };
+
+  static const char *stage_name(int s);
+
+  static bool enabled() {
+    return UNLIKELY(enabled_.load(std::memory_order_relaxed));
+  }
+
+  static void start();
+  static void stop();
+
+  static void enter(Stage s);
+  static void exit();
+
+  // totals over all threads; call after the profiled work is finished
+  static void report(std::ostream &out);
+};
+
+class ProfileStage {
+  bool active;
+
+public:
+  ProfileStage(Profiler::Stage s)
+    : active(Profiler::enabled()) {
+    if (UNLIKELY(active))
+      Profiler::enter(s);
+  }
+
+  ProfileStage(const ProfileStage &) = delete;
+  ProfileStage &operator=(const ProfileStage &) = delete;
+
+  ~ProfileStage() {
+    if (UNLIKELY(active))
+      Profiler::exit();
+  }
+};
+
+} // namespace hail
+
+#endif // HAIL_PERFCOUNTERS_HH
@@ -11,6 +11,7 @@
 #include <cstdio>
 
 #include "casting.hh"
+#include "pages.hh"
 #include "type.hh"
 #include "util.hh"
 
@@ -26,30 +27,69 @@ public:
   char *mem;
   size_t capacity;
   size_t end;
+  // false for a view of memory the region does not own
+  bool owned;
+  PageKind kind;
 
 public:
-  Region()
-    : mem((char *)malloc(128)), capacity(128), end(0) {}
+  Region() : Region(128) {}
   
   Region(size_t capacity_)
-    : mem((char *)malloc(capacity_)), capacity(capacity_), end(0) {}
+    : capacity(capacity_), end(0), owned(true) {
+    mem = allocate_pages(capacity, kind);
+    assert(mem != nullptr);
+  }
 
   ~Region() {
-    free(mem);
+    if (owned)
+      free_pages(mem, capacity, kind);
+  }
+  
+  void clear() {
+    end = 0;
+    // the next allocation moves a view to memory of its own
+    if (UNLIKELY(!owned))
+      capacity = 0;
   }
   
-  void clear() { end = 0; }
+  // drop the values allocated since end was n
+  void truncate(size_t n) {
+    assert(n <= end);
+    end = n;
+  }
   
   void grow(size_t required) {
     assert(capacity < required);
     
     size_t new_capacity = std::max((capacity * 3) >> 1, required);
-    char *new_mem = (char *)malloc(new_capacity);
+    PageKind new_kind;
+    char *new_mem = allocate_pages(new_capacity, new_kind);
     assert(new_mem != nullptr);
     memcpy(new_mem, mem, end);
-    free(mem);
+    if (owned)
+      free_pages(mem, capacity, kind);
     mem = new_mem;
     capacity = new_capacity;
+    kind = new_kind;
+    owned = true;
+  }
+  
+  // View the n bytes at p, the region of some values, in place, for
+  // example in a mapped file.  p must stay valid while the region views
+  // it and is only read; allocating in the region copies it first.
+  void view(const char *p, size_t n) {
+    if (owned)
+      free_pages(mem, capacity, kind);
+    mem = const_cast<char *>(p);
+    capacity = n;
+    end = n;
+    owned = false;
+  }
+  
+  // make room for n more bytes without growing
+  void reserve(size_t n) {
+    if (capacity < end + n)
+      grow(end + n);
   }
   
   offset_t allocate(offset_t alignment, offset_t n) {
@@ -95,6 +135,14 @@ public:
     return (b & (1 << (i & 7))) != 0;
   }
   
+  void set_bit(offset_t off, int i) {
+    *(mem + off + (i >> 3)) |= (1 << (i & 7));
+  }
+  
+  void clear_bit(offset_t off, int i) {
+    *(mem + off + (i >> 3)) &= ~(1 << (i & 7));
+  }
+  
   void store_int(offset_t off, int32_t i) {
     *(int32_t *)(mem + off) = i;
   }
@@ -168,6 +216,9 @@ public:
     : region(region), offset(offset), type(type)
   {}
   
+  const Region *get_region() const { return region; }
+  offset_t get_offset() const { return offset; }
+  
   bool load_bool() const {
     assert(isa<TBoolean>(type->fundamental_type));
     return region->load_bool(offset);
@@ -214,11 +265,11 @@ public:
   }
   
   bool is_element_missing(uint64_t i) {
-    return region->is_element_missing(cast<TArray>(type->fundamental_type), offset, i);
+    return region->is_element_missing(cast<TArray>(type->fundamental_type), region->load_offset(offset), i);
   }
   
   bool is_element_defined(uint64_t i) {
-    return region->is_element_defined(cast<TArray>(type->fundamental_type), offset, i);
+    return region->is_element_defined(cast<TArray>(type->fundamental_type), region->load_offset(offset), i);
   }
   
   uint64_t array_size() {
@@ -0,0 +1,197 @@
+
+#include <vector>
+
+#include "casting.hh"
+#include "relocate.hh"
+
+namespace hail {
+
+class RelocateNode {
+public:
+  const Type *type;
+  // no strings or arrays: copying the value's bytes is enough
+  bool fixed;
+  // struct: the fields that are not fixed, and their nodes; array:
+  // the element node
+  std::vector<uint64_t> fields;
+  std::vector<std::unique_ptr<const RelocateNode>> children;
+
+  RelocateNode(const Type *t);
+
+  // the value's bytes have been copied from src_off to dst_off; copy
+  // what they point to
+  void fix_up(const Region &src, offset_t src_off, Region &dst, offset_t dst_off) const;
+
+  // bytes dst might need to copy what the value at off points to,
+  // including alignment
+  uint64_t out_of_line_size(const Region &src, offset_t off) const;
+};
+
+RelocateNode::RelocateNode(const Type *t)
+  : type(t) {
+  assert(t->is_fundamental());
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+  case BaseType::Kind::INT32:
+  case BaseType::Kind::INT64:
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+    fixed = true;
+    break;
+  case BaseType::Kind::STRING:
+    fixed = false;
+    break;
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(t);
+      for (uint64_t i = 0; i < ts->fields.size(); ++i) {
+	auto child = std::make_unique<const RelocateNode>(ts->fields[i].type);
+	if (!child->fixed) {
+	  fields.push_back(i);
+	  children.push_back(std::move(child));
+	}
+      }
+      fixed = fields.empty();
+    }
+    break;
+  case BaseType::Kind::ARRAY:
+    children.push_back(std::make_unique<const RelocateNode>(cast<TArray>(t)->element_type));
+    fixed = false;
+    break;
+  default: abort();
+  }
+}
+
+void
+RelocateNode::fix_up(const Region &src, offset_t src_off, Region &dst, offset_t dst_off) const {
+  // dst.allocate can move dst.mem, and src.mem if src is dst, so
+  // pointers are not held across it
+  switch (type->kind) {
+  case BaseType::Kind::STRING:
+    {
+      offset_t soff = src.load_offset(src_off);
+      uint32_t n = src.load_int(soff);
+      offset_t new_off = dst.allocate(4, 4 + n);
+      memcpy(dst.mem + new_off, src.mem + soff, 4 + n);
+      dst.store_offset(dst_off, new_off);
+    }
+    break;
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(type);
+      for (uint64_t k = 0; k < fields.size(); ++k) {
+	uint64_t i = fields[k];
+	if (src.is_field_defined(ts, src_off, i))
+	  children[k]->fix_up(src, src_off + ts->field_offset[i], dst, dst_off + ts->field_offset[i]);
+      }
+    }
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(type);
+      offset_t aoff = src.load_offset(src_off);
+      uint32_t n = src.load_int(aoff);
+      uint64_t size = ta->content_size(n);
+      offset_t new_off = dst.allocate(ta->content_alignment(), size);
+      memcpy(dst.mem + new_off, src.mem + aoff, size);
+      dst.store_offset(dst_off, new_off);
+
+      const RelocateNode *element = children[0].get();
+      if (!element->fixed) {
+	uint64_t elements_off = ta->elements_offset(n);
+	uint64_t element_size = ta->element_size();
+	for (uint64_t i = 0; i < n; ++i) {
+	  if (src.is_element_defined(ta, aoff, i)) {
+	    uint64_t e = elements_off + i * element_size;
+	    element->fix_up(src, aoff + e, dst, new_off + e);
+	  }
+	}
+      }
+    }
+    break;
+  default: abort();
+  }
+}
+
+uint64_t
+RelocateNode::out_of_line_size(const Region &src, offset_t off) const {
+  uint64_t size = 0;
+  switch (type->kind) {
+  case BaseType::Kind::STRING:
+    size = 4 + (uint32_t)src.load_int(src.load_offset(off)) + 3;
+    break;
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(type);
+      for (uint64_t k = 0; k < fields.size(); ++k) {
+	uint64_t i = fields[k];
+	if (src.is_field_defined(ts, off, i))
+	  size += children[k]->out_of_line_size(src, off + ts->field_offset[i]);
+      }
+    }
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(type);
+      offset_t aoff = src.load_offset(off);
+      uint32_t n = src.load_int(aoff);
+      size = ta->content_size(n) + ta->content_alignment() - 1;
+
+      const RelocateNode *element = children[0].get();
+      if (!element->fixed) {
+	uint64_t elements_off = aoff + ta->elements_offset(n);
+	uint64_t element_size = ta->element_size();
+	for (uint64_t i = 0; i < n; ++i)
+	  if (src.is_element_defined(ta, aoff, i))
+	    size += element->out_of_line_size(src, elements_off + i * element_size);
+      }
+    }
+    break;
+  default: abort();
+  }
+  return size;
+}
+
+Relocator::Relocator(const Type *t)
+  : root(std::make_shared<const RelocateNode>(t->fundamental_type)),
+    type(t->fundamental_type) {}
+
+uint64_t
+Relocator::out_of_line_size(const Region &src, offset_t off) const {
+  return root->fixed ? 0 : root->out_of_line_size(src, off);
+}
+
+void
+Relocator::copy(const Region &src, offset_t src_off, Region &dst, offset_t dst_off) const {
+  memcpy(dst.mem + dst_off, src.mem + src_off, type->size);
+  if (!root->fixed)
+    root->fix_up(src, src_off, dst, dst_off);
+}
+
+offset_t
+Relocator::relocate(const Region &src, offset_t src_off, Region &dst) const {
+  offset_t dst_off = dst.allocate(type->alignment, type->size);
+  copy(src, src_off, dst, dst_off);
+  return dst_off;
+}
+
+TypedRegionValue
+Relocator::relocate(TypedRegionValue v, Region &dst) const {
+  assert(v.type->fundamental_type == type);
+  return TypedRegionValue(&dst, relocate(*v.get_region(), v.get_offset(), dst), v.type);
+}
+
+void
+Relocator::relocate(const Region &src, const offset_t *src_offsets, uint64_t n,
+		    Region &dst, offset_t *dst_offsets) const {
+  uint64_t size = n * (type->size + type->alignment - 1);
+  if (!root->fixed) {
+    for (uint64_t i = 0; i < n; ++i)
+      size += out_of_line_size(src, src_offsets[i]);
+  }
+  dst.reserve(size);
+  for (uint64_t i = 0; i < n; ++i)
+    dst_offsets[i] = relocate(src, src_offsets[i], dst);
+}
+
+} // namespace hail
@@ -0,0 +1,48 @@
+#ifndef HAIL_RELOCATE_HH
+#define HAIL_RELOCATE_HH
+#pragma once
+
+#include <memory>
+
+#include "region.hh"
+
+namespace hail {
+
+class RelocateNode;
+
+// Copies values of a type from one region to another: the value's own
+// bytes and the strings and arrays it points to, with the offsets it
+// stores rewritten for the destination.  The plan is built once per
+// type.  Subtrees without strings or arrays are copied with a single
+// memcpy, including arrays of them.  src and dst may be the same
+// region.
+class Relocator {
+  std::shared_ptr<const RelocateNode> root;
+
+  uint64_t out_of_line_size(const Region &src, offset_t off) const;
+
+public:
+  // fundamental type of the values
+  const Type *type;
+
+  Relocator(const Type *t);
+
+  // copy the value at src_off to dst_off, where type->size bytes have
+  // been allocated
+  void copy(const Region &src, offset_t src_off, Region &dst, offset_t dst_off) const;
+
+  // copy the value at src_off to a new slot in dst, returning its
+  // offset
+  offset_t relocate(const Region &src, offset_t src_off, Region &dst) const;
+
+  TypedRegionValue relocate(TypedRegionValue v, Region &dst) const;
+
+  // relocate the n values at src_offsets, setting dst_offsets.  Makes
+  // room in dst for all of them first, so dst grows at most once.
+  void relocate(const Region &src, const offset_t *src_offsets, uint64_t n,
+		Region &dst, offset_t *dst_offsets) const;
+};
+
+} // namespace hail
+
+#endif // HAIL_RELOCATE_HH
@@ -0,0 +1,290 @@
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "rowcache.hh"
+
+namespace hail {
+
+namespace {
+
+const char magic[4] = { 'H', 'L', 'R', 'C' };
+const uint32_t version = 1;
+
+class Header {
+public:
+  char magic[4];
+  uint32_t version;
+  uint64_t n_rows;
+  uint64_t data_size;
+};
+
+class CacheFile {
+public:
+  std::string filename;
+  uint64_t size;
+  struct timespec mtime;
+  bool tmp;
+};
+
+bool
+is_tmp_file(const char *name) {
+  return strstr(name, ".tmp-") != nullptr;
+}
+
+bool
+is_part_file(const char *name) {
+  return strncmp(name, "part-", 5) == 0 && !is_tmp_file(name);
+}
+
+// partition and temporary files under each key directory of dirname
+std::vector<CacheFile>
+list_cache_files(const std::string &dirname) {
+  std::vector<CacheFile> files;
+  DIR *d = opendir(dirname.c_str());
+  if (!d)
+    return files;
+  while (struct dirent *e = readdir(d)) {
+    if (e->d_name[0] == '.')
+      continue;
+    std::string key_dirname = dirname + "/" + e->d_name;
+    DIR *kd = opendir(key_dirname.c_str());
+    if (!kd)
+      continue;
+    while (struct dirent *ke = readdir(kd)) {
+      bool tmp = is_tmp_file(ke->d_name);
+      if (!tmp && !is_part_file(ke->d_name))
+	continue;
+      std::string filename = key_dirname + "/" + ke->d_name;
+      struct stat st;
+      if (stat(filename.c_str(), &st) == 0)
+	files.push_back(CacheFile { filename, (uint64_t)st.st_size, st.st_mtim, tmp });
+    }
+    closedir(kd);
+  }
+  closedir(d);
+  return files;
+}
+
+bool
+read_file(const std::string &filename, std::string &contents) {
+  std::ifstream is(filename, std::ios::binary);
+  if (!is)
+    return false;
+  contents.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+  return !is.bad();
+}
+
+// unique among concurrent writers on this host
+std::string
+tmp_suffix() {
+  static std::atomic<uint64_t> counter(0);
+  return fmt::format(".tmp-{}-{}", getpid(), counter++);
+}
+
+} // namespace
+
+CachedPartition::CachedPartition(const std::string &filename)
+  : fd(-1), data(nullptr), size(0), n_rows(0) {
+  fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < header_size) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("not a row cache file: {}", filename));
+  }
+  size = st.st_size;
+  void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("could not map {}: {}", filename, strerror(errno)));
+  }
+  data = (const char *)p;
+  madvise(p, size, MADV_SEQUENTIAL);
+  
+  Header h;
+  memcpy(&h, data, sizeof(h));
+  n_rows = h.n_rows;
+  if (!std::equal(h.magic, h.magic + 4, magic)
+      || h.version != version
+      || size != header_size + h.data_size) {
+    munmap((void *)data, size);
+    ::close(fd);
+    throw std::runtime_error(fmt::format("not a row cache file: {}", filename));
+  }
+}
+
+CachedPartition::~CachedPartition() {
+  munmap((void *)data, size);
+  ::close(fd);
+}
+
+CachedPartitionWriter::CachedPartitionWriter(std::shared_ptr<RowCache> cache, const std::string &filename)
+  : cache(std::move(cache)),
+    filename(filename),
+    tmp_filename(filename + tmp_suffix()),
+    out(tmp_filename, std::ios::binary),
+    n_rows(0),
+    data_size(0),
+    committed(false) {
+  if (!out)
+    throw std::runtime_error(fmt::format("could not open file: {}", tmp_filename));
+  char header[CachedPartition::header_size] = {};
+  out.write(header, sizeof(header));
+}
+
+CachedPartitionWriter::~CachedPartitionWriter() {
+  if (!committed) {
+    out.close();
+    unlink(tmp_filename.c_str());
+  }
+}
+
+void
+CachedPartitionWriter::append(const Region &region, offset_t row_offset) {
+  static const char padding[8] = {};
+  uint64_t n = region.end;
+  uint64_t prefix[2] = { n, row_offset };
+  out.write((const char *)prefix, sizeof(prefix));
+  out.write(region.mem, n);
+  out.write(padding, alignto(n, 8) - n);
+  ++n_rows;
+  data_size += sizeof(prefix) + alignto(n, 8);
+}
+
+void
+CachedPartitionWriter::commit() {
+  Header h;
+  std::copy(magic, magic + 4, h.magic);
+  h.version = version;
+  h.n_rows = n_rows;
+  h.data_size = data_size;
+  out.seekp(0);
+  out.write((const char *)&h, sizeof(h));
+  out.close();
+  if (!out || rename(tmp_filename.c_str(), filename.c_str()) == -1) {
+    unlink(tmp_filename.c_str());
+    throw std::runtime_error(fmt::format("could not write file: {}", filename));
+  }
+  committed = true;
+  cache->evict();
+}
+
+RowCache::RowCache(const std::string &dirname, uint64_t max_bytes)
+  : dirname(dirname), max_bytes(max_bytes) {
+  if (mkdir(dirname.c_str(), 0777) == -1 && errno != EEXIST)
+    throw std::runtime_error(fmt::format("could not create directory {}: {}", dirname, strerror(errno)));
+}
+
+std::string
+RowCache::key_dirname(const std::string &key) const {
+  return fmt::format("{}/{:016x}", dirname, (uint64_t)std::hash<std::string>()(key));
+}
+
+std::string
+RowCache::part_filename(const std::string &key, uint64_t part) const {
+  return fmt::format("{}/part-{}", key_dirname(key), part);
+}
+
+std::shared_ptr<const CachedPartition>
+RowCache::open(const std::string &key, uint64_t part) {
+  std::string stored_key;
+  if (!read_file(key_dirname(key) + "/key", stored_key) || stored_key != key)
+    return nullptr;
+  
+  std::string filename = part_filename(key, part);
+  std::shared_ptr<const CachedPartition> p;
+  try {
+    p = std::make_shared<const CachedPartition>(filename);
+  } catch (const std::runtime_error &) {
+    return nullptr;
+  }
+  // the modification time orders eviction
+  utimensat(AT_FDCWD, filename.c_str(), nullptr, 0);
+  return p;
+}
+
+std::unique_ptr<CachedPartitionWriter>
+RowCache::create(const std::string &key, uint64_t part) {
+  std::string key_dir = key_dirname(key);
+  if (mkdir(key_dir.c_str(), 0777) == -1 && errno != EEXIST)
+    throw std::runtime_error(fmt::format("could not create directory {}: {}", key_dir, strerror(errno)));
+  
+  std::string key_filename = key_dir + "/key";
+  std::string stored_key;
+  if (!read_file(key_filename, stored_key)) {
+    std::string tmp_filename = key_filename + tmp_suffix();
+    std::ofstream os(tmp_filename, std::ios::binary);
+    os << key;
+    os.close();
+    if (!os || rename(tmp_filename.c_str(), key_filename.c_str()) == -1) {
+      unlink(tmp_filename.c_str());
+      throw std::runtime_error(fmt::format("could not write file: {}", key_filename));
+    }
+    if (!read_file(key_filename, stored_key))
+      throw std::runtime_error(fmt::format("could not read file: {}", key_filename));
+  }
+  if (stored_key != key)
+    return nullptr;
+  
+  return std::make_unique<CachedPartitionWriter>(shared_from_this(), part_filename(key, part));
+}
+
+uint64_t
+RowCache::size() {
+  uint64_t total = 0;
+  for (const auto &f : list_cache_files(dirname))
+    total += f.size;
+  return total;
+}
+
+void
+RowCache::evict() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<CacheFile> files = list_cache_files(dirname);
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t total = 0;
+  std::vector<CacheFile> parts;
+  for (const auto &f : files) {
+    if (f.tmp && now.tv_sec - f.mtime.tv_sec > stale_tmp_seconds
+	&& unlink(f.filename.c_str()) == 0)
+      continue;
+    total += f.size;
+    if (!f.tmp)
+      parts.push_back(f);
+  }
+  if (total <= max_bytes)
+    return;
+  
+  std::sort(parts.begin(), parts.end(),
+	    [](const CacheFile &a, const CacheFile &b) {
+	      return std::tie(a.mtime.tv_sec, a.mtime.tv_nsec) < std::tie(b.mtime.tv_sec, b.mtime.tv_nsec);
+	    });
+  for (const auto &f : parts) {
+    if (total <= max_bytes)
+      break;
+    // a reader that has it mapped keeps its copy
+    if (unlink(f.filename.c_str()) == 0)
+      total -= f.size;
+  }
+}
+
+} // namespace hail
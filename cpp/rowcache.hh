@@ -0,0 +1,127 @@
+#ifndef HAIL_ROWCACHE_HH
+#define HAIL_ROWCACHE_HH
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include "region.hh"
+
+namespace hail {
+
+class RowCache;
+
+// A partition of decoded rows in a cache file, mapped read-only.  On
+// disk:
+//
+//   header (header_size bytes): "HLRC", uint32 version, uint64 n_rows,
+//     uint64 data_size
+//   per row: uint64 size, uint64 row offset, then the row's region,
+//     size bytes padded to 8
+//
+// Each row's region holds only that row, so its offsets are relative
+// to the start of the region and a Region can view it in place.
+class CachedPartition {
+  int fd;
+  
+public:
+  static const uint64_t header_size = 64;
+  
+  const char *data;
+  size_t size;
+  uint64_t n_rows;
+  
+  // throws std::runtime_error if filename is not a complete cache file
+  CachedPartition(const std::string &filename);
+  CachedPartition(const CachedPartition &) = delete;
+  ~CachedPartition();
+  
+  CachedPartition &operator=(const CachedPartition &) = delete;
+  
+  // rows are at [header_size, size)
+  const char *begin() const { return data + header_size; }
+  const char *end() const { return data + size; }
+  
+  // View the row at p in region, returning the row offset and the
+  // position of the next row.  Throws std::runtime_error if the row, or
+  // its row_size bytes at the row offset, run past the end of the file.
+  const char *load_row(const char *p, uint64_t row_size, Region &region, offset_t &row_offset) const {
+    uint64_t left = end() - p;
+    if (left < 16)
+      throw std::runtime_error("truncated row cache file");
+    uint64_t n = *(const uint64_t *)p;
+    row_offset = *(const uint64_t *)(p + 8);
+    if (n > left - 16 || alignto(n, 8) > left - 16 || row_offset > n || row_size > n - row_offset)
+      throw std::runtime_error("corrupt row cache file");
+    region.view(p + 16, n);
+    return p + 16 + alignto(n, 8);
+  }
+};
+
+// Writes a CachedPartition to a temporary file that commit() renames
+// into place, so readers never see a partial partition.  Dropped
+// without commit(), the temporary file is removed.
+class CachedPartitionWriter {
+  std::shared_ptr<RowCache> cache;
+  std::string filename;
+  std::string tmp_filename;
+  std::ofstream out;
+  uint64_t n_rows;
+  uint64_t data_size;
+  bool committed;
+  
+public:
+  CachedPartitionWriter(std::shared_ptr<RowCache> cache, const std::string &filename);
+  CachedPartitionWriter(const CachedPartitionWriter &) = delete;
+  ~CachedPartitionWriter();
+  
+  CachedPartitionWriter &operator=(const CachedPartitionWriter &) = delete;
+  
+  // region must hold only the row at row_offset
+  void append(const Region &region, offset_t row_offset);
+  
+  void commit();
+};
+
+// A directory of decoded partitions, bounded in size by evicting the
+// least recently used partition files.  Partitions are grouped by key,
+// which identifies the dataset and the type of its cached rows; each
+// key has a subdirectory named by its hash that also records the key.
+// Several processes may share the directory.  Temporary files of
+// writers count towards the size; those not modified for
+// stale_tmp_seconds, left by writers that died, are removed by evict().
+class RowCache : public std::enable_shared_from_this<RowCache> {
+  std::mutex mutex;
+  
+  std::string key_dirname(const std::string &key) const;
+  std::string part_filename(const std::string &key, uint64_t part) const;
+  
+public:
+  static const int64_t stale_tmp_seconds = 3600;
+  
+  const std::string dirname;
+  const uint64_t max_bytes;
+  
+  RowCache(const std::string &dirname, uint64_t max_bytes);
+  
+  // the cached partition, or null if it is not in the cache
+  std::shared_ptr<const CachedPartition> open(const std::string &key, uint64_t part);
+  
+  // a writer adding the partition to the cache, or null if the key
+  // collides with another key
+  std::unique_ptr<CachedPartitionWriter> create(const std::string &key, uint64_t part);
+  
+  // total bytes of partition and temporary files
+  uint64_t size();
+  
+  // remove stale temporary files, then least recently used partition
+  // files until at most max_bytes remain
+  void evict();
+};
+
+} // namespace hail
+
+#endif // HAIL_ROWCACHE_HH
@@ -0,0 +1,39 @@
+
+#include "rowfilter.hh"
+
+namespace hail {
+
+namespace {
+
+// row_impl field 0 is pk, a Locus: Struct { contig: !String, pos: !Int32 }
+bool
+load_locus(TypedRegionValue row, std::string &contig, int32_t &pos) {
+  if (row.is_field_missing(0))
+    return false;
+  TypedRegionValue pk = row.load_field(0);
+  contig = pk.load_field(0).load_string();
+  pos = pk.load_field(1).load_int();
+  return true;
+}
+
+} // namespace
+
+RowPredicate
+contig_filter(const std::string &contig) {
+  return [contig](TypedRegionValue row) {
+    std::string c;
+    int32_t pos;
+    return load_locus(row, c, pos) && c == contig;
+  };
+}
+
+RowPredicate
+locus_filter(const std::string &contig, int32_t start, int32_t end) {
+  return [contig, start, end](TypedRegionValue row) {
+    std::string c;
+    int32_t pos;
+    return load_locus(row, c, pos) && c == contig && start <= pos && pos < end;
+  };
+}
+
+} // namespace hail
@@ -0,0 +1,19 @@
+#ifndef HAIL_ROWFILTER_HH
+#define HAIL_ROWFILTER_HH
+#pragma once
+
+#include <string>
+
+#include "matrixtable.hh"
+
+namespace hail {
+
+// rows whose pk is on contig
+extern RowPredicate contig_filter(const std::string &contig);
+
+// rows whose pk is on contig with start <= pos < end
+extern RowPredicate locus_filter(const std::string &contig, int32_t start, int32_t end);
+
+} // namespace hail
+
+#endif // HAIL_ROWFILTER_HH
@@ -0,0 +1,74 @@
+#ifndef HAIL_SERIALIZE_HH
+#define HAIL_SERIALIZE_HH
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace hail {
+
+// Binary fields of partial results passed between processes on the
+// same architecture.  Readers throw std::runtime_error on truncated
+// input.
+
+template<typename T> void
+write_raw(std::ostream &out, const T &x) {
+  out.write((const char *)&x, sizeof(T));
+}
+
+template<typename T> T
+read_raw(std::istream &in) {
+  T x;
+  in.read((char *)&x, sizeof(T));
+  if (!in)
+    throw std::runtime_error("truncated input");
+  return x;
+}
+
+inline void
+write_string(std::ostream &out, const std::string &s) {
+  write_raw<uint64_t>(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+inline std::string
+read_string(std::istream &in) {
+  uint64_t n = read_raw<uint64_t>(in);
+  std::string s;
+  // grow as the bytes arrive, so a bad length fails as truncated
+  char buf[4096];
+  while (n > 0) {
+    uint64_t k = std::min<uint64_t>(n, sizeof(buf));
+    in.read(buf, k);
+    if (!in)
+      throw std::runtime_error("truncated input");
+    s.append(buf, k);
+    n -= k;
+  }
+  return s;
+}
+
+// T is a plain value type
+template<typename T> void
+write_vector(std::ostream &out, const std::vector<T> &v) {
+  write_raw<uint64_t>(out, v.size());
+  out.write((const char *)v.data(), v.size() * sizeof(T));
+}
+
+template<typename T> std::vector<T>
+read_vector(std::istream &in) {
+  uint64_t n = read_raw<uint64_t>(in);
+  std::vector<T> v;
+  while (v.size() < n)
+    v.push_back(read_raw<T>(in));
+  return v;
+}
+
+} // namespace hail
+
+#endif // HAIL_SERIALIZE_HH
@@ -0,0 +1,168 @@
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "serialize.hh"
+#include "shard.hh"
+
+namespace hail {
+
+namespace {
+
+const char magic[4] = { 'H', 'L', 'S', 'R' };
+// version 2 adds the partials, version 3 the partition stamps
+const uint32_t version = 3;
+
+} // namespace
+
+ShardResult::ShardResult()
+  : n_partitions(0),
+    parts { 0, 0 },
+    n_rows(0) {}
+
+ShardResult
+ShardResult::scan(const std::shared_ptr<const MatrixTable> &mt, uint64_t i, uint64_t n,
+		  const Aggregation *agg, unsigned n_threads) {
+  ShardResult r;
+  r.dataset = mt->resolved_filename();
+  r.part_stamps = mt->part_stamps();
+  r.n_partitions = mt->n_partitions;
+  r.parts = mt->shard(i, n);
+  if (agg) {
+    std::vector<uint64_t> part_rows;
+    r.partials = agg->run_partitions(mt, r.parts, n_threads, &part_rows);
+    for (uint64_t k : part_rows)
+      r.n_rows += k;
+  } else
+    r.n_rows = mt->count_rows(r.parts);
+  return r;
+}
+
+ShardResult
+ShardResult::merge(std::vector<ShardResult> shards) {
+  if (shards.empty())
+    throw std::runtime_error("no shard results to merge");
+  
+  std::sort(shards.begin(), shards.end(),
+	    [](const ShardResult &l, const ShardResult &r) {
+	      return l.parts.begin < r.parts.begin
+		|| (l.parts.begin == r.parts.begin && l.parts.end < r.parts.end);
+	    });
+  
+  ShardResult r;
+  r.dataset = shards[0].dataset;
+  r.part_stamps = shards[0].part_stamps;
+  r.n_partitions = shards[0].n_partitions;
+  r.parts = PartitionRange { 0, 0 };
+  auto i = std::find_if(shards.begin(), shards.end(),
+			[](const ShardResult &s) { return !s.partials.empty(); });
+  bool aggregated = i != shards.end();
+  size_t n_aggregators = aggregated ? i->partials[0].size() : 0;
+  for (auto &s : shards) {
+    if (s.dataset != r.dataset || s.n_partitions != r.n_partitions)
+      throw std::runtime_error(fmt::format("shard results from different datasets: {} and {}",
+					   r.dataset, s.dataset));
+    if (s.part_stamps != r.part_stamps)
+      throw std::runtime_error(fmt::format("shard results for partitions [{}, {}) and [{}, {}) of {}: dataset changed between scans",
+					   shards[0].parts.begin, shards[0].parts.end,
+					   s.parts.begin, s.parts.end, s.dataset));
+    if (s.parts.begin != r.parts.end)
+      throw std::runtime_error(fmt::format("shard result for partitions [{}, {}) of {}: expected one starting at {}",
+					   s.parts.begin, s.parts.end, s.dataset, r.parts.end));
+    // a shard of no partitions has no partials either way
+    if (s.parts.begin != s.parts.end
+	&& (s.partials.empty() == aggregated
+	    || (aggregated && s.partials[0].size() != n_aggregators)))
+      throw std::runtime_error(fmt::format("shard results for partitions [{}, {}) of {}: different aggregators",
+					   s.parts.begin, s.parts.end, s.dataset));
+    r.parts.end = s.parts.end;
+    r.n_rows += s.n_rows;
+    for (auto &p : s.partials)
+      r.partials.push_back(std::move(p));
+  }
+  if (r.parts.end != r.n_partitions)
+    throw std::runtime_error(fmt::format("shard results cover partitions [0, {}) of {}",
+					 r.parts.end, r.n_partitions));
+  if (aggregated)
+    r.aggregators = Aggregation::merge_partitions(std::move(r.partials));
+  r.partials.clear();
+  return r;
+}
+
+void
+ShardResult::write(std::ostream &out) const {
+  out.write(magic, 4);
+  write_raw<uint32_t>(out, version);
+  write_string(out, dataset);
+  write_string(out, part_stamps);
+  write_raw<uint64_t>(out, n_partitions);
+  write_raw<uint64_t>(out, parts.begin);
+  write_raw<uint64_t>(out, parts.end);
+  write_raw<uint64_t>(out, n_rows);
+  write_raw<uint64_t>(out, partials.empty() ? 0 : partials[0].size());
+  for (const auto &aggs : partials)
+    for (const auto &a : aggs)
+      a->serialize(out);
+}
+
+ShardResult
+ShardResult::read(std::istream &in, const Aggregation *agg) {
+  char m[4];
+  in.read(m, 4);
+  if (!in || !std::equal(m, m + 4, magic))
+    throw std::runtime_error("not a shard result");
+  uint32_t v = read_raw<uint32_t>(in);
+  if (v < 1 || v > version)
+    throw std::runtime_error(fmt::format("unsupported shard result version {}", v));
+  
+  ShardResult r;
+  r.dataset = read_string(in);
+  if (v >= 3)
+    r.part_stamps = read_string(in);
+  r.n_partitions = read_raw<uint64_t>(in);
+  r.parts.begin = read_raw<uint64_t>(in);
+  r.parts.end = read_raw<uint64_t>(in);
+  r.n_rows = read_raw<uint64_t>(in);
+  if (v == 1)
+    return r;
+  
+  uint64_t n_aggregators = read_raw<uint64_t>(in);
+  if (n_aggregators == 0)
+    return r;
+  if (!agg)
+    throw std::runtime_error(fmt::format("shard result for partitions [{}, {}) of {} has partials: need their aggregation",
+					 r.parts.begin, r.parts.end, r.dataset));
+  std::vector<std::unique_ptr<Aggregator>> proto = agg->init();
+  if (proto.size() != n_aggregators)
+    throw std::runtime_error(fmt::format("shard result has {} aggregators, expected {}",
+					 n_aggregators, proto.size()));
+  for (uint64_t p = r.parts.begin; p < r.parts.end; ++p) {
+    std::vector<std::unique_ptr<Aggregator>> aggs = agg->init();
+    for (auto &a : aggs)
+      a->deserialize(in);
+    r.partials.push_back(std::move(aggs));
+  }
+  return r;
+}
+
+void
+ShardResult::write(const std::string &filename) const {
+  std::ofstream out(filename, std::ios::binary);
+  write(out);
+  out.close();
+  if (!out)
+    throw std::runtime_error(fmt::format("could not write file: {}", filename));
+}
+
+ShardResult
+ShardResult::read(const std::string &filename, const Aggregation *agg) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    throw std::runtime_error(fmt::format("could not open file: {}", filename));
+  return read(in, agg);
+}
+
+} // namespace hail
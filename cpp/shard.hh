@@ -0,0 +1,64 @@
+#ifndef HAIL_SHARD_HH
+#define HAIL_SHARD_HH
+#pragma once
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "aggregator.hh"
+#include "matrixtable.hh"
+
+namespace hail {
+
+// Partial result of scanning one shard of a dataset, written by the
+// process that scanned it.  merge() combines shards in partition order
+// regardless of the order they are given in, so n processes give the
+// same answer as one.
+//
+// With an Aggregation, the shard keeps the aggregators of each of its
+// partitions, and merge() merges those of all shards as
+// Aggregation::run() would over the whole dataset.
+class ShardResult {
+public:
+  // the dataset's resolved path, and the size and modification time of
+  // its partition files when it was scanned
+  std::string dataset;
+  std::string part_stamps;
+  uint64_t n_partitions;
+  PartitionRange parts;
+  
+  uint64_t n_rows;
+  
+  // per partition of parts, empty without an aggregation
+  std::vector<std::vector<std::unique_ptr<Aggregator>>> partials;
+  // set by merge(): the merged partials
+  std::vector<std::unique_ptr<Aggregator>> aggregators;
+  
+  ShardResult();
+  
+  // With an aggregation, rows are counted in the same pass.
+  static ShardResult scan(const std::shared_ptr<const MatrixTable> &mt, uint64_t i, uint64_t n,
+			  const Aggregation *agg = nullptr, unsigned n_threads = 0);
+  
+  // throws std::runtime_error if the shards are from different
+  // datasets, or the dataset changed between their scans, overlap,
+  // leave partitions uncovered or do not all have the same
+  // aggregators.  Compare part_stamps with MatrixTable::part_stamps()
+  // to check the result against the dataset as it is now.
+  static ShardResult merge(std::vector<ShardResult> shards);
+  
+  // reading partials needs the aggregation that wrote them; throws
+  // std::runtime_error if agg is null or has different aggregators
+  void write(std::ostream &out) const;
+  static ShardResult read(std::istream &in, const Aggregation *agg = nullptr);
+  
+  void write(const std::string &filename) const;
+  static ShardResult read(const std::string &filename, const Aggregation *agg = nullptr);
+};
+
+} // namespace hail
+
+#endif // HAIL_SHARD_HH
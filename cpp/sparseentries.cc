@@ -0,0 +1,189 @@
+
+#include "casting.hh"
+#include "decode.hh"
+#include "packedcalls.hh"
+#include "sparseentries.hh"
+
+namespace hail {
+
+namespace {
+
+enum EntryCode : uint8_t {
+  ENTRY_MISSING,
+  ENTRY_HOM_REF,
+  ENTRY_OTHER,
+};
+
+} // namespace
+
+TypedRegionValue
+SparseEntries::entries() const {
+  return TypedRegionValue(region, entries_offset, entries_type);
+}
+
+TypedRegionValue
+SparseEntries::default_entries() const {
+  assert(defaults_stored);
+  return TypedRegionValue(region, defaults_offset, entries_type);
+}
+
+void
+SparseEntries::count_calls(uint64_t counts[4]) const {
+  counts[PackedCalls::HOM_REF] = 0;
+  counts[PackedCalls::HET] = 0;
+  counts[PackedCalls::HOM_VAR] = 0;
+  counts[PackedCalls::MISSING] = 0;
+  counts[default_missing ? PackedCalls::MISSING : PackedCalls::HOM_REF] = n - k;
+
+  TypedRegionValue es = entries();
+  for (uint64_t i = 0; i < k; ++i) {
+    if (es.is_element_missing(i)) {
+      ++counts[PackedCalls::MISSING];
+      continue;
+    }
+    TypedRegionValue e = es.load_element(i);
+    if (e.is_field_missing(gt)) {
+      ++counts[PackedCalls::MISSING];
+      continue;
+    }
+    TypedRegionValue call = e.load_field(gt);
+    int32_t c = call.get_region()->load_int(call.get_offset()), j, l;
+    call_alleles(c, j, l);
+    if (c == 0)
+      ++counts[PackedCalls::HOM_REF];
+    else if (j == l)
+      ++counts[PackedCalls::HOM_VAR];
+    else
+      ++counts[PackedCalls::HET];
+  }
+}
+
+uint64_t
+SparseEntries::alt_allele_count() const {
+  uint64_t n_alt = 0;
+  for_each_entry([this, &n_alt](uint32_t, TypedRegionValue e) {
+      if (e.is_field_defined(gt)) {
+	TypedRegionValue call = e.load_field(gt);
+	n_alt += call_n_alt(call.get_region()->load_int(call.get_offset()));
+      }
+    });
+  return n_alt;
+}
+
+SparseEntryDecoder::SparseEntryDecoder(const Type *gs, uint64_t gt, double max_density)
+  : entries_type(gs),
+    gs_type(cast<TArray>(gs->fundamental_type)),
+    entry(cast<TStruct>(gs_type->element_type)),
+    gt(gt),
+    max_density(max_density) {}
+
+offset_t
+SparseEntryDecoder::build_array(Region &region, bool keep_missing, bool keep_hom_ref, bool keep_other) {
+  auto keep = [=](uint8_t c) {
+    return c == ENTRY_MISSING ? keep_missing : c == ENTRY_HOM_REF ? keep_hom_ref : keep_other;
+  };
+  uint64_t n = codes.size();
+  uint64_t m = 0;
+  for (uint8_t c : codes)
+    m += keep(c);
+
+  offset_t aoff = region.allocate(gs_type->content_alignment(), gs_type->content_size(m));
+  region.store_int(aoff, m);
+  memset(region.mem + aoff + 4, 0, gs_type->missing_bits_size(m));
+  offset_t elements_off = aoff + gs_type->elements_offset(m);
+  uint64_t element_size = gs_type->element_size();
+
+  const char *p = bytes.data();
+  uint64_t j = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    uint8_t c = codes[i];
+    if (keep(c)) {
+      if (c == ENTRY_MISSING)
+	region.set_bit(aoff + 4, j);
+      else
+	memcpy(region.mem + elements_off + j * element_size, p, entry->size);
+      ++j;
+    }
+    if (c != ENTRY_MISSING)
+      p += entry->size;
+  }
+  assert(j == m);
+  return aoff;
+}
+
+bool
+SparseEntryDecoder::decode(BlockInputBuffer &in, Region &region, offset_t off, SparseEntries &sparse) {
+  uint64_t n = (uint32_t)in.read_int();
+  codes.resize(n);
+  bytes.clear();
+
+  offset_t bits_off = region.allocate(1, gs_type->missing_bits_size(n));
+  if (gs_type->element_type->required)
+    memset(region.mem + bits_off, 0, gs_type->missing_bits_size(n));
+  else
+    in.read_bytes(region, bits_off, gs_type->missing_bits_size(n));
+  // one slot for decoding each entry
+  offset_t slot = region.allocate(entry->alignment, entry->size);
+
+  uint64_t n_missing = 0, n_hom_ref = 0;
+  // some hom-ref entry has a field other than GT defined
+  bool hom_ref_fields = false;
+  for (uint64_t i = 0; i < n; ++i) {
+    if (region.load_bit(bits_off, i) && !gs_type->element_type->required) {
+      codes[i] = ENTRY_MISSING;
+      ++n_missing;
+      continue;
+    }
+
+    in.read_bytes(region, slot, entry->missing_bits_size());
+    bool other_fields = false;
+    for (uint64_t f = 0; f < entry->fields.size(); ++f) {
+      if (!region.is_field_defined(entry, slot, f))
+	continue;
+      hail::decode(in, region, slot + entry->field_offset[f], entry->fields[f].type);
+      other_fields |= f != gt;
+    }
+    bool is_hom_ref = region.is_field_defined(entry, slot, gt)
+      && region.load_int(slot + entry->field_offset[gt]) == 0;
+    if (is_hom_ref) {
+      codes[i] = ENTRY_HOM_REF;
+      ++n_hom_ref;
+      hom_ref_fields |= other_fields;
+    } else
+      codes[i] = ENTRY_OTHER;
+    bytes.insert(bytes.end(), region.mem + slot, region.mem + slot + entry->size);
+  }
+
+  bool default_missing = n_missing >= n_hom_ref;
+  uint64_t k = n - (default_missing ? n_missing : n_hom_ref);
+  if (n == 0 || k >= max_density * n) {
+    region.store_offset(off, build_array(region, true, true, true));
+    return false;
+  }
+
+  offset_t aoff = build_array(region, !default_missing, default_missing, true);
+  offset_t entries_off = region.allocate(8, 8);
+  region.store_offset(entries_off, aoff);
+  bool defaults_stored = !default_missing && hom_ref_fields;
+  offset_t defaults_off = 0;
+  if (defaults_stored) {
+    offset_t doff = build_array(region, false, true, false);
+    defaults_off = region.allocate(8, 8);
+    region.store_offset(defaults_off, doff);
+  }
+  offset_t indices_off = region.allocate(4, 4 * k);
+  uint64_t j = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    if (codes[i] == (default_missing ? ENTRY_MISSING : ENTRY_HOM_REF))
+      continue;
+    region.store_int(indices_off + 4 * j, i);
+    ++j;
+  }
+  assert(j == k);
+
+  sparse = SparseEntries(&region, indices_off, entries_off, defaults_off, entries_type, gt,
+			 n, k, default_missing, defaults_stored);
+  return true;
+}
+
+} // namespace hail
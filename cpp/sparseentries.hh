@@ -0,0 +1,125 @@
+#ifndef HAIL_SPARSEENTRIES_HH
+#define HAIL_SPARSEENTRIES_HH
+#pragma once
+
+#include <vector>
+
+#include "region.hh"
+#include "inputbuffer.hh"
+
+namespace hail {
+
+// Entries of a row as a default entry plus the entries that differ
+// from it.  The default is either a missing entry or a hom-ref entry,
+// one with GT 0.  The non-default entries are a regular array of
+// entries in the region, with their entry indices in increasing order.
+// Hom-ref entries keep their other fields, DP, GQ, AD, PL and so on,
+// in a dense side array of the default entries, which is left out
+// when every one of them has its other fields missing.  Valid until
+// the region is cleared.
+class SparseEntries {
+  const Region *region;
+  offset_t indices_offset;
+  // offsets of pointers to the array of non-default entries, and of
+  // default entries
+  offset_t entries_offset;
+  offset_t defaults_offset;
+  const Type *entries_type;
+  uint64_t gt;
+
+public:
+  // number of entries, and of non-default entries
+  uint64_t n;
+  uint64_t k;
+  bool default_missing;
+  // the default entries have fields other than GT defined
+  bool defaults_stored;
+
+  SparseEntries()
+    : region(nullptr), indices_offset(0), entries_offset(0), defaults_offset(0),
+      entries_type(nullptr), gt(0), n(0), k(0), default_missing(true), defaults_stored(false) {}
+  SparseEntries(const Region *region, offset_t indices_offset, offset_t entries_offset,
+		offset_t defaults_offset, const Type *entries_type, uint64_t gt,
+		uint64_t n, uint64_t k, bool default_missing, bool defaults_stored)
+    : region(region), indices_offset(indices_offset), entries_offset(entries_offset),
+      defaults_offset(defaults_offset), entries_type(entries_type), gt(gt),
+      n(n), k(k), default_missing(default_missing), defaults_stored(defaults_stored) {}
+
+  // entry index of non-default entry j
+  uint32_t index(uint64_t j) const {
+    return region->load_int(indices_offset + 4 * j);
+  }
+
+  // the non-default entries, an array of k entries
+  TypedRegionValue entries() const;
+
+  // with defaults_stored, the default entries, an array of n - k
+  // entries in entry order; otherwise each default entry is GT 0 with
+  // every other field missing
+  TypedRegionValue default_entries() const;
+
+  // f(i, entry) for each non-default entry that is not missing, where
+  // i is its entry index
+  template<typename F> void
+  for_each_entry(F f) const {
+    TypedRegionValue es = entries();
+    for (uint64_t j = 0; j < k; ++j)
+      if (es.is_element_defined(j))
+	f(index(j), es.load_element(j));
+  }
+
+  // f(i, entry) for each default entry, with defaults_stored
+  template<typename F> void
+  for_each_default_entry(F f) const {
+    if (!defaults_stored)
+      return;
+    TypedRegionValue ds = default_entries();
+    uint64_t j = 0, r = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      if (j < k && index(j) == i) {
+	++j;
+	continue;
+      }
+      f(i, ds.load_element(r++));
+    }
+  }
+
+  // counts[c] is the number of calls with PackedCalls::Code c, where
+  // het and hom-var are by allele, so multi-allelic calls count too
+  void count_calls(uint64_t counts[4]) const;
+
+  // number of non-reference alleles over all defined calls
+  uint64_t alt_allele_count() const;
+};
+
+// Decodes entries into the sparse form when few enough of them differ
+// from the default.  Any entry with GT 0 counts as hom-ref; its other
+// fields go to the default entries, so rows decoded either way keep
+// every field of a plain decode.
+class SparseEntryDecoder {
+  const Type *entries_type;
+  const TArray *gs_type;
+  const TStruct *entry;
+  uint64_t gt;
+  double max_density;
+
+  // per row: a code per entry and the bytes of the entries that are
+  // not missing
+  std::vector<uint8_t> codes;
+  std::vector<char> bytes;
+
+  offset_t build_array(Region &region, bool keep_missing, bool keep_hom_ref, bool keep_other);
+
+public:
+  // gt is the index of the call field in the entries of gs
+  SparseEntryDecoder(const Type *gs, uint64_t gt, double max_density);
+
+  // Decodes entries from in.  If the fraction of non-default entries is
+  // below max_density, returns true and sets sparse; otherwise stores
+  // the dense array at off and returns false.
+  bool decode(BlockInputBuffer &in, Region &region, offset_t off, SparseEntries &sparse);
+};
+
+} // namespace hail
+
+#endif // HAIL_SPARSEENTRIES_HH
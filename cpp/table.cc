@@ -0,0 +1,192 @@
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <rapidjson/rapidjson.h>
+#include <rapidjson/document.h>
+
+#include "gzstream.h"
+
+#include "context.hh"
+#include "decode.hh"
+#include "perfcounters.hh"
+#include "table.hh"
+#include "trace.hh"
+
+namespace hail {
+
+void
+TableIterator::start_part() {
+  TraceSpan span("start_part", "part", part);
+  
+  int fd = open(t->part_filename(part).c_str(), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error(fmt::format("could not open file: {}", t->part_filename(part)));
+  in = fd;
+}
+
+void
+TableIterator::advance() {
+  bool cont = in.read_byte();
+  while (!cont && part < part_end) {
+    ++part;
+    if (part < part_end) {
+      start_part();
+      cont = in.read_byte();
+    }
+  }
+}
+
+TableIterator::TableIterator(const std::shared_ptr<const Table> &t, PartitionRange parts,
+			     const Type *projected_type)
+  : t(t),
+    part(parts.begin),
+    part_end(parts.end),
+    in(t->codec),
+    row_type(cast<TStruct>(t->type->row_type->fundamental_type)),
+    projected_type(projected_type ? projected_type : t->type->row_type),
+    projected(cast<TStruct>(this->projected_type->fundamental_type)),
+    missing_bits(row_type->missing_bits_size()) {
+  assert(parts.begin <= parts.end && parts.end <= t->n_partitions);
+  
+  if (projected != row_type) {
+    uint64_t j = 0;
+    for (const auto &f : row_type->fields) {
+      if (j < projected->fields.size() && projected->fields[j].name == f.name) {
+	assert(projected->fields[j].type == f.type);
+	projected_field.push_back(j++);
+      } else
+	projected_field.push_back(-1);
+    }
+    if (j != projected->fields.size())
+      throw std::runtime_error(fmt::format("{} is not a projection of {}",
+					   projected_type->to_string(), t->type->row_type->to_string()));
+  }
+  
+  if (part < part_end) {
+    start_part();
+    advance();
+  }
+}
+
+bool
+TableIterator::has_next() {
+  return part < part_end;
+}
+
+TypedRegionValue
+TableIterator::next() {
+  region.clear();
+  offset_t off = region.allocate(projected->alignment, projected->size);
+  {
+    ProfileStage stage(Profiler::DECODE);
+    if (projected == row_type)
+      decode(in, region, off, row_type);
+    else {
+      // the row's missing bits, then each field decoded into the
+      // projection or skipped
+      in.read_bytes(missing_bits.data(), missing_bits.size());
+      memset(region.mem + off, 0, projected->missing_bits_size());
+      for (uint64_t i = 0; i < row_type->fields.size(); ++i) {
+	const Type *ft = row_type->fields[i].type;
+	uint64_t b = row_type->field_missing_bit[i];
+	bool defined = ft->required || !(missing_bits[b >> 3] & (1 << (b & 7)));
+	int64_t j = projected_field[i];
+	if (j == -1) {
+	  if (defined)
+	    skip(in, ft);
+	} else if (defined)
+	  decode(in, region, off + projected->field_offset[j], ft);
+	else
+	  region.set_bit(off, projected->field_missing_bit[j]);
+      }
+    }
+  }
+  advance();
+  return TypedRegionValue(&region, off, projected_type);
+}
+
+void
+TableIterator::skip_row() {
+  {
+    ProfileStage stage(Profiler::DECODE);
+    skip(in, row_type);
+  }
+  advance();
+}
+
+Table::Table(Context &c, const std::string &filename)
+  : filename(filename) {
+  std::string metadata_filename = filename + "/metadata.json.gz";
+  igzstream is(metadata_filename.c_str());
+  if (!is.rdbuf()->is_open() || is.fail())
+    throw std::runtime_error(fmt::format("could not open file: {}", metadata_filename));
+  metadata.assign(std::istreambuf_iterator<char>(is),
+		  std::istreambuf_iterator<char>());
+  
+  rapidjson::Document d;
+  d.Parse(metadata.c_str());
+  
+  type = c.table_type(d);
+  n_partitions = d["n_partitions"].GetUint64();
+  if (d.HasMember("codec"))
+    codec = BlockCodec::lookup(d["codec"].GetString());
+  else
+    codec = BlockCodec::lz4();
+}
+
+std::string
+Table::part_filename(uint64_t part) const {
+  int n_digits = std::to_string(n_partitions).size();
+  
+  auto part_s = std::to_string(part);
+  std::string pad(n_digits - part_s.size(), '0');
+  return filename + "/parts/part-" + pad + part_s;
+}
+
+const Type *
+Table::projection(Context &c, const std::vector<std::string> &fields) const {
+  const TStruct *ts = cast<TStruct>(type->row_type);
+  for (const auto &name : fields)
+    if (std::none_of(ts->fields.begin(), ts->fields.end(),
+		     [&name](const Field &f) { return f.name == name; }))
+      throw std::runtime_error(fmt::format("no field {} in {}", name, ts->to_string()));
+  
+  std::vector<Field> projected;
+  for (const auto &f : ts->fields)
+    if (std::find(fields.begin(), fields.end(), f.name) != fields.end())
+      projected.push_back(f);
+  return c.struct_type(projected, ts->required);
+}
+
+std::shared_ptr<TableIterator>
+Table::iterator() const {
+  return iterator(all_partitions());
+}
+
+std::shared_ptr<TableIterator>
+Table::iterator(PartitionRange parts) const {
+  return std::make_shared<TableIterator>(shared_from_this(), parts);
+}
+
+std::shared_ptr<TableIterator>
+Table::iterator(PartitionRange parts, const Type *projected_type) const {
+  return std::make_shared<TableIterator>(shared_from_this(), parts, projected_type);
+}
+
+uint64_t
+Table::count_rows() const {
+  return count_rows(all_partitions());
+}
+
+uint64_t
+Table::count_rows(PartitionRange parts) const {
+  auto i = iterator(parts);
+  uint64_t nrows = 0;
+  while (i->has_next()) {
+    i->skip_row();
+    ++nrows;
+  }
+  return nrows;
+}
+
+} // namespace hail
@@ -0,0 +1,85 @@
+#ifndef HAIL_TABLE_HH
+#define HAIL_TABLE_HH
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "codec.hh"
+#include "inputbuffer.hh"
+#include "matrixtable.hh"
+#include "region.hh"
+
+namespace hail {
+
+class Table;
+
+class TableIterator {
+  std::shared_ptr<const Table> t;
+  
+  Region region;
+  
+  uint64_t part;
+  uint64_t part_end;
+  BlockInputBuffer in;
+  
+  // fundamental types of the stored rows and of the rows returned
+  const TStruct *row_type;
+  const Type *projected_type;
+  const TStruct *projected;
+  // index in projected of each field of row_type, or -1
+  std::vector<int64_t> projected_field;
+  std::vector<char> missing_bits;
+  
+  void start_part();
+  void advance();
+  
+public:
+  // rows as projected_type, a projection of the row type, see
+  // Table::projection(); null for whole rows
+  TableIterator(const std::shared_ptr<const Table> &t, PartitionRange parts,
+		const Type *projected_type = nullptr);
+  
+  bool has_next();
+  
+  TypedRegionValue next();
+  
+  // advance past the next row without decoding it
+  void skip_row();
+};
+
+// A row-only table in the layout of MatrixTable: metadata.json.gz with
+// the schema, key and n_partitions, and part files of rows, each row
+// preceded by a continuation byte.
+class Table : public std::enable_shared_from_this<Table> {
+public:
+  std::string filename;
+  std::string metadata;
+  const TTable *type;
+  uint64_t n_partitions;
+  const BlockCodec *codec;
+  
+public:
+  Table(Context &c, const std::string &filename);
+  
+  std::string part_filename(uint64_t part) const;
+  
+  PartitionRange all_partitions() const { return PartitionRange { 0, n_partitions }; }
+  
+  // the row type with only the named fields, in row order; other
+  // fields are skipped rather than decoded.  Throws
+  // std::runtime_error on an unknown field.
+  const Type *projection(Context &c, const std::vector<std::string> &fields) const;
+  
+  std::shared_ptr<TableIterator> iterator() const;
+  std::shared_ptr<TableIterator> iterator(PartitionRange parts) const;
+  std::shared_ptr<TableIterator> iterator(PartitionRange parts, const Type *projected_type) const;
+  
+  uint64_t count_rows() const;
+  uint64_t count_rows(PartitionRange parts) const;
+};
+
+} // namespace hail
+
+#endif // HAIL_TABLE_HH
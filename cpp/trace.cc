@@ -0,0 +1,232 @@
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "trace.hh"
+
+namespace hail {
+
+namespace {
+
+struct TraceEvent {
+  const char *name;
+  const char *arg_name;
+  int64_t arg;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Chunks are only appended to by the owning thread.  n and next are
+// published with release stores so Tracer::stop() can walk the list
+// while other threads are still running.
+struct TraceChunk {
+  static const int capacity = 4096;
+
+  TraceEvent events[capacity];
+  std::atomic<int> n;
+  std::atomic<TraceChunk *> next;
+
+  TraceChunk() : n(0), next(nullptr) {}
+};
+
+struct ThreadTrace {
+  uint64_t tid;
+  // the start() the events are for
+  uint64_t generation;
+  // set when the thread exits
+  bool exited;
+  TraceChunk *head;
+  TraceChunk *tail;
+
+  ThreadTrace(uint64_t tid, uint64_t generation)
+    : tid(tid), generation(generation), exited(false), head(new TraceChunk), tail(head) {}
+  ThreadTrace(const ThreadTrace &) = delete;
+  ~ThreadTrace() {
+    clear();
+    delete head;
+  }
+
+  ThreadTrace &operator=(const ThreadTrace &) = delete;
+
+  // drop the events; by the owning thread, or once it has exited, with
+  // threads_mutex held so stop() is not walking the chunks
+  void clear() {
+    TraceChunk *c = head->next.load(std::memory_order_relaxed);
+    while (c) {
+      TraceChunk *next = c->next.load(std::memory_order_relaxed);
+      delete c;
+      c = next;
+    }
+    head->next.store(nullptr, std::memory_order_relaxed);
+    head->n.store(0, std::memory_order_relaxed);
+    tail = head;
+  }
+
+  void append(const TraceEvent &e) {
+    int i = tail->n.load(std::memory_order_relaxed);
+    if (UNLIKELY(i == TraceChunk::capacity)) {
+      TraceChunk *c = new TraceChunk;
+      tail->next.store(c, std::memory_order_release);
+      tail = c;
+      i = 0;
+    }
+    tail->events[i] = e;
+    tail->n.store(i + 1, std::memory_order_release);
+  }
+};
+
+std::mutex threads_mutex;
+// Buffers outlive their threads until the trace is written; stop()
+// and start() free those of exited threads.  A live thread clears its
+// buffer at its first event after a start().
+std::vector<ThreadTrace *> threads;
+uint64_t next_tid;
+std::atomic<uint64_t> generation(0);
+std::string trace_filename;
+uint64_t trace_epoch;
+
+// marks the thread's buffer as exited when the thread exits
+struct ThreadTraceHandle {
+  ThreadTrace *trace;
+
+  ~ThreadTraceHandle() {
+    if (trace) {
+      std::lock_guard<std::mutex> lock(threads_mutex);
+      trace->exited = true;
+    }
+  }
+};
+
+thread_local ThreadTraceHandle this_thread_trace;
+
+ThreadTrace *
+thread_trace() {
+  ThreadTrace *t = this_thread_trace.trace;
+  if (UNLIKELY(t == nullptr || t->generation != generation.load(std::memory_order_relaxed))) {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    if (t == nullptr) {
+      t = new ThreadTrace(next_tid++, generation);
+      threads.push_back(t);
+      this_thread_trace.trace = t;
+    } else {
+      t->clear();
+      t->generation = generation;
+    }
+  }
+  return t;
+}
+
+// with threads_mutex held
+void
+free_exited_threads() {
+  auto i = std::remove_if(threads.begin(), threads.end(),
+			  [](ThreadTrace *t) {
+			    if (!t->exited)
+			      return false;
+			    delete t;
+			    return true;
+			  });
+  threads.erase(i, threads.end());
+}
+
+void
+stop_at_exit() {
+  Tracer::stop();
+}
+
+struct TraceFromEnvironment {
+  TraceFromEnvironment() {
+    const char *filename = getenv("HAIL_TRACE");
+    if (filename && *filename)
+      Tracer::start(filename);
+  }
+} trace_from_environment;
+
+} // namespace
+
+std::atomic<bool> Tracer::enabled_(false);
+
+uint64_t
+Tracer::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void
+Tracer::start(const std::string &filename) {
+  static bool registered = false;
+
+  std::lock_guard<std::mutex> lock(threads_mutex);
+  free_exited_threads();
+  ++generation;
+  trace_filename = filename;
+  trace_epoch = now();
+  if (!registered) {
+    atexit(stop_at_exit);
+    registered = true;
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void
+Tracer::record(const char *name,
+	       uint64_t begin, uint64_t end,
+	       const char *arg_name, int64_t arg) {
+  thread_trace()->append(TraceEvent { name, arg_name, arg, begin, end });
+}
+
+void
+Tracer::stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock(threads_mutex);
+  if (trace_filename.empty())
+    return;
+
+  FILE *f = fopen(trace_filename.c_str(), "w");
+  if (!f) {
+    fmt::print(stderr, "hail: could not open trace file: {}\n", trace_filename);
+    trace_filename.clear();
+    return;
+  }
+
+  int pid = getpid();
+  bool first = true;
+  fmt::print(f, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (ThreadTrace *t : threads) {
+    fmt::print(f, "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"hail-{}\"}}}}",
+	       first ? "" : ",\n", pid, t->tid, t->tid);
+    first = false;
+    for (TraceChunk *c = t->head; c; c = c->next.load(std::memory_order_acquire)) {
+      int n = c->n.load(std::memory_order_acquire);
+      for (int i = 0; i < n; ++i) {
+	const TraceEvent &e = c->events[i];
+	// events recorded before the last start() belong to an earlier trace
+	if (e.begin < trace_epoch)
+	  continue;
+	fmt::print(f, ",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":{},\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}",
+		   e.name, pid, t->tid,
+		   (e.begin - trace_epoch) * 1e-3,
+		   (e.end - e.begin) * 1e-3);
+	if (e.arg_name)
+	  fmt::print(f, ",\"args\":{{\"{}\":{}}}", e.arg_name, e.arg);
+	fmt::print(f, "}}");
+      }
+    }
+  }
+  fmt::print(f, "\n]}}\n");
+  fclose(f);
+
+  trace_filename.clear();
+  free_exited_threads();
+}
+
+} // namespace hail
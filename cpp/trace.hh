@@ -0,0 +1,62 @@
+#ifndef HAIL_TRACE_HH
+#define HAIL_TRACE_HH
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "util.hh"
+
+namespace hail {
+
+// Span tracer that writes Chrome trace-event JSON (loadable in
+// chrome://tracing or ui.perfetto.dev).  Spans are appended to
+// per-thread buffers without locking; the file is written by
+// Tracer::stop(), which runs at exit if tracing was started.  Setting
+// HAIL_TRACE=<file> in the environment starts tracing at load time.
+class Tracer {
+  static std::atomic<bool> enabled_;
+
+public:
+  static bool enabled() {
+    return UNLIKELY(enabled_.load(std::memory_order_relaxed));
+  }
+
+  static uint64_t now();
+
+  static void start(const std::string &filename);
+  static void stop();
+
+  // arg_name may be null
+  static void record(const char *name,
+		     uint64_t begin, uint64_t end,
+		     const char *arg_name, int64_t arg);
+};
+
+class TraceSpan {
+  const char *name;
+  const char *arg_name;
+  int64_t arg;
+  uint64_t begin;
+
+public:
+  TraceSpan(const char *name)
+    : name(name), arg_name(nullptr), arg(0),
+      begin(Tracer::enabled() ? Tracer::now() : 0) {}
+  TraceSpan(const char *name, const char *arg_name, int64_t arg)
+    : name(name), arg_name(arg_name), arg(arg),
+      begin(Tracer::enabled() ? Tracer::now() : 0) {}
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  ~TraceSpan() {
+    if (UNLIKELY(begin != 0))
+      Tracer::record(name, begin, Tracer::now(), arg_name, arg);
+  }
+};
+
+} // namespace hail
+
+#endif // HAIL_TRACE_HH
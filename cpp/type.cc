@@ -111,6 +111,50 @@ TMatrixTable::put_to(std::ostream &out) const {
   return out;
 }
 
+TTable::TTable(const Type *global_type,
+	       const Type *row_type,
+	       const std::vector<std::string> &key)
+  : BaseType(Kind::TABLE),
+    global_type(global_type),
+    row_type(row_type),
+    key(key)
+{}
+
+std::size_t
+TTable::hash() const {
+  std::size_t h = BaseType::hash();
+  hash_combine<BaseType>(h, *global_type);
+  hash_combine<BaseType>(h, *row_type);
+  for (const auto &k : key)
+    hash_combine<std::string>(h, k);
+  return h;
+}
+
+bool
+TTable::operator==(const BaseType &that) const {
+  auto *that2 = dyn_cast<TTable>(&that);
+  return that2
+    && *global_type == *that2->global_type
+    && *row_type == *that2->row_type
+    && key == that2->key;
+}
+
+std::ostream &
+TTable::put_to(std::ostream &out) const {
+  out << "Table {\n";
+  out << "  global " << *global_type << "\n";
+  out << "  key [";
+  for (size_t i = 0; i < key.size(); ++i) {
+    if (i > 0)
+      out << ", ";
+    out << key[i];
+  }
+  out << "]\n";
+  out << "  row " << *row_type << "\n";
+  out << "}\n";
+  return out;
+}
+
 Type::Type(Kind kind, bool required)
   : BaseType(kind), required(required) {
 }
@@ -173,7 +217,7 @@ TInt64::put_to(std::ostream &out) const {
 }
 
 TFloat32::TFloat32(bool required)
-  : Type(Kind::INT32, required, 4, 4, this) {}
+  : Type(Kind::FLOAT32, required, 4, 4, this) {}
 
 std::ostream &
 TFloat32::put_to(std::ostream &out) const {
@@ -412,4 +456,30 @@ TVariant::put_to(std::ostream &out) const {
   return out;
 }
 
+TInterval::TInterval(Context &c, const std::string &gr, bool required)
+  : TComplex(c.interval_representation(gr, required), Kind::INTERVAL, required),
+    gr(gr),
+    point_type(c.locus_type(gr, true)) {}
+
+std::size_t
+TInterval::hash() const {
+  std::size_t h = Type::hash();
+  hash_combine(h, gr);
+  return h;
+}
+
+bool
+TInterval::operator==(const BaseType &that) const {
+  return Type::operator==(that)
+    && gr == cast<TInterval>(that).gr;
+}
+
+std::ostream &
+TInterval::put_to(std::ostream &out) const {
+  if (required)
+    out << "!";
+  out << "Interval(" << gr << ")";
+  return out;
+}
+
 } // namespace hail
@@ -99,6 +99,28 @@ public:
   std::ostream &put_to(std::ostream &out) const;
 };
 
+class TTable : public BaseType {
+  friend class Context;
+  
+  TTable(const Type *global_type,
+	 const Type *row_type,
+	 const std::vector<std::string> &key);
+  
+public:
+  static constexpr Kind kindof = Kind::TABLE;
+  
+  const Type *global_type;
+  // a struct; rows are stored as row_type itself
+  const Type *row_type;
+  // names of the key fields of row_type
+  std::vector<std::string> key;
+  
+  std::size_t hash() const;
+  bool operator==(const BaseType &that) const;
+  
+  std::ostream &put_to(std::ostream &out) const;
+};
+
 class Type : public BaseType {
   friend class Context;
 
@@ -345,6 +367,24 @@ public:
   std::ostream &put_to(std::ostream &out) const;
 };
 
+class TInterval : public TComplex {
+  friend class Context;
+  
+  TInterval(Context &c, const std::string &gr, bool required);
+  
+public:
+  static constexpr Kind kindof = Kind::INTERVAL;
+  
+  // an interval of loci, represented as Struct{start: !Locus, end: !Locus}
+  const std::string gr;
+  const TLocus *point_type;
+  
+  std::size_t hash() const;
+  bool operator==(const BaseType &that) const;
+  
+  std::ostream &put_to(std::ostream &out) const;
+};
+
 } // namespace hail
 
 namespace std {
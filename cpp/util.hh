@@ -8,9 +8,25 @@
 
 #define LIKELY(condition) __builtin_expect(static_cast<bool>(condition), 1)
 #define UNLIKELY(condition) __builtin_expect(static_cast<bool>(condition), 0)
+
+// On x86-64, kernels for AVX2 and FMA are compiled for them with
+// TARGET_AVX2_FMA whatever the build flags, and are only called if
+// cpu_has_avx2_fma().
+#if defined(__x86_64__)
+#define AVX2_KERNELS 1
+#define TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+#endif
   
 namespace hail {
 
+#ifdef AVX2_KERNELS
+inline bool
+cpu_has_avx2_fma() {
+  static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return has;
+}
+#endif
+
 inline uint64_t alignto(uint64_t p, uint64_t alignment) {
   assert(alignment > 0);
   assert((alignment & (alignment - 1)) == 0); // power of 2
@@ -0,0 +1,384 @@
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "casting.hh"
+#include "valueops.hh"
+
+namespace hail {
+
+namespace {
+
+// wyhash constants and 64x64->128 multiply-fold mixing
+const uint64_t secret[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL,
+};
+
+const uint64_t missing_hash = secret[2];
+
+inline uint64_t
+mum(uint64_t a, uint64_t b) {
+  unsigned __int128 r = (unsigned __int128)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+inline uint64_t
+mix(uint64_t h, uint64_t v) {
+  return mum(h ^ secret[0], v ^ secret[1]);
+}
+
+inline uint64_t
+load64(const char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+uint64_t
+hash_bytes(const char *p, uint64_t n) {
+  uint64_t h = mix(secret[3], n);
+  for (; n >= 16; p += 16, n -= 16)
+    h = mum(load64(p) ^ secret[1], load64(p + 8) ^ h);
+  if (n >= 8) {
+    h = mum(load64(p) ^ secret[2], h ^ secret[1]);
+    p += 8;
+    n -= 8;
+  }
+  if (n > 0) {
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    h = mum(tail ^ secret[3], h ^ secret[1]);
+  }
+  return mix(h, secret[0]);
+}
+
+inline uint64_t
+hash_double(double d) {
+  if (d == 0)
+    d = 0;
+  else if (d != d)
+    d = NAN;
+  uint64_t bits;
+  memcpy(&bits, &d, 8);
+  return mix(secret[1], bits);
+}
+
+inline bool
+equal_double(double a, double b) {
+  return a == b || (a != a && b != b);
+}
+
+inline int
+compare_double(double a, double b) {
+  if (a < b)
+    return -1;
+  if (a > b)
+    return 1;
+  // equal, or at least one is NaN
+  return (a != a) - (b != b);
+}
+
+template<typename T> inline int
+compare_values(T a, T b) {
+  return (a > b) - (a < b);
+}
+
+} // namespace
+
+class ValueOpsNode {
+public:
+  const Type *type;
+  std::vector<std::unique_ptr<const ValueOpsNode>> children;
+  // array whose elements are required Booleans or integers, so equal
+  // arrays have equal element bytes
+  bool bytewise;
+
+  ValueOpsNode(const Type *t);
+
+  uint64_t hash(const Region &r, offset_t off) const;
+  bool equal(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const;
+  int compare(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const;
+};
+
+ValueOpsNode::ValueOpsNode(const Type *t)
+  : type(t), bytewise(false) {
+  assert(t->is_fundamental());
+  switch (t->kind) {
+  case BaseType::Kind::BOOLEAN:
+  case BaseType::Kind::INT32:
+  case BaseType::Kind::INT64:
+  case BaseType::Kind::FLOAT32:
+  case BaseType::Kind::FLOAT64:
+  case BaseType::Kind::STRING:
+    break;
+  case BaseType::Kind::STRUCT:
+    for (const auto &f : cast<TStruct>(t)->fields)
+      children.push_back(std::make_unique<const ValueOpsNode>(f.type));
+    break;
+  case BaseType::Kind::ARRAY:
+    {
+      const Type *et = cast<TArray>(t)->element_type;
+      children.push_back(std::make_unique<const ValueOpsNode>(et));
+      bytewise = et->required
+	&& (et->kind == BaseType::Kind::BOOLEAN
+	    || et->kind == BaseType::Kind::INT32
+	    || et->kind == BaseType::Kind::INT64);
+    }
+    break;
+  default: abort();
+  }
+}
+
+uint64_t
+ValueOpsNode::hash(const Region &r, offset_t off) const {
+  switch (type->kind) {
+  case BaseType::Kind::BOOLEAN:
+    return mix(secret[1], r.load_bool(off));
+  case BaseType::Kind::INT32:
+    return mix(secret[1], (uint32_t)r.load_int(off));
+  case BaseType::Kind::INT64:
+    return mix(secret[1], r.load_long(off));
+  case BaseType::Kind::FLOAT32:
+    return hash_double(r.load_float(off));
+  case BaseType::Kind::FLOAT64:
+    return hash_double(r.load_double(off));
+  case BaseType::Kind::STRING:
+    {
+      offset_t soff = r.load_offset(off);
+      return hash_bytes(r.mem + soff + 4, (uint32_t)r.load_int(soff));
+    }
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(type);
+      uint64_t h = secret[0];
+      for (uint64_t i = 0; i < children.size(); ++i)
+	h = mix(h, r.is_field_defined(ts, off, i)
+		? children[i]->hash(r, off + ts->field_offset[i])
+		: missing_hash);
+      return h;
+    }
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(type);
+      offset_t aoff = r.load_offset(off);
+      uint32_t n = r.load_int(aoff);
+      offset_t elements_off = aoff + ta->elements_offset(n);
+      uint64_t element_size = ta->element_size();
+      if (bytewise)
+	return hash_bytes(r.mem + elements_off, n * element_size);
+      uint64_t h = mix(secret[3], n);
+      for (uint64_t i = 0; i < n; ++i)
+	h = mix(h, r.is_element_defined(ta, aoff, i)
+		? children[0]->hash(r, elements_off + i * element_size)
+		: missing_hash);
+      return h;
+    }
+  default: abort();
+  }
+}
+
+bool
+ValueOpsNode::equal(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const {
+  switch (type->kind) {
+  case BaseType::Kind::BOOLEAN:
+    return r1.load_bool(off1) == r2.load_bool(off2);
+  case BaseType::Kind::INT32:
+    return r1.load_int(off1) == r2.load_int(off2);
+  case BaseType::Kind::INT64:
+    return r1.load_long(off1) == r2.load_long(off2);
+  case BaseType::Kind::FLOAT32:
+    return equal_double(r1.load_float(off1), r2.load_float(off2));
+  case BaseType::Kind::FLOAT64:
+    return equal_double(r1.load_double(off1), r2.load_double(off2));
+  case BaseType::Kind::STRING:
+    {
+      offset_t s1 = r1.load_offset(off1), s2 = r2.load_offset(off2);
+      uint32_t n = r1.load_int(s1);
+      return (uint32_t)r2.load_int(s2) == n
+	&& memcmp(r1.mem + s1 + 4, r2.mem + s2 + 4, n) == 0;
+    }
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(type);
+      for (uint64_t i = 0; i < children.size(); ++i) {
+	bool d1 = r1.is_field_defined(ts, off1, i);
+	if (d1 != r2.is_field_defined(ts, off2, i))
+	  return false;
+	if (d1 && !children[i]->equal(r1, off1 + ts->field_offset[i], r2, off2 + ts->field_offset[i]))
+	  return false;
+      }
+      return true;
+    }
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(type);
+      offset_t a1 = r1.load_offset(off1), a2 = r2.load_offset(off2);
+      uint32_t n = r1.load_int(a1);
+      if ((uint32_t)r2.load_int(a2) != n)
+	return false;
+      offset_t e1 = a1 + ta->elements_offset(n), e2 = a2 + ta->elements_offset(n);
+      uint64_t element_size = ta->element_size();
+      if (bytewise)
+	return memcmp(r1.mem + e1, r2.mem + e2, n * element_size) == 0;
+      for (uint64_t i = 0; i < n; ++i) {
+	bool d1 = r1.is_element_defined(ta, a1, i);
+	if (d1 != r2.is_element_defined(ta, a2, i))
+	  return false;
+	if (d1 && !children[0]->equal(r1, e1 + i * element_size, r2, e2 + i * element_size))
+	  return false;
+      }
+      return true;
+    }
+  default: abort();
+  }
+}
+
+int
+ValueOpsNode::compare(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const {
+  switch (type->kind) {
+  case BaseType::Kind::BOOLEAN:
+    return compare_values(r1.load_bool(off1), r2.load_bool(off2));
+  case BaseType::Kind::INT32:
+    return compare_values(r1.load_int(off1), r2.load_int(off2));
+  case BaseType::Kind::INT64:
+    return compare_values(r1.load_long(off1), r2.load_long(off2));
+  case BaseType::Kind::FLOAT32:
+    return compare_double(r1.load_float(off1), r2.load_float(off2));
+  case BaseType::Kind::FLOAT64:
+    return compare_double(r1.load_double(off1), r2.load_double(off2));
+  case BaseType::Kind::STRING:
+    {
+      offset_t s1 = r1.load_offset(off1), s2 = r2.load_offset(off2);
+      uint32_t n1 = r1.load_int(s1), n2 = r2.load_int(s2);
+      int c = memcmp(r1.mem + s1 + 4, r2.mem + s2 + 4, std::min(n1, n2));
+      return c != 0 ? c : compare_values(n1, n2);
+    }
+  case BaseType::Kind::STRUCT:
+    {
+      const TStruct *ts = cast<TStruct>(type);
+      for (uint64_t i = 0; i < children.size(); ++i) {
+	bool d1 = r1.is_field_defined(ts, off1, i), d2 = r2.is_field_defined(ts, off2, i);
+	if (d1 != d2)
+	  return d1 ? -1 : 1;
+	if (d1) {
+	  int c = children[i]->compare(r1, off1 + ts->field_offset[i], r2, off2 + ts->field_offset[i]);
+	  if (c != 0)
+	    return c;
+	}
+      }
+      return 0;
+    }
+  case BaseType::Kind::ARRAY:
+    {
+      const TArray *ta = cast<TArray>(type);
+      offset_t a1 = r1.load_offset(off1), a2 = r2.load_offset(off2);
+      uint32_t n1 = r1.load_int(a1), n2 = r2.load_int(a2);
+      offset_t e1 = a1 + ta->elements_offset(n1), e2 = a2 + ta->elements_offset(n2);
+      uint64_t element_size = ta->element_size();
+      for (uint64_t i = 0; i < std::min(n1, n2); ++i) {
+	bool d1 = r1.is_element_defined(ta, a1, i), d2 = r2.is_element_defined(ta, a2, i);
+	if (d1 != d2)
+	  return d1 ? -1 : 1;
+	if (d1) {
+	  int c = children[0]->compare(r1, e1 + i * element_size, r2, e2 + i * element_size);
+	  if (c != 0)
+	    return c;
+	}
+      }
+      return compare_values(n1, n2);
+    }
+  default: abort();
+  }
+}
+
+ValueOps::ValueOps(const Type *t)
+  : root(std::make_shared<const ValueOpsNode>(t->fundamental_type)),
+    type(t->fundamental_type) {}
+
+uint64_t
+ValueOps::hash(const Region &region, offset_t off) const {
+  return root->hash(region, off);
+}
+
+bool
+ValueOps::equal(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const {
+  return root->equal(r1, off1, r2, off2);
+}
+
+int
+ValueOps::compare(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const {
+  return root->compare(r1, off1, r2, off2);
+}
+
+uint64_t
+ValueOps::hash(TypedRegionValue v) const {
+  assert(v.type->fundamental_type == type);
+  return hash(*v.get_region(), v.get_offset());
+}
+
+bool
+ValueOps::equal(TypedRegionValue v1, TypedRegionValue v2) const {
+  assert(v1.type->fundamental_type == type && v2.type->fundamental_type == type);
+  return equal(*v1.get_region(), v1.get_offset(), *v2.get_region(), v2.get_offset());
+}
+
+int
+ValueOps::compare(TypedRegionValue v1, TypedRegionValue v2) const {
+  assert(v1.type->fundamental_type == type && v2.type->fundamental_type == type);
+  return compare(*v1.get_region(), v1.get_offset(), *v2.get_region(), v2.get_offset());
+}
+
+void
+ValueOps::hash(const Region &region, const offset_t *offsets, uint64_t n, uint64_t *hashes) const {
+  if (type->kind != BaseType::Kind::STRUCT) {
+    for (uint64_t i = 0; i < n; ++i)
+      hashes[i] = root->hash(region, offsets[i]);
+    return;
+  }
+
+  // as ValueOpsNode::hash, a field at a time
+  const TStruct *ts = cast<TStruct>(type);
+  std::fill(hashes, hashes + n, secret[0]);
+  for (uint64_t f = 0; f < ts->fields.size(); ++f) {
+    const ValueOpsNode *child = root->children[f].get();
+    uint64_t field_offset = ts->field_offset[f];
+    for (uint64_t i = 0; i < n; ++i)
+      hashes[i] = mix(hashes[i], region.is_field_defined(ts, offsets[i], f)
+		      ? child->hash(region, offsets[i] + field_offset)
+		      : missing_hash);
+  }
+}
+
+void
+ValueOps::equal(const Region &r1, const offset_t *offsets1,
+		const Region &r2, const offset_t *offsets2, uint64_t n, uint8_t *equal) const {
+  if (type->kind != BaseType::Kind::STRUCT) {
+    for (uint64_t i = 0; i < n; ++i)
+      equal[i] = root->equal(r1, offsets1[i], r2, offsets2[i]);
+    return;
+  }
+
+  const TStruct *ts = cast<TStruct>(type);
+  std::fill(equal, equal + n, 1);
+  for (uint64_t f = 0; f < ts->fields.size(); ++f) {
+    const ValueOpsNode *child = root->children[f].get();
+    uint64_t field_offset = ts->field_offset[f];
+    for (uint64_t i = 0; i < n; ++i) {
+      if (!equal[i])
+	continue;
+      bool d1 = r1.is_field_defined(ts, offsets1[i], f);
+      equal[i] = d1 == r2.is_field_defined(ts, offsets2[i], f)
+	&& (!d1 || child->equal(r1, offsets1[i] + field_offset, r2, offsets2[i] + field_offset));
+    }
+  }
+}
+
+void
+ValueOps::sort(const Region &region, offset_t *offsets, uint64_t n) const {
+  std::stable_sort(offsets, offsets + n, [this, &region](offset_t a, offset_t b) {
+      return root->compare(region, a, region, b) < 0;
+    });
+}
+
+} // namespace hail
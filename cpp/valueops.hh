@@ -0,0 +1,51 @@
+#ifndef HAIL_VALUEOPS_HH
+#define HAIL_VALUEOPS_HH
+#pragma once
+
+#include <memory>
+
+#include "region.hh"
+
+namespace hail {
+
+class ValueOpsNode;
+
+// Hashing, equality and ordering of values of a type, planned once per
+// type.  Missing values are equal to each other and order after every
+// defined value.  Structs and arrays compare field by field and element
+// by element, a shorter array ordering first when it is a prefix of
+// the other; strings compare bytewise.  Floats compare numerically,
+// with -0 equal to 0 and NaN equal to itself and after every number;
+// hashes agree with equality.
+class ValueOps {
+  std::shared_ptr<const ValueOpsNode> root;
+
+public:
+  // fundamental type of the values
+  const Type *type;
+
+  ValueOps(const Type *t);
+
+  uint64_t hash(const Region &region, offset_t off) const;
+  bool equal(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const;
+  // negative, zero or positive as the first value orders before, with
+  // or after the second
+  int compare(const Region &r1, offset_t off1, const Region &r2, offset_t off2) const;
+
+  uint64_t hash(TypedRegionValue v) const;
+  bool equal(TypedRegionValue v1, TypedRegionValue v2) const;
+  int compare(TypedRegionValue v1, TypedRegionValue v2) const;
+
+  // batches of n values at offsets in a region: the fields of structs
+  // are processed a field at a time across the batch
+  void hash(const Region &region, const offset_t *offsets, uint64_t n, uint64_t *hashes) const;
+  // equal[i] is whether value offsets1[i] in r1 equals offsets2[i] in r2
+  void equal(const Region &r1, const offset_t *offsets1,
+	     const Region &r2, const offset_t *offsets2, uint64_t n, uint8_t *equal) const;
+  // stable sort of offsets by the values at them
+  void sort(const Region &region, offset_t *offsets, uint64_t n) const;
+};
+
+} // namespace hail
+
+#endif // HAIL_VALUEOPS_HH
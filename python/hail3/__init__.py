@@ -1,3 +1,5 @@
 from hail3.types import *
 
-__all__ = ['Context', 'MatrixTable', 'BaseType', 'Type', 'TMatrixTable']
+__all__ = ['Context', 'MatrixTable', 'RowCache', 'Table', 'BaseType', 'Type', 'TMatrixTable', 'TTable',
+           'set_huge_page_policy', 'page_stats',
+           'set_block_cache_capacity', 'clear_block_cache', 'block_cache_stats']
@@ -17,6 +17,9 @@ cdef extern from "type.hh" namespace "hail":
     cdef cppclass TMatrixTable(BaseType):
         pass
 
+    cdef cppclass TTable(BaseType):
+        pass
+
     cdef cppclass Type(BaseType):
         bool required
         uint64_t alignment
@@ -118,13 +121,80 @@ cdef extern from "context.hh" namespace "hail":
         const TCall *call_type(bool required)
         const TAltAllele *alt_allele_type(bool required)
 
+cdef extern from "codec.hh" namespace "hail":
+    cdef cppclass BlockCodec:
+        const char *name()
+
+cdef extern from "codec.hh":
+    const BlockCodec *lookup_codec "hail::BlockCodec::lookup"(string name) except +
+
+cdef extern from "pages.hh" namespace "hail":
+    cdef cppclass HugePagePolicy "hail::HugePagePolicy":
+        pass
+
+    cdef cppclass PageStats:
+        uint64_t n_allocated[4]
+        uint64_t n_buffers[4]
+        uint64_t bytes[4]
+        uint64_t n_fallbacks
+        uint64_t anon_huge_bytes
+
+    void set_huge_page_policy(HugePagePolicy policy, size_t min_size)
+    PageStats page_stats()
+
+cdef extern from "pages.hh":
+    cdef HugePagePolicy HUGE_PAGES_NONE "hail::HugePagePolicy::NONE"
+    cdef HugePagePolicy HUGE_PAGES_TRANSPARENT "hail::HugePagePolicy::TRANSPARENT"
+    cdef HugePagePolicy HUGE_PAGES_HUGETLBFS "hail::HugePagePolicy::HUGETLBFS"
+
+cdef extern from "blockcache.hh" namespace "hail":
+    cdef cppclass BlockCacheStats "hail::BlockCache::Stats":
+        uint64_t hits
+        uint64_t misses
+        uint64_t evictions
+        uint64_t bytes
+        uint64_t capacity
+
+    cdef cppclass BlockCache:
+        void set_capacity(uint64_t n_bytes)
+        void clear()
+        BlockCacheStats stats()
+
+cdef extern from "blockcache.hh":
+    BlockCache &global_block_cache "hail::BlockCache::global"()
+
+cdef extern from "rowcache.hh" namespace "hail":
+    cdef cppclass RowCache:
+        RowCache(string dirname, uint64_t max_bytes) except +
+        uint64_t size()
+        void evict()
+
 cdef extern from "matrixtable.hh" namespace "hail":
     cdef cppclass MatrixTable:
-        MatrixTable(Context c, string filename)
+        MatrixTable(Context c, string filename) except +
         shared_ptr[MatrixTableIterator] iterator()
         uint64_t count_rows()
+        void write(string new_filename, const BlockCodec *new_codec) except +
+        void use_row_cache(shared_ptr[RowCache] cache) except +
+        uint64_t load_into_memory() except +
         const TMatrixTable *typ "type"
+        const BlockCodec *codec
 
     cdef cppclass MatrixTableIterator:
         bool has_next()
         TypedRegionValue next()
+        void lazy_entries()
+        void select_samples(vector[uint64_t] samples) except +
+        vector[string] col_annotations()
+
+cdef extern from "table.hh" namespace "hail":
+    cdef cppclass Table:
+        Table(Context c, string filename) except +
+        shared_ptr[TableIterator] iterator()
+        uint64_t count_rows()
+        const TTable *typ "type"
+        const BlockCodec *codec
+
+    cdef cppclass TableIterator:
+        bool has_next()
+        TypedRegionValue next()
@@ -1,5 +1,7 @@
 # distutils: language=c++
 # cython: language_level=3
+import json
+
 from libcpp cimport bool
 from libcpp.memory cimport shared_ptr, make_shared
 from libcpp.string cimport string
@@ -24,6 +26,9 @@ cdef class Context(object):
 
     def read(self, filename):
         return MatrixTable(self, filename)
+
+    def read_table(self, filename):
+        return Table(self, filename)
   
     cdef _get_type(self, const libhail.BaseType *ct):
         cdef uintptr_t h = <uintptr_t>ct
@@ -31,6 +36,8 @@ cdef class Context(object):
             return self._types[h]
         if ct.kind == libhail.MATRIXTABLE:
             t = TMatrixTable_init(<const libhail.TMatrixTable *>ct)
+        elif ct.kind == libhail.TABLE:
+            t = TTable_init(<const libhail.TTable *>ct)
         else:
             t = Type_init(<const libhail.Type *>ct)
         self._types[h] = t
@@ -101,6 +108,52 @@ cdef region_value_to_python(libhail.TypedRegionValue ctrv):
     else:
         raise RuntimeError('unknown type kind')
 
+def set_huge_page_policy(str policy, size_t min_size=2 << 20):
+    if policy == 'none':
+        libhail.set_huge_page_policy(libhail.HUGE_PAGES_NONE, min_size)
+    elif policy == 'transparent':
+        libhail.set_huge_page_policy(libhail.HUGE_PAGES_TRANSPARENT, min_size)
+    elif policy == 'hugetlbfs':
+        libhail.set_huge_page_policy(libhail.HUGE_PAGES_HUGETLBFS, min_size)
+    else:
+        raise ValueError('unknown huge page policy: {}'.format(policy))
+
+def page_stats():
+    cdef libhail.PageStats s = libhail.page_stats()
+    kinds = ['malloc', 'pages', 'transparent_huge', 'hugetlb']
+    return {'allocated': {k: s.n_allocated[i] for i, k in enumerate(kinds)},
+            'buffers': {k: s.n_buffers[i] for i, k in enumerate(kinds)},
+            'bytes': {k: s.bytes[i] for i, k in enumerate(kinds)},
+            'fallbacks': s.n_fallbacks,
+            'anon_huge_bytes': s.anon_huge_bytes}
+
+def set_block_cache_capacity(uint64_t n_bytes):
+    libhail.global_block_cache().set_capacity(n_bytes)
+
+def clear_block_cache():
+    libhail.global_block_cache().clear()
+
+def block_cache_stats():
+    cdef libhail.BlockCacheStats s = libhail.global_block_cache().stats()
+    return {'hits': s.hits,
+            'misses': s.misses,
+            'evictions': s.evictions,
+            'bytes': s.bytes,
+            'capacity': s.capacity}
+
+cdef class RowCache(object):
+    cdef shared_ptr[libhail.RowCache] cache
+
+    def __init__(self, str dirname, uint64_t max_bytes):
+        self.cache = make_shared[libhail.RowCache](<string>dirname.encode('ascii'), max_bytes)
+
+    @property
+    def size(self):
+        return self.cache.get().size()
+
+    def evict(self):
+        self.cache.get().evict()
+
 cdef class MatrixTable(object):
     cdef Context context
     cdef shared_ptr[libhail.MatrixTable] mt
@@ -110,8 +163,15 @@ cdef class MatrixTable(object):
         self.mt = make_shared[libhail.MatrixTable](c.context[0], <string>filename.encode('ascii'))
 
     # FIXME leaves file open
-    def rows(self):
+    # without entries, gs of every row is None and is never decoded;
+    # with samples, a sorted list of column indices, gs holds only
+    # their entries
+    def rows(self, bool entries=True, samples=None):
         cdef shared_ptr[libhail.MatrixTableIterator] ci = self.mt.get().iterator()
+        if not entries:
+            ci.get().lazy_entries()
+        if samples is not None:
+            ci.get().select_samples(samples)
         rs = []
         while ci.get().has_next():
             rs.append(region_value_to_python(ci.get().next()))
@@ -120,10 +180,58 @@ cdef class MatrixTable(object):
     def count_rows(self):
         return self.mt.get().count_rows()
 
+    # sample annotations of the columns, or of samples
+    def col_annotations(self, samples=None):
+        cdef shared_ptr[libhail.MatrixTableIterator] ci = self.mt.get().iterator()
+        if samples is not None:
+            ci.get().select_samples(samples)
+        return [json.loads(a) for a in ci.get().col_annotations()]
+
+    def write(self, str filename, str codec='lz4'):
+        cdef const libhail.BlockCodec *c = libhail.lookup_codec(codec.encode('ascii'))
+        self.mt.get().write(<string>filename.encode('ascii'), c)
+
+    def use_row_cache(self, RowCache cache):
+        self.mt.get().use_row_cache(cache.cache)
+
+    def load_into_memory(self):
+        return self.mt.get().load_into_memory()
+
+    @property
+    def codec(self):
+        return self.mt.get().codec.name().decode('ascii')
+
     @property
     def typ(self):
         return self.context._get_type(self.mt.get().typ)
 
+cdef class Table(object):
+    cdef Context context
+    cdef shared_ptr[libhail.Table] t
+
+    def __init__(self, Context c, str filename):
+        self.context = c
+        self.t = make_shared[libhail.Table](c.context[0], <string>filename.encode('ascii'))
+
+    # FIXME leaves file open
+    def rows(self):
+        cdef shared_ptr[libhail.TableIterator] ci = self.t.get().iterator()
+        rs = []
+        while ci.get().has_next():
+            rs.append(region_value_to_python(ci.get().next()))
+        return rs
+
+    def count_rows(self):
+        return self.t.get().count_rows()
+
+    @property
+    def codec(self):
+        return self.t.get().codec.name().decode('ascii')
+
+    @property
+    def typ(self):
+        return self.context._get_type(self.t.get().typ)
+
 cdef class BaseType:
     cdef const libhail.BaseType *ct
 
@@ -156,3 +264,11 @@ cdef TMatrixTable_init(const libhail.TMatrixTable *ct):
 
 cdef class TMatrixTable(BaseType):
     pass
+
+cdef TTable_init(const libhail.TTable *ct):
+    t = TTable()
+    t.ct = ct
+    return t
+
+cdef class TTable(BaseType):
+    pass
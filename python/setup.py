@@ -6,7 +6,7 @@ extensions = [
     Extension("hail3.types", ['hail3/types.pyx'],
               language='c++',
               include_dirs = ['../cpp'],
-              libraries = ['hail3', 'fmt', 'lz4', 'z'],
+              libraries = ['hail3', 'fmt', 'lz4', 'zstd', 'z'],
               library_dirs = ['../cpp'])
 ]
 